@@ -621,6 +621,11 @@ enum {
 #include "ELFRelocs/BPF.def"
 };
 
+// ELF Relocation types for Z80
+enum {
+#include "ELFRelocs/Z80.def"
+};
+
 #undef ELF_RELOC
 
 // Section header.
@@ -9,10 +9,18 @@
 
 #include "MCTargetDesc/Z80MCTargetDesc.h"
 #include "Z80Operand.h"
+#include "llvm/ADT/StringSwitch.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCInst.h"
+#include "llvm/MC/MCParser/AsmLexer.h"
+#include "llvm/MC/MCParser/MCAsmLexer.h"
 #include "llvm/MC/MCParser/MCAsmParser.h"
 #include "llvm/MC/MCParser/MCTargetAsmParser.h"
+#include "llvm/MC/MCStreamer.h"
+#include "llvm/MC/MCSubtargetInfo.h"
 #include "llvm/MC/SubtargetFeature.h"
+#include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetRegistry.h"
 using namespace llvm;
 
@@ -22,11 +30,31 @@ class Z80AsmParser : public MCTargetAsmParser {
   const MCInstrInfo &MII;
   ParseInstructionInfo *InstInfo;
 
+  bool is24Bit() const {
+    return getSTI().getFeatureBits()[Z80::Mode24Bit];
+  }
+
+  /// MatchRegisterName - Return the register named Name, using the 24-bit
+  /// registers if Long, or 0 if there is no such register.
+  static unsigned MatchRegisterName(StringRef Name, bool Long);
+  /// MatchCondCode - Return the condition code named Name, or ~0U if there is
+  /// no such condition code.
+  static unsigned MatchCondCode(StringRef Name);
+
+  bool ParseOperand(OperandVector &Operands, bool Long);
+  bool ParseParenOperand(OperandVector &Operands, bool Long);
+  bool ParseDirectiveAssume(SMLoc L);
+  void SwitchMode(bool ADL);
+
   bool MatchAndEmitInstruction(SMLoc IDLoc, unsigned &Opcode,
                                OperandVector &Operands, MCStreamer &Out,
                                uint64_t &ErrorInfo,
                                bool MatchingInlineAsm) override;
 
+  unsigned checkTargetMatchPredicate(MCInst &Inst) override;
+  unsigned validateTargetOperandClass(MCParsedAsmOperand &Op,
+                                      unsigned Kind) override;
+
   /// @name Auto-generated Matcher Functions
   /// {
 
@@ -38,7 +66,10 @@ class Z80AsmParser : public MCTargetAsmParser {
 public:
   Z80AsmParser(const MCSubtargetInfo &sti, MCAsmParser &Parser,
                const MCInstrInfo &mii, const MCTargetOptions &Options)
-      : MCTargetAsmParser(Options, sti), MII(mii), InstInfo(nullptr) {}
+      : MCTargetAsmParser(Options, sti), MII(mii), InstInfo(nullptr) {
+    // Initialize the set of available features.
+    setAvailableFeatures(ComputeAvailableFeatures(getSTI().getFeatureBits()));
+  }
 
   bool ParseRegister(unsigned &RegNo, SMLoc &StartLoc, SMLoc &EndLoc) override;
 
@@ -50,25 +81,320 @@ public:
 
 } // end anonymous namespace
 
-bool Z80AsmParser::MatchAndEmitInstruction(SMLoc IDLoc, unsigned &Opcode,
-                                           OperandVector &Operands,
-                                           MCStreamer &Out, uint64_t &ErrorInfo,
-                                           bool MatchingInlineAsm) {
-  llvm_unreachable("Unimplemented");
+unsigned Z80AsmParser::MatchRegisterName(StringRef Name, bool Long) {
+  return StringSwitch<unsigned>(Name.lower())
+    .Case("a",   Z80::A)
+    .Case("f",   Z80::F)
+    .Case("b",   Z80::B)
+    .Case("c",   Z80::C)
+    .Case("d",   Z80::D)
+    .Case("e",   Z80::E)
+    .Case("h",   Z80::H)
+    .Case("l",   Z80::L)
+    .Case("ixh", Z80::IXH)
+    .Case("ixl", Z80::IXL)
+    .Case("iyh", Z80::IYH)
+    .Case("iyl", Z80::IYL)
+    .Case("af",  Z80::AF)
+    .Case("bc",  Long ? Z80::UBC : Z80::BC)
+    .Case("de",  Long ? Z80::UDE : Z80::DE)
+    .Case("hl",  Long ? Z80::UHL : Z80::HL)
+    .Case("ix",  Long ? Z80::UIX : Z80::IX)
+    .Case("iy",  Long ? Z80::UIY : Z80::IY)
+    .Case("sp",  Long ? Z80::SPL : Z80::SPS)
+    .Default(0);
+}
+
+unsigned Z80AsmParser::MatchCondCode(StringRef Name) {
+  // The c condition is parsed as a register.
+  return StringSwitch<unsigned>(Name.lower())
+    .Case("nz", 0)
+    .Case("z",  1)
+    .Case("nc", 2)
+    .Case("po", 4)
+    .Case("pe", 5)
+    .Case("p",  6)
+    .Case("m",  7)
+    .Default(~0U);
 }
 
 bool Z80AsmParser::ParseRegister(unsigned &RegNo, SMLoc &StartLoc,
                                  SMLoc &EndLoc) {
-  llvm_unreachable("Unimplemented");
+  const AsmToken &Tok = getParser().getTok();
+  StartLoc = Tok.getLoc();
+  EndLoc = Tok.getEndLoc();
+  if (Tok.isNot(AsmToken::Identifier) ||
+      !(RegNo = MatchRegisterName(Tok.getString(), is24Bit())))
+    return Error(StartLoc, "invalid register name", SMRange(StartLoc, EndLoc));
+  getParser().Lex(); // Eat identifier token.
+  return false;
+}
+
+/// ParseParenOperand - Parse an operand starting with a parenthesis, which is
+/// one of (nn), (hl), (ix), (iy), (ix+d), (iy+d), or (sp).
+bool Z80AsmParser::ParseParenOperand(OperandVector &Operands, bool Long) {
+  MCAsmParser &Parser = getParser();
+  SMLoc StartLoc = Parser.getTok().getLoc();
+  Parser.Lex(); // Eat '('.
+
+  const AsmToken &Tok = Parser.getTok();
+  unsigned RegNo = 0;
+  if (Tok.is(AsmToken::Identifier))
+    RegNo = MatchRegisterName(Tok.getString(), Long);
+  if (!RegNo) {
+    const MCExpr *Val;
+    if (Parser.parseExpression(Val))
+      return true;
+    SMLoc EndLoc = Parser.getTok().getEndLoc();
+    if (Parser.parseToken(AsmToken::RParen, "expected ')'"))
+      return true;
+    Operands.push_back(Z80Operand::CreateMem(Val, StartLoc, EndLoc));
+    return false;
+  }
+  Parser.Lex(); // Eat register.
+
+  switch (RegNo) {
+  case Z80::SPS:
+  case Z80::SPL: {
+    // (sp) only appears as a literal token, as in ex (sp), hl.
+    SMLoc EndLoc = Parser.getTok().getEndLoc();
+    if (Parser.parseToken(AsmToken::RParen, "expected ')'"))
+      return true;
+    auto Op = Z80Operand::CreateToken("(sp)", StartLoc);
+    Op->EndLoc = EndLoc;
+    Operands.push_back(std::move(Op));
+    return false;
+  }
+  case Z80::HL: case Z80::UHL:
+  case Z80::IX: case Z80::UIX:
+  case Z80::IY: case Z80::UIY:
+    break;
+  default:
+    return Error(StartLoc, "invalid register in memory operand");
+  }
+
+  if (Parser.getTok().is(AsmToken::RParen)) {
+    SMLoc EndLoc = Parser.getTok().getEndLoc();
+    Parser.Lex(); // Eat ')'.
+    Operands.push_back(Z80Operand::CreatePtr(RegNo, StartLoc, EndLoc));
+    return false;
+  }
+
+  if (RegNo == Z80::HL || RegNo == Z80::UHL)
+    return TokError("expected ')'");
+  if (Parser.getTok().isNot(AsmToken::Plus) &&
+      Parser.getTok().isNot(AsmToken::Minus))
+    return TokError("expected '+' or '-'");
+  // The sign is parsed as part of the displacement expression.
+  const MCExpr *Disp;
+  if (Parser.parseExpression(Disp))
+    return true;
+  SMLoc EndLoc = Parser.getTok().getEndLoc();
+  if (Parser.parseToken(AsmToken::RParen, "expected ')'"))
+    return true;
+  Operands.push_back(Z80Operand::CreateOff(RegNo, Disp, StartLoc, EndLoc));
+  return false;
+}
+
+bool Z80AsmParser::ParseOperand(OperandVector &Operands, bool Long) {
+  MCAsmParser &Parser = getParser();
+  const AsmToken &Tok = Parser.getTok();
+  SMLoc StartLoc = Tok.getLoc();
+
+  if (Tok.is(AsmToken::LParen))
+    return ParseParenOperand(Operands, Long);
+
+  if (Tok.is(AsmToken::Identifier)) {
+    StringRef Name = Tok.getString();
+    if (unsigned RegNo = MatchRegisterName(Name, Long)) {
+      SMLoc EndLoc = Tok.getEndLoc();
+      // The lexer would take the quote in the shadow af' for the start of a
+      // character literal, so restart it just past the quote.
+      if (RegNo == Z80::AF && *EndLoc.getPointer() == '\'') {
+        const SourceMgr &SrcMgr = getSourceManager();
+        unsigned Buffer = SrcMgr.FindBufferContainingLoc(EndLoc);
+        static_cast<AsmLexer &>(getLexer()).setBuffer(
+            SrcMgr.getMemoryBuffer(Buffer)->getBuffer(),
+            EndLoc.getPointer() + 1);
+        Parser.Lex(); // Eat af'.
+        Operands.push_back(Z80Operand::CreateToken("af'", StartLoc));
+        return false;
+      }
+      Parser.Lex(); // Eat register.
+      // An index register followed by a displacement, as in lea hl, ix+d.
+      if ((Parser.getTok().is(AsmToken::Plus) ||
+           Parser.getTok().is(AsmToken::Minus)) &&
+          (RegNo == Z80::IX || RegNo == Z80::UIX ||
+           RegNo == Z80::IY || RegNo == Z80::UIY)) {
+        const MCExpr *Disp;
+        if (Parser.parseExpression(Disp, EndLoc))
+          return true;
+        Operands.push_back(Z80Operand::CreateAddr(RegNo, Disp, StartLoc,
+                                                  EndLoc));
+        return false;
+      }
+      Operands.push_back(Z80Operand::CreateReg(RegNo, StartLoc, EndLoc));
+      return false;
+    }
+    unsigned CC = MatchCondCode(Name);
+    if (CC != ~0U) {
+      SMLoc EndLoc = Tok.getEndLoc();
+      MCSymbol *Sym = getContext().getOrCreateSymbol(Name);
+      Parser.Lex(); // Eat condition code.
+      Operands.push_back(Z80Operand::CreateCC(
+          CC, MCSymbolRefExpr::create(Sym, getContext()), StartLoc, EndLoc));
+      return false;
+    }
+  }
+
+  const MCExpr *Val;
+  SMLoc EndLoc;
+  if (Parser.parseExpression(Val, EndLoc))
+    return true;
+  Operands.push_back(Z80Operand::CreateImm(Val, StartLoc, EndLoc));
+  return false;
 }
 
 bool Z80AsmParser::ParseInstruction(ParseInstructionInfo &Info, StringRef Name,
                                     SMLoc NameLoc, OperandVector &Operands) {
-  llvm_unreachable("Unimplemented");
+  MCAsmParser &Parser = getParser();
+  InstInfo = &Info;
+
+  // Register operands are 24-bit in ADL mode, unless overridden by an eZ80
+  // suffix whose first letter gives the data size.
+  std::string Mnemonic = Name.lower();
+  bool Long = is24Bit();
+  size_t Dot = Mnemonic.find('.');
+  if (Dot != std::string::npos) {
+    StringRef Suffix = StringRef(Mnemonic).substr(Dot + 1);
+    if (Suffix != "sis" && Suffix != "sil" &&
+        Suffix != "lis" && Suffix != "lil")
+      return Error(NameLoc, "invalid instruction suffix");
+    Long = Suffix[0] == 'l';
+  }
+  Operands.push_back(Z80Operand::CreateToken(Mnemonic, NameLoc));
+
+  if (getLexer().isNot(AsmToken::EndOfStatement)) {
+    if (ParseOperand(Operands, Long))
+      return true;
+    while (getLexer().is(AsmToken::Comma)) {
+      Parser.Lex(); // Eat the comma.
+      if (ParseOperand(Operands, Long))
+        return true;
+    }
+    if (getLexer().isNot(AsmToken::EndOfStatement))
+      return TokError("unexpected token in argument list");
+  }
+
+  Parser.Lex(); // Consume the EndOfStatement.
+  return false;
 }
 
 bool Z80AsmParser::ParseDirective(AsmToken DirectiveID) {
-  llvm_unreachable("Unimplemented");
+  StringRef IDVal = DirectiveID.getIdentifier();
+  if (IDVal.lower() == ".assume")
+    return ParseDirectiveAssume(DirectiveID.getLoc());
+  return true;
+}
+
+/// ParseDirectiveAssume
+///  ::= .assume adl = expression
+bool Z80AsmParser::ParseDirectiveAssume(SMLoc L) {
+  MCAsmParser &Parser = getParser();
+  if (getLexer().isNot(AsmToken::Identifier) ||
+      Parser.getTok().getString().lower() != "adl")
+    return TokError("expected 'adl'");
+  Parser.Lex(); // Eat 'adl'.
+  if (Parser.parseToken(AsmToken::Equal, "expected '='"))
+    return true;
+
+  SMLoc ValueLoc = Parser.getTok().getLoc();
+  int64_t ADL;
+  if (Parser.parseAbsoluteExpression(ADL))
+    return true;
+  if (ADL != 0 && ADL != 1)
+    return Error(ValueLoc, "adl must be 0 or 1");
+  if (Parser.parseToken(AsmToken::EndOfStatement,
+                        "unexpected token in '.assume' directive"))
+    return true;
+  if (ADL && !getSTI().getFeatureBits()[Z80::FeatureEZ80])
+    return Error(L, "adl mode requires an eZ80");
+
+  SwitchMode(ADL);
+  getParser().getStreamer().EmitAssemblerFlag(ADL ? MCAF_Code24 : MCAF_Code16);
+  return false;
+}
+
+void Z80AsmParser::SwitchMode(bool ADL) {
+  if (ADL == is24Bit())
+    return;
+  MCSubtargetInfo &STI = copySTI();
+  FeatureBitset AllModes({Z80::Mode24Bit, Z80::Mode16Bit});
+  setAvailableFeatures(ComputeAvailableFeatures(STI.ToggleFeature(AllModes)));
+  assert(is24Bit() == ADL && "Failed to switch mode");
+}
+
+bool Z80AsmParser::MatchAndEmitInstruction(SMLoc IDLoc, unsigned &Opcode,
+                                           OperandVector &Operands,
+                                           MCStreamer &Out, uint64_t &ErrorInfo,
+                                           bool MatchingInlineAsm) {
+  MCInst Inst;
+  // The eZ80 dialect is the one used in ADL mode.
+  switch (MatchInstructionImpl(Operands, Inst, ErrorInfo, MatchingInlineAsm,
+                               is24Bit())) {
+  default: break;
+  case Match_Success:
+    Inst.setLoc(IDLoc);
+    Opcode = Inst.getOpcode();
+    if (!MatchingInlineAsm)
+      Out.EmitInstruction(Inst, getSTI());
+    return false;
+  case Match_MissingFeature:
+    return Error(IDLoc, "instruction requires a CPU feature not currently "
+                        "enabled");
+  case Match_InvalidOperand: {
+    SMLoc ErrorLoc = IDLoc;
+    if (ErrorInfo != ~0ULL) {
+      if (ErrorInfo >= Operands.size())
+        return Error(IDLoc, "too few operands for instruction");
+
+      ErrorLoc = ((Z80Operand &)*Operands[ErrorInfo]).getStartLoc();
+      if (ErrorLoc == SMLoc())
+        ErrorLoc = IDLoc;
+    }
+    return Error(ErrorLoc, "invalid operand for instruction");
+  }
+  case Match_MnemonicFail:
+    return Error(IDLoc, "invalid instruction mnemonic");
+  }
+
+  llvm_unreachable("Implement any new match types added!");
+}
+
+unsigned Z80AsmParser::checkTargetMatchPredicate(MCInst &Inst) {
+  switch (Inst.getOpcode()) {
+  case Z80::LD8rr:
+  case Z80::LD8xx:
+  case Z80::LD8yy: {
+    // A single prefix selects the index register halves in place of h and l,
+    // so an instruction can't mix them, or halves of different index
+    // registers.
+    auto getClass = [](unsigned Reg) {
+      switch (Reg) {
+      case Z80::H:   case Z80::L:   return 1;
+      case Z80::IXH: case Z80::IXL: return 2;
+      case Z80::IYH: case Z80::IYL: return 3;
+      default:                      return 0;
+      }
+    };
+    int DstClass = getClass(Inst.getOperand(0).getReg());
+    int SrcClass = getClass(Inst.getOperand(1).getReg());
+    if (DstClass && SrcClass && DstClass != SrcClass)
+      return Match_InvalidOperand;
+    break;
+  }
+  }
+  return Match_Success;
 }
 
 // Force static initialization.
@@ -77,15 +403,36 @@ extern "C" void LLVMInitializeZ80AsmParser() {
   RegisterMCAsmParser<Z80AsmParser> Y(TheEZ80Target);
 }
 
-namespace {
-struct MatchEntry;
-}
-namespace std {
-inline const MatchEntry *begin(const MatchEntry array[]) { return array; }
-inline const MatchEntry *end(const MatchEntry array[]) { return array; }
-}
-
 #define GET_REGISTER_MATCHER
 #define GET_MATCHER_IMPLEMENTATION
 #define GET_SUBTARGET_FEATURE_NAME
 #include "Z80GenAsmMatcher.inc"
+
+unsigned Z80AsmParser::validateTargetOperandClass(MCParsedAsmOperand &GOp,
+                                                  unsigned Kind) {
+  // The 16-bit and 24-bit registers share names, so literal registers in the
+  // asm string, like the hl in sbc hl, sp, may be parsed as the register of
+  // the other size.  Accept those if the other size would match.
+  Z80Operand &Op = static_cast<Z80Operand &>(GOp);
+  if (!Op.isReg())
+    return Match_InvalidOperand;
+  unsigned Other;
+  switch (Op.getReg()) {
+  default: return Match_InvalidOperand;
+  case Z80::BC:  Other = Z80::UBC; break;
+  case Z80::DE:  Other = Z80::UDE; break;
+  case Z80::HL:  Other = Z80::UHL; break;
+  case Z80::IX:  Other = Z80::UIX; break;
+  case Z80::IY:  Other = Z80::UIY; break;
+  case Z80::SPS: Other = Z80::SPL; break;
+  case Z80::UBC: Other = Z80::BC;  break;
+  case Z80::UDE: Other = Z80::DE;  break;
+  case Z80::UHL: Other = Z80::HL;  break;
+  case Z80::UIX: Other = Z80::IX;  break;
+  case Z80::UIY: Other = Z80::IY;  break;
+  case Z80::SPL: Other = Z80::SPS; break;
+  }
+  Z80Operand OtherOp(Op);
+  OtherOp.Reg = Other;
+  return validateOperandClass(OtherOp, MatchClassKind(Kind));
+}
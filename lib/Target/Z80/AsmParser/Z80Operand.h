@@ -10,19 +10,193 @@
 #ifndef LLVM_LIB_TARGET_Z80_ASMPARSER_Z80OPERAND_H
 #define LLVM_LIB_TARGET_Z80_ASMPARSER_Z80OPERAND_H
 
+#include "MCTargetDesc/Z80MCTargetDesc.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCParser/MCParsedAsmOperand.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
 
 namespace llvm {
 
 /// Z80Operand - Instances of this class represent a parsed Z80 machine operand.
 struct Z80Operand : public MCParsedAsmOperand {
+  enum KindTy {
+    Token,     // mnemonic or literal token such as (sp)
+    Register,  // register
+    Immediate, // immediate or jump target
+    CondCode,  // condition code, which may also be a symbol
+    Mem,       // (nn)
+    Ptr,       // (hl), (ix), or (iy)
+    Off,       // (ix+d) or (iy+d)
+    Addr       // ix+d or iy+d
+  } Kind;
+
+  SMLoc StartLoc, EndLoc;
+
+  std::string Tok;
+  unsigned Reg = 0;
+  const MCExpr *Val = nullptr;
+  unsigned CC = 0;
+
+  Z80Operand(KindTy K, SMLoc Start, SMLoc End)
+      : Kind(K), StartLoc(Start), EndLoc(End) {}
+
+  /// getStartLoc - Get the location of the first token of this operand.
+  SMLoc getStartLoc() const override { return StartLoc; }
+  /// getEndLoc - Get the location of the last token of this operand.
+  SMLoc getEndLoc() const override { return EndLoc; }
+
   StringRef getToken() const {
-    llvm_unreachable("Unimplemented");
+    assert(Kind == Token && "Invalid access!");
+    return Tok;
+  }
+  unsigned getReg() const override {
+    assert((Kind == Register || Kind == Ptr || Kind == Off || Kind == Addr) &&
+           "Invalid access!");
+    return Reg;
+  }
+  const MCExpr *getImm() const {
+    assert((Kind == Immediate || Kind == CondCode || Kind == Mem ||
+            Kind == Off || Kind == Addr) && "Invalid access!");
+    return Val;
+  }
+  unsigned getCC() const {
+    assert(isCC() && "Invalid access!");
+    return Kind == CondCode ? CC : 3;
   }
+
+  bool isToken() const override { return Kind == Token; }
+  bool isReg() const override { return Kind == Register; }
+  // A condition code is also accepted as a symbol, such as in jp p.
+  bool isImm() const override { return Kind == Immediate || Kind == CondCode; }
+  bool isMem() const override { return Kind == Mem; }
+  bool isPtr() const { return Kind == Ptr; }
+  bool isOff() const { return Kind == Off; }
+  bool isAddr() const { return Kind == Addr; }
+  // The c register is also the carry condition.
+  bool isCC() const {
+    return Kind == CondCode || (Kind == Register && Reg == Z80::C);
+  }
+
+  void print(raw_ostream &OS) const override {
+    switch (Kind) {
+    case Token:
+      OS << "Token: " << Tok;
+      break;
+    case Register:
+      OS << "Reg: " << Reg;
+      break;
+    case Immediate:
+      OS << "Imm: " << *Val;
+      break;
+    case CondCode:
+      OS << "CC: " << CC;
+      break;
+    case Mem:
+      OS << "Mem: (" << *Val << ')';
+      break;
+    case Ptr:
+      OS << "Ptr: (" << Reg << ')';
+      break;
+    case Off:
+      OS << "Off: (" << Reg << " + " << *Val << ')';
+      break;
+    case Addr:
+      OS << "Addr: " << Reg << " + " << *Val;
+      break;
+    }
+  }
+
+  void addExpr(MCInst &Inst, const MCExpr *Expr) const {
+    // Add as immediates when possible.
+    if (const MCConstantExpr *CE = dyn_cast<MCConstantExpr>(Expr))
+      Inst.addOperand(MCOperand::createImm(CE->getValue()));
+    else
+      Inst.addOperand(MCOperand::createExpr(Expr));
+  }
+
   void addRegOperands(MCInst &Inst, unsigned N) const {
-    llvm_unreachable("Unimplemented");
+    assert(N == 1 && "Invalid number of operands!");
+    Inst.addOperand(MCOperand::createReg(getReg()));
+  }
+  void addImmOperands(MCInst &Inst, unsigned N) const {
+    assert(N == 1 && "Invalid number of operands!");
+    addExpr(Inst, getImm());
+  }
+  void addCCOperands(MCInst &Inst, unsigned N) const {
+    assert(N == 1 && "Invalid number of operands!");
+    Inst.addOperand(MCOperand::createImm(getCC()));
+  }
+  void addMemOperands(MCInst &Inst, unsigned N) const {
+    assert(N == 1 && "Invalid number of operands!");
+    addExpr(Inst, getImm());
+  }
+  void addPtrOperands(MCInst &Inst, unsigned N) const {
+    assert(N == 1 && "Invalid number of operands!");
+    Inst.addOperand(MCOperand::createReg(getReg()));
+  }
+  void addOffOperands(MCInst &Inst, unsigned N) const {
+    assert(N == 2 && "Invalid number of operands!");
+    Inst.addOperand(MCOperand::createReg(getReg()));
+    addExpr(Inst, getImm());
+  }
+  void addAddrOperands(MCInst &Inst, unsigned N) const {
+    addOffOperands(Inst, N);
+  }
+
+  static std::unique_ptr<Z80Operand> CreateToken(StringRef Str, SMLoc Loc) {
+    auto Res = make_unique<Z80Operand>(Token, Loc, Loc);
+    Res->Tok = Str;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateReg(unsigned RegNo, SMLoc StartLoc,
+                                               SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Register, StartLoc, EndLoc);
+    Res->Reg = RegNo;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateImm(const MCExpr *Val,
+                                               SMLoc StartLoc, SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Immediate, StartLoc, EndLoc);
+    Res->Val = Val;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateCC(unsigned CC, const MCExpr *Sym,
+                                              SMLoc StartLoc, SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(CondCode, StartLoc, EndLoc);
+    Res->CC = CC;
+    Res->Val = Sym;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateMem(const MCExpr *Val,
+                                               SMLoc StartLoc, SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Mem, StartLoc, EndLoc);
+    Res->Val = Val;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreatePtr(unsigned RegNo, SMLoc StartLoc,
+                                               SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Ptr, StartLoc, EndLoc);
+    Res->Reg = RegNo;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateOff(unsigned RegNo,
+                                               const MCExpr *Disp,
+                                               SMLoc StartLoc, SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Off, StartLoc, EndLoc);
+    Res->Reg = RegNo;
+    Res->Val = Disp;
+    return Res;
+  }
+  static std::unique_ptr<Z80Operand> CreateAddr(unsigned RegNo,
+                                                const MCExpr *Disp,
+                                                SMLoc StartLoc, SMLoc EndLoc) {
+    auto Res = make_unique<Z80Operand>(Addr, StartLoc, EndLoc);
+    Res->Reg = RegNo;
+    Res->Val = Disp;
+    return Res;
   }
 };
 
@@ -10,7 +10,10 @@
 #include "Z80FixupKinds.h"
 #include "Z80MCTargetDesc.h"
 #include "llvm/MC/MCAsmBackend.h"
-#include "llvm/MC/MCELFObjectWriter.h"
+#include "llvm/MC/MCAssembler.h"
+#include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCFixupKindInfo.h"
+#include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCObjectWriter.h"
 #include "llvm/MC/MCRegisterInfo.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -18,13 +21,6 @@ using namespace llvm;
 
 namespace {
 
-class Z80ELFObjectWriter : public MCELFObjectTargetWriter {
-public:
-  Z80ELFObjectWriter(bool Is24Bit)
-      : MCELFObjectTargetWriter(/*Is64Bit*/ false, 0, ELF::EM_Z80,
-                                /*HasRelocationAddend*/ false) {}
-};
-
 class Z80AsmBackend : public MCAsmBackend {
 public:
   Z80AsmBackend(const Target &T)
@@ -34,6 +30,13 @@ public:
     return Z80::NumTargetFixupKinds;
   }
 
+  const MCFixupKindInfo &getFixupKindInfo(MCFixupKind Kind) const override;
+
+  void processFixupValue(const MCAssembler &Asm, const MCAsmLayout &Layout,
+                         const MCFixup &Fixup, const MCFragment *DF,
+                         const MCValue &Target, uint64_t &Value,
+                         bool &IsResolved) override;
+
   void applyFixup(const MCFixup &Fixup, char *Data, unsigned DataSize,
                   uint64_t Value, bool IsPCRel) const override;
 
@@ -54,26 +57,93 @@ public:
 
 } // end anonymous namespace
 
+const MCFixupKindInfo &
+Z80AsmBackend::getFixupKindInfo(MCFixupKind Kind) const {
+  const static MCFixupKindInfo Infos[Z80::NumTargetFixupKinds] = {
+    // This table *must* be in the order that the fixup_* kinds are defined in
+    // Z80FixupKinds.h.
+    //
+    // Name             Offset (bits) Size (bits)     Flags
+    { "fixup_8",        0,            8,   0 },
+    { "fixup_8_dis",    0,            8,   0 },
+    { "fixup_8_pcrel",  0,            8,   MCFixupKindInfo::FKF_IsPCRel },
+    { "fixup_16",       0,            16,  0 },
+    { "fixup_24",       0,            24,  0 },
+  };
+
+  if (Kind < FirstTargetFixupKind)
+    return MCAsmBackend::getFixupKindInfo(Kind);
+
+  assert(unsigned(Kind - FirstTargetFixupKind) < getNumFixupKinds() &&
+         "Invalid kind!");
+  return Infos[Kind - FirstTargetFixupKind];
+}
+
+/// processFixupValue - Diagnose relative branches that do not reach their
+/// target.  Only jq is relaxed, so an explicit jr or djnz that is out of range
+/// is an error, as it is in other Z80 assemblers.  Fixups in relaxable
+/// fragments are also evaluated while deciding whether to relax, so they are
+/// left to relaxation.
+void Z80AsmBackend::processFixupValue(const MCAssembler &Asm,
+                                      const MCAsmLayout &Layout,
+                                      const MCFixup &Fixup,
+                                      const MCFragment *DF,
+                                      const MCValue &Target, uint64_t &Value,
+                                      bool &IsResolved) {
+  if (IsResolved && !isa<MCRelaxableFragment>(DF) &&
+      unsigned(Fixup.getKind()) == Z80::fixup_8_pcrel &&
+      int64_t(Value) != int64_t(int8_t(Value)))
+    Asm.getContext().reportError(Fixup.getLoc(),
+                                 "relative branch out of range");
+}
+
 void Z80AsmBackend::applyFixup(const MCFixup &Fixup, char *Data,
                                unsigned DataSize, uint64_t Value,
                                bool IsPCRel) const {
-  llvm_unreachable("Unimplemented");
+  unsigned Size = (getFixupKindInfo(Fixup.getKind()).TargetSize + 7) / 8;
+  unsigned Offset = Fixup.getOffset();
+  assert(Offset + Size <= DataSize && "Invalid fixup offset!");
+
+  // Fixups are little endian, and the fixed up bits are always zero.
+  for (unsigned I = 0; I != Size; ++I)
+    Data[Offset + I] |= uint8_t(Value >> (I * 8));
+}
+
+/// getRelaxedOpcode - Return the jp equivalent of a jq branch, or the original
+/// opcode if it does not need relaxation.  A jr is left as written, since its
+/// author chose its size and timing.
+static unsigned getRelaxedOpcode(const MCInst &Inst) {
+  switch (Inst.getOpcode()) {
+  default:
+    return Inst.getOpcode();
+  case Z80::JQ:
+    return Z80::JP;
+  case Z80::JQCC:
+    // A jq with a parity or sign condition is always encoded as a jp.
+    if (Inst.getOperand(1).getImm() > 3)
+      return Inst.getOpcode();
+    return Z80::JPCC;
+  }
 }
 
 bool Z80AsmBackend::mayNeedRelaxation(const MCInst &Inst) const {
-  llvm_unreachable("Unimplemented");
+  return getRelaxedOpcode(Inst) != Inst.getOpcode();
 }
 
 bool Z80AsmBackend::fixupNeedsRelaxation(const MCFixup &Fixup, uint64_t Value,
                                          const MCRelaxableFragment *DF,
                                          const MCAsmLayout &Layout) const {
-  llvm_unreachable("Unimplemented");
+  // Relax if the displacement does not fit in a signed byte.
+  return int64_t(Value) != int64_t(int8_t(Value));
 }
 
 void Z80AsmBackend::relaxInstruction(const MCInst &Inst,
                                      const MCSubtargetInfo &STI,
                                      MCInst &Res) const {
-  llvm_unreachable("Unimplemented");
+  unsigned RelaxedOp = getRelaxedOpcode(Inst);
+  assert(RelaxedOp != Inst.getOpcode() && "Unexpected instruction to relax!");
+  Res = Inst;
+  Res.setOpcode(RelaxedOp);
 }
 
 /* *** */
@@ -0,0 +1,64 @@
+//===-- Z80BaseInfo.h - Top level definitions for Z80 MC --------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains small standalone helper functions and enum definitions for
+// the Z80 target useful for the compiler back-end and the MC libraries.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_Z80_MCTARGETDESC_Z80BASEINFO_H
+#define LLVM_LIB_TARGET_Z80_MCTARGETDESC_Z80BASEINFO_H
+
+#include "llvm/Support/DataTypes.h"
+
+namespace llvm {
+
+namespace Z80II {
+  // Instruction encodings.  These are the standard/most common forms for Z80
+  // instructions, and must be kept in sync with Z80InstrFormats.td.
+  enum : uint64_t {
+    //===------------------------------------------------------------------===//
+    // Prefix - These correspond to the Prefix defs in Z80InstrFormats.td.
+    //
+    PrefixShift = 0,
+    PrefixMask  = 7 << PrefixShift,
+    NoPrefix    = 0 << PrefixShift,
+    CBPrefix    = 1 << PrefixShift,
+    DDPrefix    = 2 << PrefixShift,
+    DDCBPrefix  = 3 << PrefixShift,
+    EDPrefix    = 4 << PrefixShift,
+    FDPrefix    = 5 << PrefixShift,
+    FDCBPrefix  = 6 << PrefixShift,
+
+    //===------------------------------------------------------------------===//
+    // Mode - The operand size of the instruction, which determines whether it
+    // needs an eZ80 .sis or .lil suffix in the current mode.
+    //
+    ModeShift = PrefixShift + 3,
+    ModeMask  = 3 << ModeShift,
+    AnyMode   = 0 << ModeShift,
+    ShortMode = 1 << ModeShift,
+    LongMode  = 2 << ModeShift,
+
+    //===------------------------------------------------------------------===//
+    // Opcode - The base opcode byte, before any register fields are merged in.
+    //
+    OpcodeShift = ModeShift + 2,
+    OpcodeMask  = 0xFFULL << OpcodeShift
+  };
+
+  /// getBaseOpcode - Return the base opcode byte of an instruction.
+  inline uint8_t getBaseOpcode(uint64_t TSFlags) {
+    return (TSFlags & OpcodeMask) >> OpcodeShift;
+  }
+} // end namespace Z80II
+
+} // end namespace llvm
+
+#endif
@@ -7,8 +7,11 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "Z80FixupKinds.h"
 #include "Z80MCTargetDesc.h"
+#include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCELFObjectWriter.h"
+#include "llvm/MC/MCFixup.h"
 using namespace llvm;
 
 namespace {
@@ -33,7 +36,33 @@ Z80ELFObjectWriter::~Z80ELFObjectWriter() {}
 unsigned
 Z80ELFObjectWriter::getRelocType(MCContext &Ctx, const MCValue &Target,
                                  const MCFixup &Fixup, bool IsPCRel) const {
-  llvm_unreachable("Unimplemented");
+  unsigned Kind = Fixup.getKind();
+  if (IsPCRel) {
+    switch (Kind) {
+    case FK_Data_1:
+    case FK_PCRel_1:
+    case Z80::fixup_8:
+    case Z80::fixup_8_pcrel:
+      return ELF::R_Z80_8_PCREL;
+    }
+  } else {
+    switch (Kind) {
+    case FK_Data_1:
+    case Z80::fixup_8:
+      return ELF::R_Z80_8;
+    case Z80::fixup_8_dis:
+      return ELF::R_Z80_8_DIS;
+    case FK_Data_2:
+    case Z80::fixup_16:
+      return ELF::R_Z80_16;
+    case Z80::fixup_24:
+      return ELF::R_Z80_24;
+    case FK_Data_4:
+      return ELF::R_Z80_32;
+    }
+  }
+  Ctx.reportError(Fixup.getLoc(), "unsupported relocation type");
+  return ELF::R_Z80_NONE;
 }
 
 MCObjectWriter *llvm::createZ80ELFObjectWriter(raw_pwrite_stream &OS,
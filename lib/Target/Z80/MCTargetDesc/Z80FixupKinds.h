@@ -15,8 +15,23 @@
 namespace llvm {
 namespace Z80 {
 enum Fixups {
+  // 8-bit immediate.
+  fixup_8 = FirstTargetFixupKind,
+
+  // 8-bit signed displacement from an index register.
+  fixup_8_dis,
+
+  // 8-bit pc relative displacement of a jr or djnz.
+  fixup_8_pcrel,
+
+  // 16-bit immediate or address.
+  fixup_16,
+
+  // 24-bit immediate or address in eZ80 ADL mode.
+  fixup_24,
+
   // Marker
-  LastTargetFixupKind = FirstTargetFixupKind,
+  LastTargetFixupKind,
   NumTargetFixupKinds = LastTargetFixupKind - FirstTargetFixupKind
 };
 }
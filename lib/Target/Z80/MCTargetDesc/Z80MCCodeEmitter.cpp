@@ -1,4 +1,4 @@
-//===-- X86MCCodeEmitter.cpp - Convert X86 code to machine code -----------===//
+//===-- Z80MCCodeEmitter.cpp - Convert Z80 code to machine code -----------===//
 //
 //                     The LLVM Compiler Infrastructure
 //
@@ -7,14 +7,16 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements the X86MCCodeEmitter class.
+// This file implements the Z80MCCodeEmitter class.
 //
 //===----------------------------------------------------------------------===//
 
+#include "Z80BaseInfo.h"
 #include "Z80FixupKinds.h"
 #include "Z80MCTargetDesc.h"
 #include "llvm/MC/MCCodeEmitter.h"
 #include "llvm/MC/MCContext.h"
+#include "llvm/MC/MCExpr.h"
 #include "llvm/MC/MCInst.h"
 #include "llvm/MC/MCInstrInfo.h"
 #include "llvm/MC/MCRegisterInfo.h"
@@ -22,6 +24,8 @@
 #include "llvm/Support/raw_ostream.h"
 using namespace llvm;
 
+#define DEBUG_TYPE "mccodeemitter"
+
 namespace {
 
 class Z80MCCodeEmitter : public MCCodeEmitter {
@@ -38,14 +42,410 @@ public:
   void encodeInstruction(const MCInst &MI, raw_ostream &OS,
                          SmallVectorImpl<MCFixup> &Fixups,
                          const MCSubtargetInfo &STI) const override;
+
+private:
+  unsigned getRegEncoding(const MCOperand &MO) const {
+    return Ctx.getRegisterInfo()->getEncodingValue(MO.getReg());
+  }
+
+  void emitByte(uint8_t C, unsigned &CurByte, raw_ostream &OS) const {
+    OS << char(C);
+    ++CurByte;
+  }
+
+  void emitConstant(uint64_t Val, unsigned Size, unsigned &CurByte,
+                    raw_ostream &OS) const {
+    for (unsigned I = 0; I != Size; ++I) {
+      emitByte(Val & 0xFF, CurByte, OS);
+      Val >>= 8;
+    }
+  }
+
+  void emitImmediate(const MCOperand &MO, SMLoc Loc, unsigned Size,
+                     MCFixupKind Kind, unsigned &CurByte, raw_ostream &OS,
+                     SmallVectorImpl<MCFixup> &Fixups) const;
 };
 
 } // end anonymous namespace
 
-void Z80MCCodeEmitter::encodeInstruction(const MCInst &MC, raw_ostream &OS,
+/// getIndexPrefix - Return the DD or FD prefix byte selecting the index
+/// register Reg is part of, or 0 if Reg is not part of an index register.
+static uint8_t getIndexPrefix(unsigned Reg) {
+  switch (Reg) {
+  case Z80::IXH: case Z80::IXL: case Z80::IX: case Z80::UIX:
+    return 0xDD;
+  case Z80::IYH: case Z80::IYL: case Z80::IY: case Z80::UIY:
+    return 0xFD;
+  default:
+    return 0;
+  }
+}
+
+/// getFixupKind - Return the fixup used for a Size byte immediate.
+static MCFixupKind getFixupKind(unsigned Size, bool IsPCRel) {
+  assert((!IsPCRel || Size == 1) && "Unexpected pc relative immediate");
+  switch (Size) {
+  default: llvm_unreachable("Unexpected immediate size");
+  case 1: return MCFixupKind(IsPCRel ? Z80::fixup_8_pcrel : Z80::fixup_8);
+  case 2: return MCFixupKind(Z80::fixup_16);
+  case 3: return MCFixupKind(Z80::fixup_24);
+  }
+}
+
+void Z80MCCodeEmitter::emitImmediate(const MCOperand &MO, SMLoc Loc,
+                                     unsigned Size, MCFixupKind Kind,
+                                     unsigned &CurByte, raw_ostream &OS,
+                                     SmallVectorImpl<MCFixup> &Fixups) const {
+  if (MO.isImm()) {
+    emitConstant(MO.getImm(), Size, CurByte, OS);
+    return;
+  }
+
+  const MCExpr *Expr = MO.getExpr();
+  bool IsPCRel = unsigned(Kind) == Z80::fixup_8_pcrel;
+  int64_t Val;
+  if (!IsPCRel && Expr->evaluateAsAbsolute(Val)) {
+    emitConstant(Val, Size, CurByte, OS);
+    return;
+  }
+
+  // Relative branches are relative to the end of the instruction, and the
+  // displacement is always the last byte.
+  if (IsPCRel)
+    Expr = MCBinaryExpr::createSub(Expr, MCConstantExpr::create(1, Ctx), Ctx);
+  Fixups.push_back(MCFixup::create(CurByte, Expr, Kind, Loc));
+  emitConstant(0, Size, CurByte, OS);
+}
+
+void Z80MCCodeEmitter::encodeInstruction(const MCInst &MI, raw_ostream &OS,
                                          SmallVectorImpl<MCFixup> &Fixups,
                                          const MCSubtargetInfo &STI) const {
-  llvm_unreachable("Unimplemented");
+  unsigned Opc = MI.getOpcode();
+  const MCInstrDesc &Desc = MII.get(Opc);
+  uint64_t TSFlags = Desc.TSFlags;
+  assert(!Desc.isPseudo() && "Pseudo instructions should have been expanded!");
+  bool Is24Bit = STI.getFeatureBits()[Z80::Mode24Bit];
+  unsigned CurByte = 0;
+
+  // The size of addresses and word immediates, taking any suffix into account.
+  unsigned WordSize = Is24Bit ? 3 : 2;
+  uint8_t Suffix = 0;
+  switch (TSFlags & Z80II::ModeMask) {
+  case Z80II::ShortMode:
+    WordSize = 2;
+    if (Is24Bit)
+      Suffix = 0x40; // .sis
+    break;
+  case Z80II::LongMode:
+    WordSize = 3;
+    if (!Is24Bit)
+      Suffix = 0x5B; // .lil
+    break;
+  }
+
+  uint8_t Opcode = Z80II::getBaseOpcode(TSFlags);
+  uint8_t IndexPrefix = 0;
+  bool HasCB = false, HasED = false;
+  switch (TSFlags & Z80II::PrefixMask) {
+  case Z80II::NoPrefix:                                      break;
+  case Z80II::CBPrefix:   HasCB = true;                      break;
+  case Z80II::DDPrefix:                 IndexPrefix = 0xDD;  break;
+  case Z80II::DDCBPrefix: HasCB = true; IndexPrefix = 0xDD;  break;
+  case Z80II::EDPrefix:   HasED = true;                      break;
+  case Z80II::FDPrefix:                 IndexPrefix = 0xFD;  break;
+  case Z80II::FDCBPrefix: HasCB = true; IndexPrefix = 0xFD;  break;
+  default: llvm_unreachable("Unknown prefix");
+  }
+
+  const MCOperand ZeroDisp = MCOperand::createImm(0);
+  const MCOperand *Disp = nullptr, *Imm = nullptr;
+  unsigned ImmSize = 1;
+  bool ImmIsPCRel = false;
+
+  // Returns the encoding of a register operand, selecting the index register
+  // prefix if it names part of an index register.
+  auto UseReg = [&](unsigned OpNo) {
+    const MCOperand &MO = MI.getOperand(OpNo);
+    if (uint8_t Prefix = getIndexPrefix(MO.getReg())) {
+      assert((!IndexPrefix || IndexPrefix == Prefix) &&
+             "Instruction uses more than one index register");
+      IndexPrefix = Prefix;
+    }
+    return getRegEncoding(MO);
+  };
+  // Handles a (hl), (ix+d), or (iy+d) memory operand, returning the register
+  // field that selects it.
+  auto UseMem = [&](unsigned OpNo, bool HasOff) {
+    const MCOperand &MO = MI.getOperand(OpNo);
+    if (uint8_t Prefix = getIndexPrefix(MO.getReg())) {
+      assert((!IndexPrefix || IndexPrefix == Prefix) &&
+             "Instruction uses more than one index register");
+      IndexPrefix = Prefix;
+      Disp = HasOff ? &MI.getOperand(OpNo + 1) : &ZeroDisp;
+    }
+    return 6u;
+  };
+  // Handles the eZ80 16/24-bit loads and stores through (hl), (ix+d), and
+  // (iy+d), which use an ED prefix only in the (hl) form, and a different
+  // opcode for an index register that is not the base register.
+  auto UseLoadStore = [&](unsigned RegOpNo, unsigned MemOpNo, bool HasOff,
+                          bool IsLoad) {
+    UseMem(MemOpNo, HasOff);
+    HasED = !IndexPrefix;
+    const MCOperand &MO = MI.getOperand(RegOpNo);
+    if (uint8_t Prefix = getIndexPrefix(MO.getReg())) {
+      bool Same = Prefix == (IndexPrefix ? IndexPrefix : 0xDD);
+      Opcode = IsLoad ? (Same ? 0x37 : 0x31) : (Same ? 0x3F : 0x3E);
+    } else
+      Opcode |= getRegEncoding(MO) << 4;
+  };
+
+  switch (Opc) {
+  default:
+    // Instructions without explicit operands are just prefixes and opcode.
+    assert(!Desc.getNumOperands() && "Unhandled instruction with operands");
+    break;
+
+  // Branches and calls.
+  case Z80::JQCC:
+    // There is no jr with a parity or sign condition.
+    if (MI.getOperand(1).getImm() > 3) {
+      Opcode = 0xC2 | MI.getOperand(1).getImm() << 3;
+      Imm = &MI.getOperand(0);
+      ImmSize = WordSize;
+      break;
+    }
+    LLVM_FALLTHROUGH;
+  case Z80::JRCC:
+    Opcode |= MI.getOperand(1).getImm() << 3;
+    LLVM_FALLTHROUGH;
+  case Z80::JQ:
+  case Z80::JR:
+  case Z80::DJNZ:
+    Imm = &MI.getOperand(0);
+    ImmIsPCRel = true;
+    break;
+  case Z80::JPCC:
+  case Z80::CALLCC16i:
+  case Z80::CALLCC24i:
+    Opcode |= MI.getOperand(1).getImm() << 3;
+    LLVM_FALLTHROUGH;
+  case Z80::JP:
+  case Z80::CALL16i:
+  case Z80::CALL24i:
+  case Z80::LD8am:
+  case Z80::LD8ma:
+    Imm = &MI.getOperand(0);
+    ImmSize = WordSize;
+    break;
+  case Z80::RETCC:
+    Opcode |= MI.getOperand(0).getImm() << 3;
+    break;
+  case Z80::RST:
+    Opcode |= MI.getOperand(0).getImm();
+    break;
+  case Z80::JPr:
+  case Z80::JPRETr:
+  case Z80::LD16SP:
+  case Z80::LD24SP:
+  case Z80::ADD16aa:
+  case Z80::ADD24aa:
+  case Z80::ADD16SP:
+  case Z80::ADD24SP:
+    UseReg(0);
+    break;
+
+  // 8-bit loads.
+  case Z80::LD8rr:
+  case Z80::LD8xx:
+  case Z80::LD8yy:
+    Opcode |= UseReg(0) << 3 | UseReg(1);
+    break;
+  case Z80::LD8ri:
+    Opcode |= UseReg(0) << 3;
+    Imm = &MI.getOperand(1);
+    break;
+  case Z80::LD8rp:
+  case Z80::LD8ro:
+    Opcode |= UseReg(0) << 3;
+    UseMem(1, Opc == Z80::LD8ro);
+    break;
+  case Z80::LD8pr:
+    UseMem(0, false);
+    Opcode |= UseReg(1);
+    break;
+  case Z80::LD8or:
+    UseMem(0, true);
+    Opcode |= UseReg(2);
+    break;
+  case Z80::LD8pi:
+    UseMem(0, false);
+    Imm = &MI.getOperand(1);
+    break;
+  case Z80::LD8oi:
+    UseMem(0, true);
+    Imm = &MI.getOperand(2);
+    break;
+
+  // 16/24-bit loads.
+  case Z80::LD16ri:
+  case Z80::LD24ri:
+    Opcode |= UseReg(0) << 4;
+    Imm = &MI.getOperand(1);
+    ImmSize = WordSize;
+    break;
+  case Z80::LD16rm:
+  case Z80::LD24rm:
+  case Z80::LD16mr:
+  case Z80::LD24mr: {
+    bool IsLoad = Opc == Z80::LD16rm || Opc == Z80::LD24rm;
+    unsigned RegOpNo = IsLoad ? 0 : 1;
+    unsigned Enc = UseReg(RegOpNo);
+    // Only hl, ix, and iy have the short form.
+    if (Enc != 2) {
+      HasED = true;
+      Opcode = (IsLoad ? 0x4B : 0x43) | Enc << 4;
+    }
+    Imm = &MI.getOperand(1 - RegOpNo);
+    ImmSize = WordSize;
+    break;
+  }
+  case Z80::LD16rp:
+  case Z80::LD24rp:
+    UseLoadStore(0, 1, false, true);
+    break;
+  case Z80::LD16ro:
+  case Z80::LD24ro:
+    UseLoadStore(0, 1, true, true);
+    break;
+  case Z80::LD16pr:
+  case Z80::LD24pr:
+    UseLoadStore(1, 0, false, false);
+    break;
+  case Z80::LD16or:
+  case Z80::LD24or:
+    UseLoadStore(2, 0, true, false);
+    break;
+  case Z80::POP16r:
+  case Z80::POP24r:
+  case Z80::PUSH16r:
+  case Z80::PUSH24r:
+    Opcode |= UseReg(0) << 4;
+    break;
+
+  // 8-bit arithmetic.
+  case Z80::RLC8r: case Z80::RRC8r: case Z80::RL8r: case Z80::RR8r:
+  case Z80::SLA8r: case Z80::SRA8r: case Z80::SRL8r:
+    Opcode |= UseReg(1);
+    break;
+  case Z80::INC8r: case Z80::DEC8r:
+    Opcode |= UseReg(1) << 3;
+    break;
+  case Z80::RLC8m: case Z80::RRC8m: case Z80::RL8m: case Z80::RR8m:
+  case Z80::SLA8m: case Z80::SRA8m: case Z80::SRL8m:
+    Opcode |= UseMem(0, false);
+    break;
+  case Z80::RLC8o: case Z80::RRC8o: case Z80::RL8o: case Z80::RR8o:
+  case Z80::SLA8o: case Z80::SRA8o: case Z80::SRL8o:
+    Opcode |= UseMem(0, true);
+    break;
+  case Z80::INC8m: case Z80::DEC8m:
+    Opcode |= UseMem(0, false) << 3;
+    break;
+  case Z80::INC8o: case Z80::DEC8o:
+    Opcode |= UseMem(0, true) << 3;
+    break;
+  case Z80::ADD8ar: case Z80::ADC8ar: case Z80::SUB8ar: case Z80::SBC8ar:
+  case Z80::AND8ar: case Z80::XOR8ar: case Z80::OR8ar:  case Z80::CP8ar:
+    Opcode |= UseReg(0);
+    break;
+  case Z80::ADD8ai: case Z80::ADC8ai: case Z80::SUB8ai: case Z80::SBC8ai:
+  case Z80::AND8ai: case Z80::XOR8ai: case Z80::OR8ai:  case Z80::CP8ai:
+    Imm = &MI.getOperand(0);
+    break;
+  case Z80::ADD8am: case Z80::ADC8am: case Z80::SUB8am: case Z80::SBC8am:
+  case Z80::AND8am: case Z80::XOR8am: case Z80::OR8am:  case Z80::CP8am:
+    UseMem(0, false);
+    break;
+  case Z80::ADD8ao: case Z80::ADC8ao: case Z80::SUB8ao: case Z80::SBC8ao:
+  case Z80::AND8ao: case Z80::XOR8ao: case Z80::OR8ao:  case Z80::CP8ao:
+    UseMem(0, true);
+    break;
+  case Z80::TST8ar:
+    Opcode = 0x04 | getRegEncoding(MI.getOperand(0)) << 3;
+    break;
+  case Z80::TST8ai:
+    Opcode = 0x64;
+    Imm = &MI.getOperand(0);
+    break;
+  case Z80::TST8am:
+    if (getIndexPrefix(MI.getOperand(0).getReg()))
+      Ctx.reportError(MI.getLoc(), "invalid operand for instruction");
+    Opcode = 0x34;
+    break;
+  case Z80::TST8ao:
+    Ctx.reportError(MI.getLoc(), "invalid operand for instruction");
+    break;
+
+  // 16/24-bit arithmetic.
+  case Z80::ADD16ao:
+  case Z80::ADD24ao:
+    UseReg(0);
+    Opcode |= UseReg(2) << 4;
+    break;
+  case Z80::SBC16ar: case Z80::ADC16ar:
+  case Z80::SBC24ar: case Z80::ADC24ar:
+  case Z80::MLT8rr:
+    Opcode |= getRegEncoding(MI.getOperand(0)) << 4;
+    break;
+  case Z80::INC16r: case Z80::DEC16r:
+  case Z80::INC24r: case Z80::DEC24r:
+    Opcode |= UseReg(0) << 4;
+    break;
+  case Z80::LEA16ro:
+  case Z80::LEA24ro: {
+    // The base register is implied by the opcode, so never gets a prefix.
+    uint8_t BasePrefix = getIndexPrefix(MI.getOperand(1).getReg());
+    bool BaseIsIY = BasePrefix == 0xFD;
+    if (uint8_t Prefix = getIndexPrefix(MI.getOperand(0).getReg()))
+      Opcode = Prefix == BasePrefix ? (BaseIsIY ? 0x33 : 0x32)
+                                    : (BaseIsIY ? 0x54 : 0x55);
+    else
+      Opcode |= getRegEncoding(MI.getOperand(0)) << 4 | BaseIsIY;
+    Disp = &MI.getOperand(2);
+    break;
+  }
+  case Z80::PEA16o:
+  case Z80::PEA24o:
+    // As with lea, the base register is implied by the opcode.
+    if (getIndexPrefix(MI.getOperand(0).getReg()) == 0xFD)
+      Opcode = 0x66;
+    Disp = &MI.getOperand(1);
+    break;
+  }
+
+  if (Suffix)
+    emitByte(Suffix, CurByte, OS);
+  if (IndexPrefix)
+    emitByte(IndexPrefix, CurByte, OS);
+  if (HasED)
+    emitByte(0xED, CurByte, OS);
+  if (HasCB) {
+    // Indexed CB instructions put the displacement before the opcode.
+    emitByte(0xCB, CurByte, OS);
+    if (Disp)
+      emitImmediate(*Disp, MI.getLoc(), 1, MCFixupKind(Z80::fixup_8_dis),
+                    CurByte, OS, Fixups);
+    emitByte(Opcode, CurByte, OS);
+  } else {
+    emitByte(Opcode, CurByte, OS);
+    if (Disp)
+      emitImmediate(*Disp, MI.getLoc(), 1, MCFixupKind(Z80::fixup_8_dis),
+                    CurByte, OS, Fixups);
+  }
+  if (Imm)
+    emitImmediate(*Imm, MI.getLoc(), ImmSize, getFixupKind(ImmSize, ImmIsPCRel),
+                  CurByte, OS, Fixups);
 }
 
 MCCodeEmitter *llvm::createZ80MCCodeEmitter(const MCInstrInfo &MII,
@@ -100,6 +100,9 @@ extern "C" void LLVMInitializeZ80TargetMC() {
 
     // Register the MCInstPrinter.
     TargetRegistry::RegisterMCInstPrinter(*T, createZ80MCInstPrinter);
+
+    // Register the code emitter.
+    TargetRegistry::RegisterMCCodeEmitter(*T, createZ80MCCodeEmitter);
   }
 
   TargetRegistry::RegisterMCAsmBackend(TheZ80Target, createZ80AsmBackend);
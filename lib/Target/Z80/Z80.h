@@ -38,6 +38,19 @@ FunctionPass *createZ80ExpandPseudoPass();
 
 /// Return a pass that optimizes instructions after register selection.
 FunctionPass *createZ80MachineLateOptimization();
+
+/// Return a pass that moves spill slots onto the stack or into the shadow
+/// registers.  This pass must run after register allocation and before frame
+/// lowering.
+FunctionPass *createZ80SpillPlacement();
+
+/// Return a pass that converts counted loops to use djnz.  This pass must run
+/// after block placement, since it depends on the final branch distances.
+FunctionPass *createZ80HardwareLoops();
+
+/// Return a pass that folds branches around calls and to returns into
+/// conditional calls and returns.  This pass must run after block placement.
+FunctionPass *createZ80ConditionalCallRet();
 } // End llvm namespace
 
 #endif
@@ -9,15 +9,39 @@
 //
 // This file defines a pass that optimizes call sequences on z80.
 //
+// Stack arguments are lowered as stores relative to a copy of the stack
+// pointer into a call frame that the call frame setup allocates.  When every
+// slot of the frame is written that way, the stores are replaced with pushes
+// in reverse order, which allocate the frame while filling it.  A push takes
+// one byte and 11 cycles, while storing a word through an index register takes
+// at least six bytes and 38 cycles, plus the code that points the index
+// register at the frame.
+//
+// The caller cleanup after a call is also deferred when another call follows
+// in straight-line code, so that a run of calls frees its arguments with a
+// single stack adjustment after the last one.  The bytes left on the stack in
+// the meantime are reused for the next stored call frame, which then needs
+// less or nothing allocated.
+//
 //===----------------------------------------------------------------------===//
 
 #include "Z80.h"
+#include "Z80InstrInfo.h"
+#include "Z80Subtarget.h"
+#include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
 
 using namespace llvm;
 
 #define DEBUG_TYPE "z80-cf-opt"
 
+STATISTIC(NumCallFramesPushed, "Number of call frames set up with pushes");
+STATISTIC(NumPEAs, "Number of pushed addresses folded into pea");
+STATISTIC(NumDeferredCleanups, "Number of call frame cleanups deferred");
+
 static cl::opt<bool>
     NoZ80CFOpt("no-z80-call-frame-opt",
                cl::desc("Avoid optimizing z80 call frames"),
@@ -30,7 +54,34 @@ public:
 
   bool runOnMachineFunction(MachineFunction &MF) override;
 
+  StringRef getPassName() const override {
+    return "Z80 Optimize Call Frame";
+  }
+
 private:
+  // Information we know about a particular call site.
+  struct CallContext {
+    MachineInstr *FrameSetup = nullptr;
+    MachineInstr *Call = nullptr;
+    // The store that fills each slot of the call frame.
+    SmallVector<MachineInstr *, 4> SlotStores;
+    // The copies of the stack pointer that the stores are based on.
+    SmallVector<MachineInstr *, 1> SPCopies;
+  };
+
+  bool collectCallInfo(MachineBasicBlock::iterator I, CallContext &Context);
+  void adjustCallSequence(CallContext &Context);
+  bool mergeStackAdjustments(MachineBasicBlock &MBB);
+  bool canDeferCleanup(MachineBasicBlock::iterator I) const;
+  unsigned widenReg(MachineBasicBlock &MBB, MachineBasicBlock::iterator I,
+                    const DebugLoc &DL, unsigned Reg, unsigned Size) const;
+
+  const Z80Subtarget *STI;
+  const Z80InstrInfo *TII;
+  MachineRegisterInfo *MRI;
+  bool Is24Bit;
+  unsigned SlotSize;
+
   static char ID;
 };
 
@@ -44,5 +95,260 @@ FunctionPass *llvm::createZ80CallFrameOptimization() {
 bool Z80CallFrameOptimization::runOnMachineFunction(MachineFunction &MF) {
   if (skipFunction(*MF.getFunction()) || NoZ80CFOpt.getValue())
     return false;
+  STI = &MF.getSubtarget<Z80Subtarget>();
+  TII = STI->getInstrInfo();
+  MRI = &MF.getRegInfo();
+  Is24Bit = STI->is24Bit();
+  SlotSize = Is24Bit ? 3 : 2;
+
+  // Pushing moves the stack pointer within the call sequence, which is only
+  // accounted for when call frames are not reserved by the prologue.
+  if (STI->getFrameLowering()->hasReservedCallFrame(MF))
+    return false;
+
+  unsigned FrameSetupOpcode = TII->getCallFrameSetupOpcode();
+  SmallVector<CallContext, 8> CallSeqs;
+  for (MachineBasicBlock &MBB : MF)
+    for (auto I = MBB.begin(), E = MBB.end(); I != E; ++I)
+      if (I->getOpcode() == FrameSetupOpcode) {
+        CallContext Context;
+        if (collectCallInfo(I, Context))
+          CallSeqs.push_back(std::move(Context));
+      }
+
+  for (CallContext &Context : CallSeqs)
+    adjustCallSequence(Context);
+
+  bool Changed = !CallSeqs.empty();
+  for (MachineBasicBlock &MBB : MF)
+    Changed |= mergeStackAdjustments(MBB);
+  return Changed;
+}
+
+/// getStoreSize - If MI stores a byte or word at an offset from a register,
+/// return the number of bytes stored, otherwise return zero.
+static unsigned getStoreSize(const MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  case Z80::LD8or:
+  case Z80::LD8oi:
+    return 1;
+  case Z80::LD16or:
+  case Z80::LD88or:
+    return 2;
+  case Z80::LD24or:
+    return 3;
+  }
+  return 0;
+}
+
+/// collectCallInfo - Find the stores that fill the call frame allocated by the
+/// setup at I, and return true if every slot of the frame is filled by exactly
+/// one of them, and nothing else in the sequence depends on the stack pointer.
+bool Z80CallFrameOptimization::collectCallInfo(MachineBasicBlock::iterator I,
+                                               CallContext &Context) {
+  MachineBasicBlock &MBB = *I->getParent();
+  Context.FrameSetup = &*I;
+  unsigned NumBytes = I->getOperand(0).getImm();
+  if (!NumBytes || NumBytes % SlotSize)
+    return false;
+  Context.SlotStores.assign(NumBytes / SlotSize, nullptr);
+
+  unsigned SPReg = Is24Bit ? Z80::SPL : Z80::SPS;
+  SmallSet<unsigned, 2> SPCopyRegs;
+  for (++I; I != MBB.end(); ++I) {
+    MachineInstr &MI = *I;
+    if (MI.isCall()) {
+      Context.Call = &MI;
+      break;
+    }
+    if (MI.getOpcode() == TII->getCallFrameSetupOpcode() ||
+        MI.getOpcode() == TII->getCallFrameDestroyOpcode() ||
+        MI.isInlineAsm() || MI.hasUnmodeledSideEffects())
+      return false;
+
+    if (MI.isCopy() && MI.getOperand(1).getReg() == SPReg) {
+      SPCopyRegs.insert(MI.getOperand(0).getReg());
+      Context.SPCopies.push_back(&MI);
+      continue;
+    }
+    if (MI.readsRegister(SPReg) || MI.modifiesRegister(SPReg))
+      return false;
+
+    unsigned Size = getStoreSize(MI);
+    if (!Size || !MI.getOperand(0).isReg() ||
+        !SPCopyRegs.count(MI.getOperand(0).getReg()))
+      continue;
+
+    // The store must start a slot, which it fills, apart from padding.
+    int64_t Offset = MI.getOperand(1).getImm();
+    if (Offset < 0 || Offset % SlotSize || Offset + Size > NumBytes ||
+        Size > SlotSize)
+      return false;
+    MachineInstr *&SlotStore = Context.SlotStores[Offset / SlotSize];
+    if (SlotStore)
+      return false;
+    if (MI.getOpcode() != Z80::LD8oi &&
+        !TargetRegisterInfo::isVirtualRegister(MI.getOperand(2).getReg()))
+      return false;
+    SlotStore = &MI;
+  }
+  if (!Context.Call)
+    return false;
+  for (MachineInstr *SlotStore : Context.SlotStores)
+    if (!SlotStore)
+      return false;
+
+  // Any other use of the stack pointer copies, such as taking the address of
+  // an outgoing argument, depends on where the frame is.
+  for (unsigned Reg : SPCopyRegs)
+    for (MachineInstr &UseMI : MRI->use_nodbg_instructions(Reg))
+      if (!is_contained(Context.SlotStores, &UseMI))
+        return false;
+  return true;
+}
+
+/// widenReg - Return a register of the push class for the slot size that holds
+/// the Size byte value in Reg in its low bytes.  The remaining bytes are just
+/// padding of the slot, so they are left undefined.
+unsigned Z80CallFrameOptimization::widenReg(MachineBasicBlock &MBB,
+                                            MachineBasicBlock::iterator I,
+                                            const DebugLoc &DL, unsigned Reg,
+                                            unsigned Size) const {
+  for (; Size < SlotSize; Size = Size == 1 ? 2 : 3) {
+    const TargetRegisterClass *RC =
+      Size == 1 ? &Z80::R16RegClass : &Z80::R24RegClass;
+    unsigned UndefReg = MRI->createVirtualRegister(RC);
+    unsigned WideReg = MRI->createVirtualRegister(RC);
+    BuildMI(MBB, I, DL, TII->get(TargetOpcode::IMPLICIT_DEF), UndefReg);
+    BuildMI(MBB, I, DL, TII->get(TargetOpcode::INSERT_SUBREG), WideReg)
+      .addReg(UndefReg).addReg(Reg)
+      .addImm(Size == 1 ? Z80::sub_low : Z80::sub_short);
+    Reg = WideReg;
+  }
+  return Reg;
+}
+
+/// adjustCallSequence - Replace the stores to the call frame with pushes, from
+/// the highest slot down, and record in the setup that the frame is pushed.
+void Z80CallFrameOptimization::adjustCallSequence(CallContext &Context) {
+  // The pushes go where the last store was, where all of the stored values
+  // are available, and before any copies to argument registers.
+  MachineInstr *LastStore = nullptr;
+  for (MachineInstr &MI : make_range(Context.FrameSetup->getIterator(),
+                                     Context.Call->getIterator()))
+    if (is_contained(Context.SlotStores, &MI))
+      LastStore = &MI;
+  MachineBasicBlock &MBB = *LastStore->getParent();
+  MachineBasicBlock::iterator InsertPt = LastStore->getIterator();
+
+  unsigned PushOpc = Is24Bit ? Z80::PUSH24r : Z80::PUSH16r;
+  for (MachineInstr *Store : reverse(Context.SlotStores)) {
+    DebugLoc DL = Store->getDebugLoc();
+    unsigned Size = getStoreSize(*Store);
+    MachineOperand &ValOp = Store->getOperand(2);
+
+    if (Store->getOpcode() == Z80::LD8oi) {
+      // There is no push of an immediate, so materialize it in a register.
+      unsigned Reg = MRI->createVirtualRegister(Is24Bit ? &Z80::R24RegClass
+                                                        : &Z80::R16RegClass);
+      BuildMI(MBB, InsertPt, DL, TII->get(Is24Bit ? Z80::LD24ri : Z80::LD16ri),
+              Reg).addImm(ValOp.getImm() & 0xFF);
+      BuildMI(MBB, InsertPt, DL, TII->get(PushOpc))
+        .addReg(Reg, RegState::Kill);
+      Store->eraseFromParent();
+      continue;
+    }
+
+    // An address computed from a frame index or register only for this slot
+    // is pushed directly on the ez80.
+    unsigned Reg = ValOp.getReg();
+    MachineInstr *DefMI = MRI->getUniqueVRegDef(Reg);
+    unsigned LEAOpc = Is24Bit ? Z80::LEA24ro : Z80::LEA16ro;
+    if (Size == SlotSize && DefMI && DefMI->getOpcode() == LEAOpc &&
+        MRI->hasOneNonDBGUse(Reg)) {
+      BuildMI(MBB, InsertPt, DL, TII->get(Is24Bit ? Z80::PEA24o : Z80::PEA16o))
+        .addOperand(DefMI->getOperand(1)).addOperand(DefMI->getOperand(2));
+      DefMI->eraseFromParent();
+      Store->eraseFromParent();
+      ++NumPEAs;
+      continue;
+    }
+
+    Reg = widenReg(MBB, InsertPt, DL, Reg, Size);
+    BuildMI(MBB, InsertPt, DL, TII->get(PushOpc))
+      .addReg(Reg, getKillRegState(ValOp.isKill() || Reg != ValOp.getReg()));
+    Store->eraseFromParent();
+  }
+
+  // The stack pointer copies were only used by the stores.
+  for (MachineInstr *Copy : Context.SPCopies)
+    if (MRI->use_nodbg_empty(Copy->getOperand(0).getReg()))
+      Copy->eraseFromParent();
+
+  Context.FrameSetup->getOperand(1).setImm(
+    Context.FrameSetup->getOperand(0).getImm());
+  ++NumCallFramesPushed;
+}
+
+/// canDeferCleanup - Return true if the call frame destroy at I is followed in
+/// its block by another call frame setup, and nothing in between depends on
+/// where the stack pointer is.
+bool Z80CallFrameOptimization::canDeferCleanup(
+    MachineBasicBlock::iterator I) const {
+  MachineBasicBlock &MBB = *I->getParent();
+  unsigned SPReg = Is24Bit ? Z80::SPL : Z80::SPS;
+  for (++I; I != MBB.end(); ++I) {
+    if (I->getOpcode() == TII->getCallFrameSetupOpcode())
+      return true;
+    if (I->isCall() || I->isTerminator() || I->isInlineAsm() ||
+        I->readsRegister(SPReg) || I->modifiesRegister(SPReg))
+      return false;
+  }
   return false;
 }
+
+/// mergeStackAdjustments - Defer the cleanup of each call frame in MBB that is
+/// followed by another call, and let the next frame reuse the bytes left on
+/// the stack.  Returns true if any call sequence was changed.
+bool Z80CallFrameOptimization::mergeStackAdjustments(MachineBasicBlock &MBB) {
+  bool Changed = false;
+  // The number of bytes left on the stack by deferred cleanups.
+  int64_t Outstanding = 0;
+  // The part of the current frame that is allocated by its setup or reused,
+  // and the part that is pushed.
+  int64_t Stored = 0, Pushed = 0;
+  for (auto I = MBB.begin(), E = MBB.end(); I != E; ++I) {
+    if (I->getOpcode() == TII->getCallFrameSetupOpcode()) {
+      Pushed = I->getOperand(1).getImm();
+      Stored = I->getOperand(0).getImm() - Pushed;
+      // The arguments are stored at the bottom of the stack, so the bytes left
+      // there already cover as much of the frame as they can.
+      if (int64_t Reused = std::min(Outstanding, Stored)) {
+        I->getOperand(1).setImm(Pushed + Reused);
+        Changed = true;
+      }
+      continue;
+    }
+    if (I->getOpcode() != TII->getCallFrameDestroyOpcode())
+      continue;
+    bool Defer = canDeferCleanup(I);
+    if (!Outstanding && !Defer)
+      continue;
+    // What is left on the stack after the call, measured from where the stack
+    // pointer was before the first deferred cleanup.
+    int64_t CalleePop = I->getOperand(1).getImm();
+    int64_t Cleanup = I->getOperand(0).getImm() - CalleePop;
+    int64_t Left = std::max(Outstanding, Stored) + Pushed - CalleePop;
+    if (Defer) {
+      I->getOperand(2).setImm(Cleanup);
+      Outstanding = Left;
+      ++NumDeferredCleanups;
+    } else {
+      I->getOperand(2).setImm(Cleanup - Left);
+      Outstanding = 0;
+    }
+    Changed = true;
+  }
+  assert(!Outstanding && "Deferred cleanup was never done");
+  return Changed;
+}
@@ -0,0 +1,240 @@
+//===-- Z80ConditionalCallRet.cpp - Form conditional calls and returns ----===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a pass that folds branches into the conditional forms of
+// call and ret, which every z80 variant has.  A call that is only branched
+// around becomes a call on the opposite condition, and a conditional branch to
+// a block that just returns becomes a conditional return.  Small epilogues are
+// also duplicated into the blocks that jump to them, so that the jump is
+// replaced by the return itself.
+//
+// The pass runs just before emission, after the epilogues have been inserted
+// and the blocks have been placed, since both forms depend on the final
+// layout and on which return blocks are left empty by frame lowering.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Z80.h"
+#include "Z80InstrInfo.h"
+#include "Z80Subtarget.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "z80-cond-call-ret"
+
+STATISTIC(NumCondCalls, "Number of conditional calls formed");
+STATISTIC(NumCondRets, "Number of conditional returns formed");
+STATISTIC(NumDupEpilogues, "Number of epilogues duplicated");
+
+static cl::opt<bool>
+    NoZ80CondCallRet("no-z80-cond-call-ret",
+                     cl::desc("Avoid forming conditional calls and returns"),
+                     cl::init(false), cl::Hidden);
+
+namespace {
+class Z80ConditionalCallRet : public MachineFunctionPass {
+public:
+  Z80ConditionalCallRet() : MachineFunctionPass(ID) {}
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  MachineFunctionProperties getRequiredProperties() const override {
+    return MachineFunctionProperties().set(
+        MachineFunctionProperties::Property::NoVRegs);
+  }
+
+  StringRef getPassName() const override {
+    return "Z80 Conditional Calls and Returns";
+  }
+
+private:
+  bool duplicateEpilogue(MachineBasicBlock &MBB);
+  bool formConditionalCall(MachineBasicBlock &MBB);
+  bool formConditionalReturn(MachineBasicBlock &MBB);
+
+  const Z80InstrInfo *TII;
+  // Blocks that may have lost all of their predecessors.
+  SmallSetVector<MachineBasicBlock *, 4> MaybeDead;
+
+  static char ID;
+};
+
+char Z80ConditionalCallRet::ID = 0;
+} // end anonymous namespace
+
+FunctionPass *llvm::createZ80ConditionalCallRet() {
+  return new Z80ConditionalCallRet();
+}
+
+bool Z80ConditionalCallRet::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(*MF.getFunction()) || NoZ80CondCallRet.getValue())
+    return false;
+  TII = MF.getSubtarget<Z80Subtarget>().getInstrInfo();
+
+  bool Changed = false;
+  for (MachineBasicBlock &MBB : MF)
+    Changed |= duplicateEpilogue(MBB);
+  for (auto I = MF.begin(), E = MF.end(); I != E;) {
+    // The block is erased when its call is moved into its predecessor.
+    MachineBasicBlock &MBB = *I++;
+    Changed |= formConditionalCall(MBB);
+  }
+  for (MachineBasicBlock &MBB : MF)
+    Changed |= formConditionalReturn(MBB);
+
+  for (MachineBasicBlock *MBB : MaybeDead)
+    if (MBB->pred_empty() && MBB != &MF.front())
+      MBB->eraseFromParent();
+  MaybeDead.clear();
+  return Changed;
+}
+
+/// getOnlyInstr - If MBB contains a single instruction, apart from debug
+/// values, return it.
+static MachineInstr *getOnlyInstr(MachineBasicBlock &MBB) {
+  MachineInstr *Only = nullptr;
+  for (MachineInstr &MI : MBB) {
+    if (MI.isDebugValue())
+      continue;
+    if (Only)
+      return nullptr;
+    Only = &MI;
+  }
+  return Only;
+}
+
+/// isBareReturn - Return true if MBB does nothing but return.
+static bool isBareReturn(MachineBasicBlock &MBB) {
+  MachineInstr *MI = getOnlyInstr(MBB);
+  return MI && MI->getOpcode() == Z80::RET && !MBB.isEHPad();
+}
+
+/// duplicateEpilogue - If MBB ends in a jump to a small block that returns,
+/// replace the jump with a copy of that block.  Under optsize, only a bare
+/// return is copied, since it is smaller than the jump.
+bool Z80ConditionalCallRet::duplicateEpilogue(MachineBasicBlock &MBB) {
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
+  SmallVector<MachineOperand, 1> Cond;
+  if (TII->analyzeBranch(MBB, TBB, FBB, Cond, false) || !TBB ||
+      !Cond.empty() || TBB == &MBB || TBB->isEHPad() || !TBB->succ_empty())
+    return false;
+  MachineBasicBlock::iterator Ret = TBB->getLastNonDebugInstr();
+  if (Ret == TBB->end() || Ret->getOpcode() != Z80::RET)
+    return false;
+  bool OptSize = MBB.getParent()->getFunction()->optForSize();
+  unsigned MaxSize = OptSize ? 1 : 3, Size = 0;
+  for (MachineInstr &MI : *TBB) {
+    if (MI.isDebugValue())
+      continue;
+    if (++Size > MaxSize || MI.isCall() || MI.isInlineAsm() ||
+        MI.isNotDuplicable())
+      return false;
+  }
+
+  DEBUG(dbgs() << "Duplicating epilogue BB#" << TBB->getNumber()
+               << " into BB#" << MBB.getNumber() << '\n');
+  TII->removeBranch(MBB);
+  MachineFunction &MF = *MBB.getParent();
+  for (MachineInstr &MI : *TBB)
+    MBB.push_back(MF.CloneMachineInstr(&MI));
+  MBB.removeSuccessor(TBB);
+  MaybeDead.insert(TBB);
+  ++NumDupEpilogues;
+  return true;
+}
+
+/// formConditionalCall - If MBB only makes a call that its layout predecessor
+/// branches around, move the call into the predecessor, made conditional on
+/// the branch not being taken, and remove MBB.
+bool Z80ConditionalCallRet::formConditionalCall(MachineBasicBlock &MBB) {
+  if (MBB.pred_size() != 1 || MBB.succ_size() != 1 || MBB.isEHPad() ||
+      MBB.hasAddressTaken() || &MBB == &MBB.getParent()->front())
+    return false;
+  MachineBasicBlock *Pred = *MBB.pred_begin();
+  MachineBasicBlock *Succ = *MBB.succ_begin();
+  if (!Pred->isLayoutSuccessor(&MBB) || !MBB.isLayoutSuccessor(Succ) ||
+      Pred == &MBB || Succ == &MBB)
+    return false;
+  MachineInstr *Call = getOnlyInstr(MBB);
+  if (!Call || (Call->getOpcode() != Z80::CALL16i &&
+                Call->getOpcode() != Z80::CALL24i))
+    return false;
+
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
+  SmallVector<MachineOperand, 1> Cond;
+  if (TII->analyzeBranch(*Pred, TBB, FBB, Cond, false) || Cond.size() != 1 ||
+      TBB != Succ || (FBB && FBB != &MBB))
+    return false;
+
+  DEBUG(dbgs() << "Folding call in BB#" << MBB.getNumber()
+               << " into BB#" << Pred->getNumber() << '\n');
+  MachineFunction &MF = *MBB.getParent();
+  DebugLoc DL = Call->getDebugLoc();
+  TII->removeBranch(*Pred);
+  // The call keeps all of its operands, including the register mask and the
+  // argument and result registers, and also reads the flags.
+  MachineInstr *CondCall = MF.CreateMachineInstr(
+      TII->get(Call->getOpcode() == Z80::CALL24i ? Z80::CALLCC24i
+                                                 : Z80::CALLCC16i),
+      DL, true);
+  MachineInstrBuilder MIB(MF, CondCall);
+  MIB.addOperand(Call->getOperand(0))
+    .addImm(Z80::GetOppositeBranchCondition(Z80::CondCode(Cond[0].getImm())));
+  for (unsigned I = 1, E = Call->getNumOperands(); I != E; ++I)
+    MIB.addOperand(Call->getOperand(I));
+  MIB.addReg(Z80::F, RegState::Implicit);
+  Pred->insert(Pred->end(), CondCall);
+
+  Pred->removeSuccessor(&MBB);
+  MBB.removeSuccessor(Succ);
+  MBB.eraseFromParent();
+  ++NumCondCalls;
+  return true;
+}
+
+/// formConditionalReturn - If MBB branches to a block that just returns on
+/// some condition, return on that condition directly instead.
+bool Z80ConditionalCallRet::formConditionalReturn(MachineBasicBlock &MBB) {
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr;
+  SmallVector<MachineOperand, 1> Cond;
+  if (TII->analyzeBranch(MBB, TBB, FBB, Cond, false) || Cond.size() != 1 ||
+      TBB == FBB)
+    return false;
+  Z80::CondCode CC = Z80::CondCode(Cond[0].getImm());
+  MachineBasicBlock *RetMBB, *Other;
+  if (isBareReturn(*TBB)) {
+    RetMBB = TBB;
+    Other = FBB;
+  } else if (FBB && isBareReturn(*FBB)) {
+    // Returning on the opposite condition still saves the jump to the return.
+    RetMBB = FBB;
+    Other = TBB;
+    CC = Z80::GetOppositeBranchCondition(CC);
+  } else
+    return false;
+
+  DEBUG(dbgs() << "Folding return in BB#" << RetMBB->getNumber()
+               << " into BB#" << MBB.getNumber() << '\n');
+  DebugLoc DL = MBB.getFirstTerminator()->getDebugLoc();
+  TII->removeBranch(MBB);
+  // The return uses the registers that hold the result.
+  MachineInstrBuilder MIB = BuildMI(&MBB, DL, TII->get(Z80::RETCC)).addImm(CC);
+  for (const MachineOperand &MO :
+       RetMBB->getFirstTerminator()->implicit_operands())
+    MIB.addOperand(MO);
+  if (Other && !MBB.isLayoutSuccessor(Other))
+    TII->insertBranch(MBB, Other, nullptr, None, DL);
+  MBB.removeSuccessor(RetMBB);
+  MaybeDead.insert(RetMBB);
+  ++NumCondRets;
+  return true;
+}
@@ -14,10 +14,13 @@
 #include "Z80FrameLowering.h"
 #include "Z80.h"
 #include "Z80InstrInfo.h"
+#include "Z80MachineFunctionInfo.h"
 #include "Z80Subtarget.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineRegisterInfo.h"
+#include "llvm/CodeGen/TargetSchedule.h"
 using namespace llvm;
 
 Z80FrameLowering::Z80FrameLowering(const Z80Subtarget &STI)
@@ -27,18 +30,35 @@ Z80FrameLowering::Z80FrameLowering(const Z80Subtarget &STI)
 }
 
 /// hasFP - Return true if the specified function should have a dedicated frame
-/// pointer register.  This is true if the function has variable sized allocas
-/// or if frame pointer elimination is disabled.
+/// pointer register.  This is true if the function has variable sized allocas,
+/// makes calls, or if frame pointer elimination is disabled.  Without a frame
+/// pointer, each stack access has to point an index register at the slot
+/// first, which only pays off in leaf functions that free up ix.
 bool Z80FrameLowering::hasFP(const MachineFunction &MF) const {
-  return true;
   const MachineFrameInfo &MFI = MF.getFrameInfo();
 
   return MF.getTarget().Options.DisableFramePointerElim(MF) ||
-    MFI.hasVarSizedObjects() || MFI.isFrameAddressTaken()
-    // TODO
-    || !MF.getFunction()->arg_empty();
+    MFI.hasVarSizedObjects() || MFI.isFrameAddressTaken() || MFI.hasCalls();
+}
+
+/// determineCalleeSaves - Interprocedural register allocation lets functions
+/// that are only called from within the module skip saving callee-saved
+/// registers, but ix is still saved, since callers keep their frame pointer in
+/// it and do not expect it to be clobbered.
+void Z80FrameLowering::determineCalleeSaves(MachineFunction &MF,
+                                            BitVector &SavedRegs,
+                                            RegScavenger *RS) const {
+  TargetFrameLowering::determineCalleeSaves(MF, SavedRegs, RS);
+  // Interrupt handlers save ix along with everything else they touch.
+  unsigned FrameReg = Is24Bit ? Z80::UIX : Z80::IX;
+  if (!hasFP(MF) && !isInterrupt(MF) &&
+      MF.getRegInfo().isPhysRegModified(FrameReg))
+    SavedRegs.set(FrameReg);
 }
 
+/// BuildStackAdjustment - Adjust the stack pointer by Offset, using ScratchReg
+/// to compute large adjustments.  A ScratchReg of 0 means that no register is
+/// free, so the stack can only be grown by pushing af, which is not modified.
 void Z80FrameLowering::BuildStackAdjustment(MachineFunction &MF,
                                             MachineBasicBlock &MBB,
                                             MachineBasicBlock::iterator MI,
@@ -51,6 +71,14 @@ void Z80FrameLowering::BuildStackAdjustment(MachineFunction &MF,
     .hasAttribute(AttributeSet::FunctionIndex, Attribute::OptimizeForSize);
   uint32_t WordSize = Is24Bit ? 3 : 2;
 
+  // The cost of each sequence is its size in bytes when optimizing for size,
+  // and its latency in the scheduling model otherwise.
+  TargetSchedModel SchedModel;
+  SchedModel.init(STI.getSchedModel(), &STI, &TII);
+  auto getCost = [&](unsigned Opc, unsigned Bytes) {
+    return OptSize ? Bytes : SchedModel.computeInstrLatency(Opc);
+  };
+
   // Optimal if we are trying to set SP = FP
   //   LD SP, FP
   if (FPOffset >= 0 && FPOffset + Offset == 0) {
@@ -62,36 +90,46 @@ void Z80FrameLowering::BuildStackAdjustment(MachineFunction &MF,
 
   // Optimal for small offsets
   //   POP/PUSH HL for every WordSize bytes
-  unsigned SmallCost = OptSize ? 1 : Is24Bit ? 4 : Offset >= 0 ? 10 : 11;
+  unsigned SmallCost = getCost(Offset >= 0 ? (Is24Bit ? Z80::POP24r
+                                                      : Z80::POP16r)
+                                           : (Is24Bit ? Z80::PUSH24r
+                                                      : Z80::PUSH16r), 1);
   uint32_t PopPushCount = std::abs(Offset) / WordSize;
   SmallCost *= PopPushCount;
   //   INC/DEC SP for remaining bytes
   uint32_t IncDecCount = std::abs(Offset) % WordSize;
-  SmallCost += (OptSize || Is24Bit ? 1 : 6) * IncDecCount;
+  SmallCost += getCost(Is24Bit ? Z80::INC24r : Z80::INC16r, 1) * IncDecCount;
 
   // Optimal for large offsets
   //   LD HL, Offset
-  unsigned LargeCost = OptSize || Is24Bit ? 1 + WordSize : 10;
+  unsigned LargeCost = getCost(Is24Bit ? Z80::LD24ri : Z80::LD16ri,
+                               1 + WordSize);
   //   ADD HL, SP
-  LargeCost += OptSize || Is24Bit ? 1 : 11;
+  LargeCost += getCost(Is24Bit ? Z80::ADD24SP : Z80::ADD16SP, 1);
   //   LD SP, HL
-  LargeCost += OptSize || Is24Bit ? 1 : 6;
+  unsigned LoadSPCost = getCost(Is24Bit ? Z80::LD24SP : Z80::LD16SP, 1);
+  LargeCost += LoadSPCost;
 
   // Optimal for large offsets when possible
   //   LEA HL, FP + SPOffsetFromFP + Offset
   //   LD SP, HL
   bool CanUseLEA = STI.hasEZ80Ops() && FPOffset >= 0 &&
     isInt<8>(FPOffset + Offset) && hasFP(MF);
-  unsigned LEACost = CanUseLEA ? 4 : LargeCost;
+  unsigned LEACost = CanUseLEA ? getCost(Is24Bit ? Z80::LEA24ro
+                                                 : Z80::LEA16ro, 3) +
+                                 LoadSPCost
+                               : LargeCost;
 
   // Prefer smaller version
-  if (SmallCost <= LargeCost && SmallCost <= LEACost) {
+  assert((ScratchReg || Offset < 0) && "Need a register to shrink the stack");
+  if (!ScratchReg || (SmallCost <= LargeCost && SmallCost <= LEACost)) {
+    unsigned PushReg = ScratchReg ? ScratchReg : Z80::AF;
     while (PopPushCount--)
       BuildMI(MBB, MI, DL, TII.get(Offset >= 0 ? (Is24Bit ? Z80::POP24r
                                                           : Z80::POP16r)
                                                : (Is24Bit ? Z80::PUSH24r
                                                           : Z80::PUSH16r)))
-        .addReg(ScratchReg, getDefRegState(Offset >= 0) | RegState::Undef);
+        .addReg(PushReg, getDefRegState(Offset >= 0) | RegState::Undef);
     unsigned StackReg = Is24Bit ? Z80::SPL : Z80::SPS;
     while (IncDecCount--)
       BuildMI(MBB, MI, DL, TII.get(Offset >= 0 ? (Is24Bit ? Z80::INC24r
@@ -117,6 +155,24 @@ void Z80FrameLowering::BuildStackAdjustment(MachineFunction &MF,
     .addReg(ScratchReg);
 }
 
+/// getFreeScratchReg - Return the first of the 16-bit registers Regs, or its
+/// 24-bit super-register, that does not overlap a live-in of MBB, or 0 if there
+/// is none.  This keeps the prologue from clobbering arguments passed in
+/// registers before they are copied out.
+unsigned Z80FrameLowering::getFreeScratchReg(const MachineBasicBlock &MBB,
+                                             ArrayRef<unsigned> Regs) const {
+  for (unsigned Reg : Regs) {
+    if (Is24Bit)
+      Reg = TRI->getMatchingSuperReg(Reg, Z80::sub_short, &Z80::R24RegClass);
+    if (none_of(MBB.liveins(), [&](const MachineBasicBlock::RegisterMaskPair
+                                       &LiveIn) {
+          return TRI->regsOverlap(LiveIn.PhysReg, Reg);
+        }))
+      return Reg;
+  }
+  return 0;
+}
+
 /// emitPrologue - Push callee-saved registers onto the stack, which
 /// automatically adjust the stack pointer. Adjust the stack pointer to allocate
 /// space for local variables.
@@ -128,31 +184,43 @@ void Z80FrameLowering::emitPrologue(MachineFunction &MF,
   // to determine the end of the prologue.
   DebugLoc DL;
 
+  bool IsInterrupt = isInterrupt(MF);
+  if (IsInterrupt)
+    emitInterruptSave(MF, MBB, MI, DL);
+
   int StackSize = -(int)MF.getFrameInfo().getStackSize();
-  unsigned ScratchReg = Is24Bit ? Z80::UHL : Z80::HL;
-  if (MF.getFunction()->getAttributes().hasAttribute(
-          AttributeSet::FunctionIndex, Attribute::OptimizeForSize)) {
+  unsigned ScratchReg = getFreeScratchReg(MBB, {Z80::HL, Z80::IY});
+  if (!hasFP(MF)) {
+    BuildStackAdjustment(MF, MBB, MI, DL, ScratchReg, StackSize);
+    return;
+  }
+  // The _frameset helpers are not safe to call from an interrupt handler,
+  // which may have interrupted them.  _frameset takes the size in hl, so when
+  // hl holds an argument, the frame is set up inline instead.
+  unsigned FrameSetReg = Is24Bit ? Z80::UHL : Z80::HL;
+  if (!IsInterrupt && MF.getFunction()->getAttributes().hasAttribute(
+          AttributeSet::FunctionIndex, Attribute::OptimizeForSize) &&
+      (!StackSize || getFreeScratchReg(MBB, Z80::HL) == FrameSetReg)) {
     if (StackSize) {
       BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::LD24ri : Z80::LD16ri),
-              ScratchReg).addImm(StackSize);
-      BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::CALL24i : Z80::CALL24r))
-        .addExternalSymbol("_frameset").addReg(ScratchReg, RegState::Implicit);
+              FrameSetReg).addImm(StackSize);
+      BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::CALL24i : Z80::CALL16i))
+        .addExternalSymbol("_frameset")
+        .addReg(FrameSetReg, RegState::Implicit | RegState::Kill);
       return;
     }
-    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::CALL24i : Z80::CALL24r))
+    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::CALL24i : Z80::CALL16i))
       .addExternalSymbol("_frameset0");
     return;
   }
-  if (hasFP(MF)) {
-    unsigned FrameReg = TRI->getFrameRegister(MF);
-    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::PUSH24r : Z80::PUSH16r))
-      .addReg(FrameReg);
-    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::LD24ri : Z80::LD16ri),
-            FrameReg)
-      .addImm(0);
-    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::ADD24SP : Z80::ADD16SP),
-            FrameReg).addReg(FrameReg);
-  }
+  unsigned FrameReg = TRI->getFrameRegister(MF);
+  BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::PUSH24r : Z80::PUSH16r))
+    .addReg(FrameReg);
+  BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::LD24ri : Z80::LD16ri),
+          FrameReg)
+    .addImm(0);
+  BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::ADD24SP : Z80::ADD16SP),
+          FrameReg).addReg(FrameReg);
   BuildStackAdjustment(MF, MBB, MI, DL, ScratchReg, StackSize, 0);
 }
 
@@ -173,25 +241,213 @@ void Z80FrameLowering::emitEpilogue(MachineFunction &MF,
   } else {
     assert(!MFI.hasVarSizedObjects() &&
            "Can't use StackSize with var sized objects!");
-    unsigned ScratchReg = Is24Bit ? Z80::UIY : Z80::IY;
-    BuildStackAdjustment(MF, MBB, MI, DL, ScratchReg, StackSize, -StackSize);
+    // Adjust the stack through iy, or hl when iy holds the result or the
+    // target of a tail call.  When both are taken, pop the frame into a pair
+    // that the terminator leaves free, or failing that, increment sp.
+    unsigned DropReg = 0;
+    for (unsigned Reg : {Z80::IY, Z80::HL, Z80::DE, Z80::BC}) {
+      if (Is24Bit)
+        Reg = TRI->getMatchingSuperReg(Reg, Z80::sub_short, &Z80::R24RegClass);
+      if (isFreeAt(MBB, MI, Reg)) {
+        DropReg = Reg;
+        break;
+      }
+    }
+    if (DropReg == (Is24Bit ? Z80::UIY : Z80::IY) ||
+        DropReg == (Is24Bit ? Z80::UHL : Z80::HL))
+      BuildStackAdjustment(MF, MBB, MI, DL, DropReg, StackSize, -StackSize);
+    else
+      emitStackPop(MBB, MI, DL, DropReg, StackSize);
+  }
+  if (isInterrupt(MF)) {
+    if (MI != MBB.end() && MI->getOpcode() == Z80::RET)
+      emitInterruptReturn(MF, MBB, MI, DL);
+    return;
+  }
+  if (unsigned BytesToPop =
+          MF.getInfo<Z80MachineFunctionInfo>()->getBytesToPopOnReturn())
+    if (MI != MBB.end() && MI->getOpcode() == Z80::RET)
+      emitCalleePop(MF, MBB, MI, DL, BytesToPop);
+}
+
+/// isFreeAt - Return true if the terminator MI of MBB does not use any part of
+/// Reg.  A return uses the registers that hold the result, and a tail call
+/// uses its target and the registers that hold its arguments.
+bool Z80FrameLowering::isFreeAt(MachineBasicBlock &MBB,
+                                MachineBasicBlock::iterator MI,
+                                unsigned Reg) const {
+  if (MI == MBB.end())
+    return true;
+  for (const MachineOperand &MO : MI->operands())
+    if (MO.isReg() && MO.getReg() && TRI->regsOverlap(MO.getReg(), Reg))
+      return false;
+  return true;
+}
+
+/// emitStackPop - Drop Bytes from the stack before MI by popping them into
+/// DropReg, which must be dead, and incrementing sp for any bytes left over,
+/// or for all of them if DropReg is 0.
+void Z80FrameLowering::emitStackPop(MachineBasicBlock &MBB,
+                                    MachineBasicBlock::iterator MI,
+                                    DebugLoc DL, unsigned DropReg,
+                                    unsigned Bytes) const {
+  unsigned SlotSize = Is24Bit ? 3 : 2;
+  for (; DropReg && Bytes >= SlotSize; Bytes -= SlotSize)
+    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::POP24r : Z80::POP16r))
+      .addReg(DropReg, RegState::Define | RegState::Dead);
+  unsigned StackReg = Is24Bit ? Z80::SPL : Z80::SPS;
+  while (Bytes--)
+    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::INC24r : Z80::INC16r),
+            StackReg).addReg(StackReg);
+}
+
+/// emitCalleePop - Replace the return at MI with one that also pops Bytes of
+/// arguments.  The return address is popped into hl, or iy when hl holds part
+/// of the result, then the arguments are dropped, and the function returns by
+/// jumping through the register.
+void Z80FrameLowering::emitCalleePop(MachineFunction &MF,
+                                     MachineBasicBlock &MBB,
+                                     MachineBasicBlock::iterator MI,
+                                     DebugLoc DL, unsigned Bytes) const {
+  // The return uses the registers that hold the result.
+  auto IsFree = [&](unsigned Reg) { return isFreeAt(MBB, MI, Reg); };
+  unsigned HL = Is24Bit ? Z80::UHL : Z80::HL;
+  unsigned IY = Is24Bit ? Z80::UIY : Z80::IY;
+  unsigned RetAddrReg = IsFree(HL) ? HL : IY;
+  assert(IsFree(RetAddrReg) && "No register left to return through");
+  BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::POP24r : Z80::POP16r),
+          RetAddrReg);
+
+  // Drop the arguments into the first free pair, which can also adjust the
+  // stack pointer directly if it is hl or iy.
+  unsigned DropReg = 0;
+  for (unsigned Reg : {Z80::DE, Z80::BC, Z80::HL, Z80::IY}) {
+    if (Is24Bit)
+      Reg = TRI->getMatchingSuperReg(Reg, Z80::sub_short, &Z80::R24RegClass);
+    if (Reg != RetAddrReg && IsFree(Reg)) {
+      DropReg = Reg;
+      break;
+    }
+  }
+  if (DropReg == HL || DropReg == IY)
+    BuildStackAdjustment(MF, MBB, MI, DL, DropReg, Bytes);
+  else
+    emitStackPop(MBB, MI, DL, DropReg, Bytes);
+
+  MachineInstrBuilder MIB = BuildMI(MBB, MI, DL, TII.get(Z80::JPRETr))
+    .addReg(RetAddrReg, RegState::Kill);
+  for (const MachineOperand &MO : MI->implicit_operands())
+    MIB.addOperand(MO);
+  MBB.erase(MI);
+}
+
+bool Z80FrameLowering::isInterrupt(const MachineFunction &MF) {
+  return MF.getFunction()->hasFnAttribute("interrupt");
+}
+
+/// getInterruptSaves - Collect the registers that the interrupt handler MF
+/// pushes on entry, in push order, and return true if it also switches to the
+/// shadow registers.  Only registers that the body modifies are saved, along
+/// with the flags and the scratch registers used by the frame setup and
+/// teardown, so that the prologue and every epilogue agree on the set.
+bool Z80FrameLowering::getInterruptSaves(
+    const MachineFunction &MF, SmallVectorImpl<unsigned> &Regs) const {
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  bool Shadow = MF.getFunction()->hasFnAttribute("interrupt-shadow");
+  bool HasStack = MF.getFrameInfo().getStackSize() != 0;
+  auto Save = [&](unsigned Reg) {
+    if (Is24Bit)
+      Reg = TRI->getMatchingSuperReg(Reg, Z80::sub_short, &Z80::R24RegClass);
+    Regs.push_back(Reg);
+  };
+  auto IsModified = [&](unsigned Reg) {
+    return MRI.isPhysRegModified(Reg) ||
+      (Is24Bit && MRI.isPhysRegModified(TRI->getMatchingSuperReg(
+                      Reg, Z80::sub_short, &Z80::R24RegClass)));
+  };
+  // The shadow registers replace af, bc, de, and hl, but not the index
+  // registers.
+  if (!Shadow) {
+    Regs.push_back(Z80::AF);
+    for (unsigned Reg : {Z80::BC, Z80::DE})
+      if (IsModified(Reg))
+        Save(Reg);
+    if (IsModified(Z80::HL) || HasStack)
+      Save(Z80::HL);
+  }
+  // With a frame pointer, ix is saved by the frame setup itself.
+  if (!hasFP(MF) && IsModified(Z80::IX))
+    Save(Z80::IX);
+  if (IsModified(Z80::IY) || (!hasFP(MF) && HasStack))
+    Save(Z80::IY);
+  return Shadow;
+}
+
+/// emitInterruptSave - Save the registers of the interrupted code at the very
+/// start of an interrupt handler, before the frame is set up.
+void Z80FrameLowering::emitInterruptSave(MachineFunction &MF,
+                                         MachineBasicBlock &MBB,
+                                         MachineBasicBlock::iterator MI,
+                                         DebugLoc DL) const {
+  SmallVector<unsigned, 6> Regs;
+  if (getInterruptSaves(MF, Regs)) {
+    // The interrupted code's values are swapped out rather than read.
+    for (unsigned Opc : {Z80::EXAF, Z80::EXX}) {
+      MachineInstrBuilder MIB = BuildMI(MBB, MI, DL, TII.get(Opc));
+      for (MachineOperand &MO : MIB->implicit_operands())
+        if (MO.isUse())
+          MO.setIsUndef();
+    }
   }
+  for (unsigned Reg : Regs) {
+    MBB.addLiveIn(Reg);
+    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::PUSH24r : Z80::PUSH16r))
+      .addReg(Reg, RegState::Kill);
+  }
+}
+
+/// emitInterruptReturn - Restore the registers saved by emitInterruptSave and
+/// replace the return at MI with reti, or retn for a non-maskable interrupt.
+/// Maskable interrupts are disabled on entry, so they are enabled again just
+/// before returning, which takes effect only after the reti.
+void Z80FrameLowering::emitInterruptReturn(MachineFunction &MF,
+                                           MachineBasicBlock &MBB,
+                                           MachineBasicBlock::iterator MI,
+                                           DebugLoc DL) const {
+  SmallVector<unsigned, 6> Regs;
+  bool Shadow = getInterruptSaves(MF, Regs);
+  for (unsigned Reg : reverse(Regs))
+    BuildMI(MBB, MI, DL, TII.get(Is24Bit ? Z80::POP24r : Z80::POP16r), Reg);
+  if (Shadow)
+    for (unsigned Opc : {Z80::EXX, Z80::EXAF})
+      BuildMI(MBB, MI, DL, TII.get(Opc));
+
+  bool IsNMI = MF.getFunction()->getFnAttribute("interrupt")
+    .getValueAsString() == "nmi";
+  if (!IsNMI)
+    BuildMI(MBB, MI, DL, TII.get(Z80::EI));
+  BuildMI(MBB, MI, DL, TII.get(IsNMI ? Z80::RETN : Z80::RETI));
+  MBB.erase(MI);
 }
 
 MachineBasicBlock::iterator Z80FrameLowering::
 eliminateCallFramePseudoInstr(MachineFunction &MF, MachineBasicBlock &MBB,
                               MachineBasicBlock::iterator I) const {
   if (!hasReservedCallFrame(MF)) {
-    unsigned Amount = I->getOperand(0).getImm();
+    int Amount = I->getOperand(0).getImm();
     unsigned ScratchReg = I->getOperand(I->getNumOperands() - 1).getReg();
     assert((Z80::A16RegClass.contains(ScratchReg) ||
             Z80::A24RegClass.contains(ScratchReg)) &&
            "Expected last operand to be the scratch reg.");
+    // For a setup, the second operand is the part of the frame that is already
+    // on the stack, and for a destroy, the part popped by the callee, while
+    // the third is the part that a later destroy frees.
+    Amount -= I->getOperand(1).getImm();
     if (I->getOpcode() == TII.getCallFrameSetupOpcode()) {
       Amount = -Amount;
     } else {
       assert(I->getOpcode() == TII.getCallFrameDestroyOpcode());
-      Amount -= I->getOperand(1).getImm();
+      Amount -= I->getOperand(2).getImm();
     }
     assert(TargetRegisterInfo::isPhysicalRegister(ScratchReg) &&
            "Reg alloc should have already happened.");
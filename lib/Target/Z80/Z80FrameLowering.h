@@ -52,11 +52,33 @@ public:
 
   bool hasFP(const MachineFunction &MF) const override;
 
+  /// isInterrupt - Return true if MF is an interrupt handler, which has to
+  /// preserve every register it touches and returns with reti or retn.
+  static bool isInterrupt(const MachineFunction &MF);
+
+  void determineCalleeSaves(MachineFunction &MF, BitVector &SavedRegs,
+                            RegScavenger *RS = nullptr) const override;
+
 private:
   void BuildStackAdjustment(MachineFunction &MF, MachineBasicBlock &MBB,
                             MachineBasicBlock::iterator MBBI, DebugLoc DL,
                             unsigned ScratchReg, int Offset,
                             int FPOffset = -1) const;
+  unsigned getFreeScratchReg(const MachineBasicBlock &MBB,
+                             ArrayRef<unsigned> Regs) const;
+  bool isFreeAt(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
+                unsigned Reg) const;
+  void emitStackPop(MachineBasicBlock &MBB, MachineBasicBlock::iterator MI,
+                    DebugLoc DL, unsigned DropReg, unsigned Bytes) const;
+  void emitCalleePop(MachineFunction &MF, MachineBasicBlock &MBB,
+                     MachineBasicBlock::iterator MI, DebugLoc DL,
+                     unsigned Bytes) const;
+  bool getInterruptSaves(const MachineFunction &MF,
+                         SmallVectorImpl<unsigned> &Regs) const;
+  void emitInterruptSave(MachineFunction &MF, MachineBasicBlock &MBB,
+                         MachineBasicBlock::iterator MI, DebugLoc DL) const;
+  void emitInterruptReturn(MachineFunction &MF, MachineBasicBlock &MBB,
+                           MachineBasicBlock::iterator MI, DebugLoc DL) const;
 };
 } // End llvm namespace
 
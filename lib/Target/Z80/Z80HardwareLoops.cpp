@@ -0,0 +1,294 @@
+//===-- Z80HardwareLoops.cpp - Form djnz loops ----------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a pass that rewrites loops counted down by an 8-bit
+// register to use djnz, which decrements b and branches while it is nonzero in
+// a single instruction.  An 8-bit down counter that exits on zero runs at most
+// 256 times, which is exactly what djnz does.
+//
+// The pass runs just before emission, after register allocation and block
+// placement, so that it only takes b when the allocator left it free
+// throughout the loop, and so that it can check that the loop branch is within
+// range of the displacement, since djnz has no long form to relax to.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Z80.h"
+#include "Z80InstrInfo.h"
+#include "Z80Subtarget.h"
+#include "MCTargetDesc/Z80BaseInfo.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/MC/MCAsmInfo.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "z80-hwloops"
+
+STATISTIC(NumDJNZLoops, "Number of loops converted to djnz");
+
+static cl::opt<bool>
+    NoZ80HardwareLoops("no-z80-hardware-loops",
+                       cl::desc("Avoid forming djnz loops"),
+                       cl::init(false), cl::Hidden);
+
+namespace {
+class Z80HardwareLoops : public MachineFunctionPass {
+public:
+  Z80HardwareLoops() : MachineFunctionPass(ID) {}
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.setPreservesCFG();
+    AU.addRequired<MachineLoopInfo>();
+    AU.addPreserved<MachineLoopInfo>();
+    MachineFunctionPass::getAnalysisUsage(AU);
+  }
+
+  MachineFunctionProperties getRequiredProperties() const override {
+    return MachineFunctionProperties()
+      .set(MachineFunctionProperties::Property::NoVRegs)
+      .set(MachineFunctionProperties::Property::TracksLiveness);
+  }
+
+  StringRef getPassName() const override { return "Z80 Hardware Loops"; }
+
+private:
+  bool convertLoop(MachineLoop &L);
+  bool isLiveIn(const MachineBasicBlock &MBB, unsigned Reg) const;
+  bool canRenameCounter(MachineLoop &L, unsigned CountReg) const;
+  unsigned getMaxInstSize(const MachineInstr &MI) const;
+  bool isInRange(MachineBasicBlock &Header, MachineBasicBlock &Latch) const;
+
+  const Z80InstrInfo *TII;
+  const TargetRegisterInfo *TRI;
+  const MCAsmInfo *MAI;
+
+  static char ID;
+};
+
+char Z80HardwareLoops::ID = 0;
+} // end anonymous namespace
+
+FunctionPass *llvm::createZ80HardwareLoops() { return new Z80HardwareLoops(); }
+
+bool Z80HardwareLoops::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(*MF.getFunction()) || NoZ80HardwareLoops.getValue())
+    return false;
+  const Z80Subtarget &STI = MF.getSubtarget<Z80Subtarget>();
+  TII = STI.getInstrInfo();
+  TRI = STI.getRegisterInfo();
+  MAI = MF.getTarget().getMCAsmInfo();
+  MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+
+  // Visit inner loops first, since they are the ones that benefit the most,
+  // and once an outer loop owns b, none of its inner loops can use it.
+  SmallVector<MachineLoop *, 8> Worklist(MLI.begin(), MLI.end());
+  SmallVector<MachineLoop *, 8> Loops;
+  while (!Worklist.empty()) {
+    MachineLoop *L = Worklist.pop_back_val();
+    Loops.push_back(L);
+    Worklist.append(L->begin(), L->end());
+  }
+  bool Changed = false;
+  for (MachineLoop *L : reverse(Loops))
+    Changed |= convertLoop(*L);
+  return Changed;
+}
+
+/// getMaxInstSize - Return an upper bound on the encoded size of MI.  Every
+/// instruction has one opcode, at most one immediate, displacement, or branch
+/// target, and at most two prefixes plus an eZ80 suffix.
+unsigned Z80HardwareLoops::getMaxInstSize(const MachineInstr &MI) const {
+  if (MI.isDebugValue() || MI.isPosition() || MI.isKill() ||
+      MI.isImplicitDef())
+    return 0;
+  // Inline asm is bounded by MaxInstLength for each statement.
+  if (MI.isInlineAsm())
+    return TII->getInlineAsmLength(MI.getOperand(0).getSymbolName(), *MAI);
+  // This pass runs after every target pseudo has been expanded.  Select, Sub,
+  // Cp, and Memmove, which expand to the most code, were replaced by their
+  // custom inserters before register allocation, and ADJCALLSTACK by frame
+  // lowering.  Of those expanded by expandPostRAPseudo, the largest are
+  // LD88ro and LD88or, at two suffixed indexed loads of 4 bytes each, while
+  // RCF, CALL16r, CALL24r, and TCRETURN become one instruction.
+  if (MI.isPseudo())
+    return 8;
+  uint64_t TSFlags = MI.getDesc().TSFlags;
+  unsigned Size = 2;
+  switch (TSFlags & Z80II::PrefixMask) {
+  case Z80II::DDCBPrefix:
+  case Z80II::FDCBPrefix:
+    ++Size;
+    break;
+  }
+  if ((TSFlags & Z80II::ModeMask) != Z80II::AnyMode)
+    ++Size;
+  for (const MachineOperand &MO : MI.explicit_operands())
+    if (!MO.isReg()) {
+      Size += 3;
+      break;
+    }
+  return Size;
+}
+
+/// isInRange - Return true if a djnz at the end of Latch can reach Header.
+bool Z80HardwareLoops::isInRange(MachineBasicBlock &Header,
+                                 MachineBasicBlock &Latch) const {
+  MachineFunction &MF = *Header.getParent();
+  unsigned Distance = 0;
+  // A backward branch goes from the end of the djnz to the start of Header.
+  for (auto I = Header.getIterator(), E = MF.end(); I != E; ++I) {
+    if (&*I == &Latch) {
+      for (auto MI = Latch.begin(), ME = Latch.getFirstTerminator(); MI != ME;
+           ++MI)
+        Distance += getMaxInstSize(*MI);
+      return Distance + 2 <= 128;
+    }
+    for (const MachineInstr &MI : *I)
+      Distance += getMaxInstSize(MI);
+    if (Distance > 128)
+      return false;
+  }
+  // A forward branch skips any jump to the exit and the blocks in between.
+  Distance = 4;
+  for (auto I = std::next(Latch.getIterator()), E = MF.end(); I != E; ++I) {
+    if (&*I == &Header)
+      return Distance <= 127;
+    for (const MachineInstr &MI : *I)
+      Distance += getMaxInstSize(MI);
+    if (Distance > 127)
+      return false;
+  }
+  return false;
+}
+
+/// isLiveIn - Return true if any part of Reg is live into MBB.
+bool Z80HardwareLoops::isLiveIn(const MachineBasicBlock &MBB,
+                                unsigned Reg) const {
+  for (MCRegAliasIterator AI(Reg, TRI, true); AI.isValid(); ++AI)
+    if (MBB.isLiveIn(*AI))
+      return true;
+  return false;
+}
+
+/// canRenameCounter - Return true if the counter in CountReg can be moved to b
+/// for the whole loop, which requires that the loop leave b alone, and that
+/// the counter neither escapes the loop nor shares its register with anything
+/// else in the loop.
+bool Z80HardwareLoops::canRenameCounter(MachineLoop &L,
+                                        unsigned CountReg) const {
+  // Any live in of b, bc, or ubc means that b holds a value across the loop.
+  if (isLiveIn(*L.getHeader(), Z80::B))
+    return false;
+  SmallVector<MachineBasicBlock *, 4> ExitBlocks;
+  L.getExitBlocks(ExitBlocks);
+  for (MachineBasicBlock *Exit : ExitBlocks)
+    if (isLiveIn(*Exit, CountReg) || isLiveIn(*Exit, Z80::B))
+      return false;
+  for (MachineBasicBlock *MBB : L.blocks())
+    for (MachineInstr &MI : *MBB) {
+      if (MI.readsRegister(Z80::B, TRI) || MI.modifiesRegister(Z80::B, TRI))
+        return false;
+      for (const MachineOperand &MO : MI.operands())
+        if (MO.isReg() && MO.getReg() && MO.getReg() != CountReg &&
+            TRI->regsOverlap(MO.getReg(), CountReg))
+          return false;
+    }
+  return true;
+}
+
+bool Z80HardwareLoops::convertLoop(MachineLoop &L) {
+  MachineBasicBlock *Header = L.getHeader();
+  MachineBasicBlock *Latch = L.getLoopLatch();
+  MachineBasicBlock *Preheader = L.getLoopPreheader();
+  if (!Latch || !Preheader)
+    return false;
+
+  // The latch must branch back to the header while the counter is nonzero.
+  MachineBasicBlock *TBB = nullptr, *FBB = nullptr, *Exit;
+  SmallVector<MachineOperand, 1> Cond;
+  if (TII->analyzeBranch(*Latch, TBB, FBB, Cond, false) || Cond.size() != 1)
+    return false;
+  auto Next = std::next(Latch->getIterator());
+  MachineBasicBlock *LayoutSucc =
+    Next == Latch->getParent()->end() ? nullptr : &*Next;
+  switch (Cond[0].getImm()) {
+  default:
+    return false;
+  case Z80::COND_NZ:
+    if (TBB != Header)
+      return false;
+    Exit = FBB ? FBB : LayoutSucc;
+    break;
+  case Z80::COND_Z:
+    if ((FBB ? FBB : LayoutSucc) != Header)
+      return false;
+    Exit = TBB;
+    break;
+  }
+  if (!Exit || isLiveIn(*Exit, Z80::F) || isLiveIn(*Header, Z80::F))
+    return false;
+
+  // Find the decrement that sets the flags for the branch.  Nothing after it
+  // may look at the counter, since b is only decremented by the djnz itself.
+  MachineInstr *Dec = nullptr;
+  unsigned CountReg = 0;
+  for (auto I = Latch->getFirstTerminator(); I != Latch->begin();) {
+    MachineInstr &MI = *--I;
+    if (MI.isDebugValue())
+      continue;
+    if (MI.getOpcode() == Z80::DEC8r) {
+      Dec = &MI;
+      CountReg = MI.getOperand(0).getReg();
+      break;
+    }
+    if (MI.readsRegister(Z80::F, TRI) || MI.modifiesRegister(Z80::F, TRI))
+      return false;
+  }
+  if (!Dec)
+    return false;
+  for (auto I = std::next(Dec->getIterator()), E = Latch->getFirstTerminator();
+       I != E; ++I)
+    if (I->readsRegister(CountReg, TRI) || I->modifiesRegister(CountReg, TRI) ||
+        I->readsRegister(Z80::B, TRI) || I->modifiesRegister(Z80::B, TRI))
+      return false;
+
+  if (CountReg != Z80::B && !canRenameCounter(L, CountReg))
+    return false;
+  if (!isInRange(*Header, *Latch))
+    return false;
+
+  DEBUG(dbgs() << "Converting loop at BB#" << Header->getNumber()
+               << " to djnz\n");
+  if (CountReg != Z80::B) {
+    for (MachineBasicBlock *MBB : L.blocks()) {
+      for (MachineInstr &MI : *MBB)
+        for (MachineOperand &MO : MI.operands())
+          if (MO.isReg() && MO.getReg() == CountReg)
+            MO.setReg(Z80::B);
+      if (MBB->isLiveIn(CountReg)) {
+        MBB->removeLiveIn(CountReg);
+        MBB->addLiveIn(Z80::B);
+      }
+    }
+    TII->copyPhysReg(*Preheader, Preheader->getFirstTerminator(),
+                     Dec->getDebugLoc(), Z80::B, CountReg, true);
+  }
+  DebugLoc DL = Dec->getDebugLoc();
+  Dec->eraseFromParent();
+  TII->removeBranch(*Latch);
+  BuildMI(Latch, DL, TII->get(Z80::DJNZ)).addMBB(Header);
+  if (Exit != LayoutSucc)
+    TII->insertBranch(*Latch, Exit, nullptr, None, DL);
+  ++NumDJNZLoops;
+  return true;
+}
@@ -13,7 +13,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "Z80ISelLowering.h"
+#include "Z80FrameLowering.h"
 #include "MCTargetDesc/Z80MCTargetDesc.h"
+#include "Z80MachineFunctionInfo.h"
 #include "Z80Subtarget.h"
 #include "Z80TargetMachine.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
@@ -38,10 +40,12 @@ Z80TargetLowering::Z80TargetLowering(const Z80TargetMachine &TM,
     addRegisterClass(MVT::i24, &Z80::R24RegClass);
     //addRegisterClass(MVT::i32, &Z80::R24RegClass);
   }
-  for (auto VT : { MVT::i16, MVT::i24, MVT::i32 })
+  for (auto VT : { MVT::i16, MVT::i24 })
     for (unsigned Opc : { ISD::AND, ISD::OR, ISD::XOR,
                           ISD::SHL, ISD::SRA, ISD::SRL })
-      setOperationAction(Opc, VT, LibCall);
+      setOperationAction(Opc, VT, Custom);
+  for (unsigned Opc : { ISD::SHL, ISD::SRA, ISD::SRL })
+    setOperationAction(Opc, MVT::i32, LibCall);
   for (auto VT : { MVT::i8, MVT::i16, MVT::i24, MVT::i32 }) {
     for (unsigned Opc : { ISD::MUL,
                           ISD::SDIV,    ISD::UDIV,
@@ -83,6 +87,11 @@ Z80TargetLowering::Z80TargetLowering(const Z80TargetMachine &TM,
 
   setStackPointerRegisterToSaveRestore(Is24Bit ? Z80::SPL : Z80::SPS);
 
+  // Byte copies are cheaper as ldi than as separate loads and stores, so leave
+  // them to Z80SelectionDAGInfo.
+  MaxStoresPerMemcpy = MaxStoresPerMemcpyOptSize = 0;
+  MaxStoresPerMemmove = MaxStoresPerMemmoveOptSize = 0;
+
   // Compute derived properties from the register classes
   computeRegisterProperties(STI.getRegisterInfo());
 
@@ -265,6 +274,9 @@ SDValue Z80TargetLowering::LowerOperation(SDValue Op, SelectionDAG &DAG) const {
   case ISD::SETCC:     return LowerSETCC(Op, DAG);
   case ISD::SELECT_CC: return LowerSELECT_CC(Op, DAG);
   case ISD::MUL:       return LowerMUL(Op, DAG);
+  case ISD::AND:
+  case ISD::OR:
+  case ISD::XOR:       return LowerBitwise(Op, DAG);
   case ISD::SHL:       return LowerSHL(Op, DAG);
   case ISD::SRA:       return LowerSHR(true, Op, DAG);
   case ISD::SRL:       return LowerSHR(false, Op, DAG);
@@ -332,6 +344,83 @@ SDValue Z80TargetLowering::LowerStore(StoreSDNode *Node,
   return Ch;
 }
 
+/// getByte - Return the byte of Op at sub-register index Idx, which must be
+/// sub_low or sub_high.
+static SDValue getByte(unsigned Idx, const SDLoc &DL, SDValue Op,
+                       SelectionDAG &DAG) {
+  if (ConstantSDNode *Const = dyn_cast<ConstantSDNode>(Op))
+    return DAG.getConstant(Const->getAPIntValue()
+                               .lshr(Idx == Z80::sub_high ? 8 : 0).trunc(8),
+                           DL, MVT::i8);
+  return DAG.getTargetExtractSubreg(Idx, DL, MVT::i8, Op);
+}
+
+/// buildWord - Return Base with its sub_low and sub_high bytes replaced by Lo
+/// and Hi.
+static SDValue buildWord(SDValue Base, SDValue Lo, SDValue Hi, const SDLoc &DL,
+                         SelectionDAG &DAG) {
+  EVT VT = Base.getValueType();
+  SDValue Res = DAG.getTargetInsertSubreg(Z80::sub_low, DL, VT, Base, Lo);
+  return DAG.getTargetInsertSubreg(Z80::sub_high, DL, VT, Res, Hi);
+}
+
+/// LowerBitwise - Lower an i16 or i24 AND, OR, or XOR to the equivalent i8
+/// operations on the register halves, which are performed through A.  The
+/// upper byte of a 24-bit register is not directly accessible, so an i24
+/// operation is only lowered inline when the upper byte of the result is
+/// known, or is the upper byte of one of the operands.  Otherwise, and when
+/// optimizing for minimum size, the smaller runtime library call is used.
+SDValue Z80TargetLowering::LowerBitwise(SDValue Op, SelectionDAG &DAG) const {
+  EVT VT = Op.getValueType();
+  unsigned Opc = Op.getOpcode();
+  SDLoc DL(Op);
+  SDValue LHS = Op.getOperand(0), RHS = Op.getOperand(1);
+  auto LowerToLibCall = [&] {
+    return LowerLibCall(RTLIB::UNKNOWN_LIBCALL,
+                        Opc == ISD::AND ? RTLIB::AND_I16 :
+                        Opc == ISD::OR  ? RTLIB:: OR_I16 : RTLIB::XOR_I16,
+                        Opc == ISD::AND ? RTLIB::AND_I24 :
+                        Opc == ISD::OR  ? RTLIB:: OR_I24 : RTLIB::XOR_I24,
+                        RTLIB::UNKNOWN_LIBCALL, Op, DAG);
+  };
+  if (DAG.getMachineFunction().getFunction()->optForMinSize())
+    return LowerToLibCall();
+
+  SDValue Base;
+  if (VT == MVT::i24) {
+    // Find the value that provides the upper byte of the result.
+    APInt TopMask = APInt::getHighBitsSet(24, 8);
+    APInt KnownZero, KnownOne;
+    DAG.computeKnownBits(Op, KnownZero, KnownOne);
+    if (((KnownZero | KnownOne) & TopMask) == TopMask)
+      Base = DAG.getConstant(KnownOne & TopMask, DL, VT);
+    else {
+      // An operand whose upper byte is all ones for AND, or all zeros for OR
+      // and XOR, leaves the upper byte of the other operand unchanged.
+      for (SDValue Identity : { RHS, LHS }) {
+        DAG.computeKnownBits(Identity, KnownZero, KnownOne);
+        if (((Opc == ISD::AND ? KnownOne : KnownZero) & TopMask) == TopMask) {
+          Base = Identity == RHS ? LHS : RHS;
+          break;
+        }
+      }
+      if (!Base)
+        return LowerToLibCall();
+    }
+  } else {
+    assert(VT == MVT::i16 && "Unexpected type");
+    Base = DAG.getUNDEF(VT);
+  }
+
+  SDValue Lo = DAG.getNode(Opc, DL, MVT::i8,
+                           getByte(Z80::sub_low,  DL, LHS, DAG),
+                           getByte(Z80::sub_low,  DL, RHS, DAG));
+  SDValue Hi = DAG.getNode(Opc, DL, MVT::i8,
+                           getByte(Z80::sub_high, DL, LHS, DAG),
+                           getByte(Z80::sub_high, DL, RHS, DAG));
+  return buildWord(Base, Lo, Hi, DL, DAG);
+}
+
 SDValue Z80TargetLowering::EmitCmp(SDValue LHS, SDValue RHS, SDValue &TargetCC,
                                    ISD::CondCode CC, const SDLoc &DL,
                                    SelectionDAG &DAG) const {
@@ -642,54 +731,131 @@ SDValue Z80TargetLowering::LowerADDSUB(SDValue Op, SelectionDAG &DAG) const {
   return DAG.getMergeValues(makeArrayRef(Ops, 2), DL);
 }
 
+/// isInlineShiftCheaper - Estimate whether shifting a VT value by a constant
+/// Amount inline is cheaper than calling the _b library routine, in bytes when
+/// optimizing for size and in T-states otherwise.
+static bool isInlineShiftCheaper(unsigned Opc, EVT VT, unsigned Amount,
+                                 SelectionDAG &DAG) {
+  unsigned Bytes = 0, Cycles = 0;
+  if (Opc == ISD::SHL && VT == MVT::i24) {
+    // add hl, hl
+    Bytes = Amount;
+    Cycles = 11 * Amount;
+  } else if (Opc == ISD::SHL) {
+    if (Amount >= 8) {
+      // ld h, l; ld l, 0
+      Bytes += 3;
+      Cycles += 11;
+    }
+    // add hl, hl
+    Bytes += Amount % 8;
+    Cycles += 11 * (Amount % 8);
+  } else if (Amount >= 8) {
+    // ld l, h; ld h, 0 or ld l, h; ld a, h; add a, a; sbc a, a; ld h, a
+    Bytes += Opc == ISD::SRA ? 5 : 3;
+    Cycles += Opc == ISD::SRA ? 20 : 11;
+    // srl l or sra l
+    Bytes += 2 * (Amount % 8);
+    Cycles += 8 * (Amount % 8);
+  } else {
+    // srl h; rr l or sra h; rr l
+    Bytes = 4 * Amount;
+    Cycles = 16 * Amount;
+  }
+  // ld a, n; call _?sh?_b, and a loop of about 24 T-states per bit.
+  const unsigned CallBytes = 5, CallCycles = 7 + 17 + 20 + 24 * Amount;
+  if (DAG.getMachineFunction().getFunction()->optForSize())
+    return Bytes <= CallBytes;
+  return Cycles <= CallCycles;
+}
+
+/// LowerSHL - Lower a shift left by a constant amount to a byte move for
+/// multiples of 8, followed by a chain of adds.
 SDValue Z80TargetLowering::LowerSHL(SDValue Op, SelectionDAG &DAG) const {
   EVT VT = Op.getValueType();
   SDLoc DL(Op);
-  if (ConstantSDNode *ShiftAmountNode =
-      dyn_cast<ConstantSDNode>(Op.getOperand(1))) {
-    uint64_t ShiftAmount = ShiftAmountNode->getZExtValue();
-    SDValue Res = Op.getOperand(0);
-    while (ShiftAmount--)
-      if (VT == MVT::i8)
-        Res = DAG.getNode(Z80ISD::SLA, DL, DAG.getVTList(MVT::i8, MVT::i8), Res);
-      else
-        Res = DAG.getNode(ISD::ADD, DL, VT, Res, Res);
-    return Res;
+  ConstantSDNode *AmountNode = dyn_cast<ConstantSDNode>(Op.getOperand(1));
+  if (!AmountNode)
+    return LowerLibCall(RTLIB::SHL_I8, RTLIB::SHL_I16, RTLIB::SHL_I24,
+                        RTLIB::SHL_I32, Op, DAG);
+  unsigned Amount = AmountNode->getZExtValue();
+  if (Amount >= VT.getSizeInBits())
+    return DAG.getUNDEF(VT);
+  if (!isInlineShiftCheaper(ISD::SHL, VT, Amount, DAG))
+    return LowerLibCall(RTLIB::UNKNOWN_LIBCALL, RTLIB::SHL_I16_I8,
+                        RTLIB::SHL_I24_I8, RTLIB::UNKNOWN_LIBCALL, Op, DAG);
+  SDValue Res = Op.getOperand(0);
+  // The upper byte of a 24-bit register is not accessible, so only i16 can
+  // shift by whole bytes.
+  if (VT == MVT::i16 && Amount >= 8) {
+    Res = buildWord(DAG.getUNDEF(VT), DAG.getConstant(0, DL, MVT::i8),
+                    getByte(Z80::sub_low, DL, Res, DAG), DL, DAG);
+    Amount -= 8;
   }
-  return DAG.getNode(ISD::SHL, DL, VT, Op.getOperand(0), Op.getOperand(1));
+  while (Amount--)
+    Res = DAG.getNode(ISD::ADD, DL, VT, Res, Res);
+  return Res;
 }
+
+/// LowerSHR - Lower a shift right by a constant amount to a byte move for
+/// multiples of 8, followed by a chain of srl or sra and rr.  An i24 value is
+/// only shifted inline when its upper byte is known to be zero, since it is
+/// not otherwise accessible.
 SDValue Z80TargetLowering::LowerSHR(bool Signed, SDValue Op,
                                     SelectionDAG &DAG) const {
   EVT VT = Op.getValueType();
-  assert(VT.getSizeInBits() <= 32 && VT.getSizeInBits() % 8 == 0 &&
-         "Can only handle multiple of byte sized operations");
   SDLoc DL(Op);
-  SmallVector<SDValue, 4> Bytes;
-  for (unsigned Shift = VT.getSizeInBits(); Shift; Shift -= 8)
-    Bytes.push_back(DAG.getNode(ISD::TRUNCATE, DL, MVT::i8,
-                                DAG.getNode(ISD::SRL, DL, VT, Op.getOperand(0),
-                                            DAG.getConstant(Shift-8, DL, VT))));
-  if (ConstantSDNode *ShiftAmountNode =
-      dyn_cast<ConstantSDNode>(Op.getOperand(1))) {
-    uint64_t ShiftAmount = ShiftAmountNode->getZExtValue();
-    while (ShiftAmount--) {
-      Bytes[0] = DAG.getNode(Signed ? Z80ISD::SRA : Z80ISD::SRL, DL,
-                             DAG.getVTList(MVT::i8, MVT::i8), Bytes[0]);
-      for (unsigned I = 1, E = Bytes.size(); I != E; ++I)
-        Bytes[I] = DAG.getNode(Z80ISD::RR, DL, DAG.getVTList(MVT::i8, MVT::i8),
-                               Bytes[I], Bytes[I-1].getValue(1));
+  SDValue Val = Op.getOperand(0);
+  ConstantSDNode *AmountNode = dyn_cast<ConstantSDNode>(Op.getOperand(1));
+  if (!AmountNode)
+    return Signed ? LowerLibCall(RTLIB::SRA_I8, RTLIB::SRA_I16, RTLIB::SRA_I24,
+                                 RTLIB::SRA_I32, Op, DAG)
+                  : LowerLibCall(RTLIB::SRL_I8, RTLIB::SRL_I16, RTLIB::SRL_I24,
+                                 RTLIB::SRL_I32, Op, DAG);
+  unsigned Amount = AmountNode->getZExtValue();
+  if (Amount >= VT.getSizeInBits())
+    return DAG.getUNDEF(VT);
+  SDValue Base = DAG.getUNDEF(VT);
+  bool Inline = true;
+  if (VT == MVT::i24) {
+    Inline = DAG.MaskedValueIsZero(Val, APInt::getHighBitsSet(24, 8));
+    if (Inline && Amount >= 16)
+      return DAG.getConstant(0, DL, VT);
+    Signed = false;
+    Base = DAG.getConstant(0, DL, VT);
+  }
+  if (!Inline ||
+      !isInlineShiftCheaper(Signed ? ISD::SRA : ISD::SRL, VT, Amount, DAG))
+    return Signed ? LowerLibCall(RTLIB::UNKNOWN_LIBCALL, RTLIB::SRA_I16_I8,
+                                 RTLIB::SRA_I24_I8, RTLIB::UNKNOWN_LIBCALL,
+                                 Op, DAG)
+                  : LowerLibCall(RTLIB::UNKNOWN_LIBCALL, RTLIB::SRL_I16_I8,
+                                 RTLIB::SRL_I24_I8, RTLIB::UNKNOWN_LIBCALL,
+                                 Op, DAG);
+  SDVTList VTs = DAG.getVTList(MVT::i8, MVT::i8);
+  unsigned Opc = Signed ? Z80ISD::SRA : Z80ISD::SRL;
+  SDValue Lo = getByte(Z80::sub_low, DL, Val, DAG);
+  SDValue Hi = getByte(Z80::sub_high, DL, Val, DAG);
+  if (Amount >= 8) {
+    Lo = Hi;
+    if (Signed) {
+      // Doubling the high byte shifts the sign bit into the carry, and then
+      // subtracting the result from itself with borrow gives the
+      // sign-extension byte.  This is add a, a and sbc a, a, rather than the
+      // two byte sla.
+      SDValue Sign = DAG.getNode(Z80ISD::ADD, DL, VTs, Hi, Hi);
+      Hi = DAG.getNode(Z80ISD::SBC, DL, VTs, Sign, Sign, Sign.getValue(1));
+    } else
+      Hi = DAG.getConstant(0, DL, MVT::i8);
+    for (Amount -= 8; Amount; --Amount)
+      Lo = DAG.getNode(Opc, DL, VTs, Lo);
+  } else {
+    for (; Amount; --Amount) {
+      Hi = DAG.getNode(Opc, DL, VTs, Hi);
+      Lo = DAG.getNode(Z80ISD::RR, DL, VTs, Lo, Hi.getValue(1));
     }
-    SDValue Res = DAG.getConstant(0, DL, VT);
-    for (unsigned Shift = VT.getSizeInBits(); Shift; Shift -= 8)
-      Res = DAG.getNode(ISD::OR, DL, VT, Res,
-                        DAG.getNode(ISD::SHL, DL, VT,
-                                    DAG.getNode(ISD::ZERO_EXTEND, DL, VT,
-                                                Bytes.pop_back_val()),
-                                    DAG.getConstant(Shift-8, DL, VT)));
-    return Res;
   }
-  return DAG.getNode(Signed ? ISD::SRA : ISD::SRL, DL, VT,
-                     Op.getOperand(0), Op.getOperand(1));
+  return buildWord(Base, Lo, Hi, DL, DAG);
 }
 
 SDValue Z80TargetLowering::LowerMUL(SDValue Op, SelectionDAG &DAG) const {
@@ -1261,6 +1427,9 @@ Z80TargetLowering::EmitInstrWithCustomInserter(MachineInstr &MI,
   case Z80::Select16:
   case Z80::Select24:
     return EmitLoweredSelect(MI, BB);
+  case Z80::Memmove16:
+  case Z80::Memmove24:
+    return EmitLoweredMemmove(MI, BB);
   }
 }
 
@@ -1424,6 +1593,83 @@ Z80TargetLowering::EmitLoweredSelect(MachineInstr &MI,
   return BB;
 }
 
+MachineBasicBlock *
+Z80TargetLowering::EmitLoweredMemmove(MachineInstr &MI,
+                                      MachineBasicBlock *BB) const {
+  bool Is24Bit = MI.getOpcode() == Z80::Memmove24;
+  assert((Is24Bit || MI.getOpcode() == Z80::Memmove16) && "Unexpected opcode");
+  const TargetInstrInfo *TII = Subtarget.getInstrInfo();
+  DebugLoc DL = MI.getDebugLoc();
+  unsigned SrcReg = Is24Bit ? Z80::UHL : Z80::HL;
+  unsigned DstReg = Is24Bit ? Z80::UDE : Z80::DE;
+  unsigned CountReg = Is24Bit ? Z80::UBC : Z80::BC;
+
+  // A forward copy is only unsafe when the source is below the destination,
+  // in which case the copy is done backwards starting from the last bytes.
+  const BasicBlock *LLVM_BB = BB->getBasicBlock();
+  MachineFunction::iterator I = ++BB->getIterator();
+
+  //  thisMBB:
+  //  ...
+  //   or a, a ; sbc hl, de ; add hl, de
+  //   jr c, backMBB
+  //   fallthrough --> forwardMBB
+  MachineBasicBlock *thisMBB = BB;
+  MachineFunction *F = BB->getParent();
+  MachineBasicBlock *forwardMBB = F->CreateMachineBasicBlock(LLVM_BB);
+  MachineBasicBlock *backMBB = F->CreateMachineBasicBlock(LLVM_BB);
+  MachineBasicBlock *doneMBB = F->CreateMachineBasicBlock(LLVM_BB);
+  F->insert(I, forwardMBB);
+  F->insert(I, backMBB);
+  F->insert(I, doneMBB);
+  for (MachineBasicBlock *MBB : {forwardMBB, backMBB}) {
+    MBB->addLiveIn(SrcReg);
+    MBB->addLiveIn(DstReg);
+    MBB->addLiveIn(CountReg);
+  }
+
+  doneMBB->splice(doneMBB->begin(), BB,
+                  std::next(MachineBasicBlock::iterator(MI)), BB->end());
+  doneMBB->transferSuccessorsAndUpdatePHIs(BB);
+  BB->addSuccessor(forwardMBB);
+  BB->addSuccessor(backMBB);
+
+  BuildMI(BB, DL, TII->get(Z80::RCF));
+  BuildMI(BB, DL, TII->get(Is24Bit ? Z80::SBC24ar : Z80::SBC16ar))
+    .addReg(DstReg);
+  BuildMI(BB, DL, TII->get(Is24Bit ? Z80::ADD24ao : Z80::ADD16ao), SrcReg)
+    .addReg(SrcReg).addReg(DstReg);
+  BuildMI(BB, DL, TII->get(Z80::JQCC)).addMBB(backMBB).addImm(Z80::COND_C);
+
+  //  forwardMBB:
+  //   ldir
+  //   jr doneMBB
+  BB = forwardMBB;
+  BB->addSuccessor(doneMBB);
+  BuildMI(BB, DL, TII->get(Is24Bit ? Z80::LDIR24 : Z80::LDIR16));
+  BuildMI(BB, DL, TII->get(Z80::JQ)).addMBB(doneMBB);
+
+  //  backMBB:
+  //   add hl, bc ; dec hl ; ex de, hl
+  //   add hl, bc ; dec hl ; ex de, hl
+  //   lddr
+  //   # fallthrough to doneMBB
+  BB = backMBB;
+  BB->addSuccessor(doneMBB);
+  for (int Ptr = 0; Ptr != 2; ++Ptr) {
+    BuildMI(BB, DL, TII->get(Is24Bit ? Z80::ADD24ao : Z80::ADD16ao), SrcReg)
+      .addReg(SrcReg).addReg(CountReg);
+    BuildMI(BB, DL, TII->get(Is24Bit ? Z80::DEC24r : Z80::DEC16r), SrcReg)
+      .addReg(SrcReg);
+    BuildMI(BB, DL, TII->get(Is24Bit ? Z80::EX24DE : Z80::EX16DE));
+  }
+  BuildMI(BB, DL, TII->get(Is24Bit ? Z80::LDDR24 : Z80::LDDR16));
+
+  MI.eraseFromParent();   // The pseudo instruction is gone now.
+  DEBUG(F->dump());
+  return doneMBB;
+}
+
 //===----------------------------------------------------------------------===//
 //               Return Value Calling Convention Implementation
 //===----------------------------------------------------------------------===//
@@ -1435,7 +1681,10 @@ CCAssignFn *Z80TargetLowering::getCCAssignFn(CallingConv::ID CallConv) const {
   switch (CallConv) {
   default: llvm_unreachable("Unsupported calling convention!");
   case CallingConv::C:
+  case CallingConv::X86_StdCall:
     return Is24Bit ? CC_EZ80_C : CC_Z80_C;
+  case CallingConv::Fast:
+    return Is24Bit ? CC_EZ80_Fast : CC_Z80_Fast;
   case CallingConv::Z80_LibCall:
     return CC_EZ80_LC_AB;
   case CallingConv::Z80_LibCall_AC:
@@ -1453,6 +1702,8 @@ CCAssignFn *Z80TargetLowering::getRetCCAssignFn(CallingConv::ID CallConv) const
   switch (CallConv) {
   default: llvm_unreachable("Unsupported calling convention!");
   case CallingConv::C:
+  case CallingConv::Fast:
+  case CallingConv::X86_StdCall:
   case CallingConv::Z80_LibCall:
   case CallingConv::Z80_LibCall_AC:
   case CallingConv::Z80_LibCall_BC:
@@ -1463,6 +1714,56 @@ CCAssignFn *Z80TargetLowering::getRetCCAssignFn(CallingConv::ID CallConv) const
   }
 }
 
+/// isCalleePop - Return true if a function with the given calling convention
+/// pops its own stack arguments.  The stdcall convention does, unless it is
+/// variadic, or its result is so wide that the return sequence would not be
+/// left with hl or iy to jump through.
+static bool isCalleePop(CallingConv::ID CallConv, bool IsVarArg, Type *RetTy,
+                        const DataLayout &DL) {
+  if (CallConv != CallingConv::X86_StdCall || IsVarArg)
+    return false;
+  return RetTy->isVoidTy() ||
+    DL.getTypeSizeInBits(RetTy) <= 2 * DL.getPointerSizeInBits();
+}
+
+/// MatchingStackOffset - Return true if the given stack call argument is
+/// already available in the same position (relatively) of the caller's
+/// incoming argument stack.
+static bool MatchingStackOffset(SDValue Arg, unsigned Offset,
+                                ISD::ArgFlagsTy Flags, MachineFrameInfo &MFI,
+                                const MachineRegisterInfo *MRI,
+                                const TargetInstrInfo *TII) {
+  unsigned Bytes = Arg.getValueType().getSizeInBits() / 8;
+  int FI = INT_MAX;
+  if (Arg.getOpcode() == ISD::CopyFromReg) {
+    unsigned VR = cast<RegisterSDNode>(Arg.getOperand(1))->getReg();
+    if (!TargetRegisterInfo::isVirtualRegister(VR))
+      return false;
+    MachineInstr *Def = MRI->getVRegDef(VR);
+    if (!Def)
+      return false;
+    if (Flags.isByVal() || !TII->isLoadFromStackSlot(*Def, FI))
+      return false;
+  } else if (LoadSDNode *Ld = dyn_cast<LoadSDNode>(Arg)) {
+    if (Flags.isByVal())
+      return false;
+    SDValue Ptr = Ld->getBasePtr();
+    FrameIndexSDNode *FINode = dyn_cast<FrameIndexSDNode>(Ptr);
+    if (!FINode)
+      return false;
+    FI = FINode->getIndex();
+  } else if (Arg.getOpcode() == ISD::FrameIndex && Flags.isByVal()) {
+    FrameIndexSDNode *FINode = cast<FrameIndexSDNode>(Arg);
+    FI = FINode->getIndex();
+    Bytes = Flags.getByValSize();
+  } else
+    return false;
+
+  assert(FI != INT_MAX);
+  return MFI.isFixedObjectIndex(FI) && Offset == MFI.getObjectOffset(FI) &&
+    Bytes == MFI.getObjectSize(FI);
+}
+
 SDValue Z80TargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
                                      SmallVectorImpl<SDValue> &InVals) const {
   SelectionDAG &DAG                     = CLI.DAG;
@@ -1501,7 +1802,7 @@ SDValue Z80TargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
 
   SmallVector<std::pair<unsigned, SDValue>, 2> RegsToPass;
   SmallVector<SDValue, 14> MemOpChains;
-  SDValue StackPtr;
+  SDValue StackPtr, ArgChain;
   const TargetRegisterInfo *RegInfo = Subtarget.getRegisterInfo();
 
   // Walk the register/memloc assignments, inserting copies/loads.
@@ -1539,6 +1840,23 @@ SDValue Z80TargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
           DAG.getMemBasePlusOffset(StackPtr, VA.getLocMemOffset(), DL),
           MachinePointerInfo::getStack(DAG.getMachineFunction(),
                                        VA.getLocMemOffset())));
+    } else {
+      // A sibling call passes its stack arguments in the caller's incoming
+      // argument area.  Arguments that are already in place are left alone,
+      // and the rest are stored only after every incoming argument has been
+      // loaded, since the stores may overwrite them.
+      MachineFrameInfo &MFI = MF.getFrameInfo();
+      if (MatchingStackOffset(Arg, VA.getLocMemOffset(), Outs[I].Flags, MFI,
+                              &MF.getRegInfo(), Subtarget.getInstrInfo()))
+        continue;
+      assert(!Outs[I].Flags.isByVal() && "Unexpected byval tail call");
+      if (!ArgChain.getNode())
+        ArgChain = DAG.getStackArgumentTokenFactor(Chain);
+      int FI = MFI.CreateFixedObject(Arg.getValueType().getStoreSize(),
+                                     VA.getLocMemOffset(), false);
+      MemOpChains.push_back(DAG.getStore(
+          ArgChain, DL, Arg, DAG.getFrameIndex(FI, PtrVT),
+          MachinePointerInfo::getFixedStack(MF, FI)));
     }
   }
 
@@ -1587,8 +1905,13 @@ SDValue Z80TargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
   InFlag = Chain.getValue(1);
 
   // Create the CALLSEQ_END node.
+  unsigned NumBytesForCalleeToPop =
+    isCalleePop(CallConv, IsVarArg, CLI.RetTy, DAG.getDataLayout()) ? NumBytes
+                                                                    : 0;
   Chain = DAG.getCALLSEQ_END(Chain, DAG.getIntPtrConstant(NumBytes, DL, true),
-                             DAG.getIntPtrConstant(0, DL, true), InFlag, DL);
+                             DAG.getIntPtrConstant(NumBytesForCalleeToPop, DL,
+                                                   true),
+                             InFlag, DL);
   InFlag = Chain.getValue(1);
 
   // Handle result values, copying them out of physregs into vregs that we
@@ -1597,46 +1920,11 @@ SDValue Z80TargetLowering::LowerCall(TargetLowering::CallLoweringInfo &CLI,
                          InVals);
 }
 
-/// MatchingStackOffset - Return true if the given stack call argument is
-/// already available in the same position (relatively) of the caller's
-/// incoming argument stack.
-static bool MatchingStackOffset(SDValue Arg, unsigned Offset,
-                                ISD::ArgFlagsTy Flags, MachineFrameInfo &MFI,
-                                const MachineRegisterInfo *MRI,
-                                const TargetInstrInfo *TII) {
-  unsigned Bytes = Arg.getValueType().getSizeInBits() / 8;
-  int FI = INT_MAX;
-  if (Arg.getOpcode() == ISD::CopyFromReg) {
-    unsigned VR = cast<RegisterSDNode>(Arg.getOperand(1))->getReg();
-    if (!TargetRegisterInfo::isVirtualRegister(VR))
-      return false;
-    MachineInstr *Def = MRI->getVRegDef(VR);
-    if (!Def)
-      return false;
-    if (Flags.isByVal() || !TII->isLoadFromStackSlot(*Def, FI))
-      return false;
-  } else if (LoadSDNode *Ld = dyn_cast<LoadSDNode>(Arg)) {
-    if (Flags.isByVal())
-      return false;
-    SDValue Ptr = Ld->getBasePtr();
-    FrameIndexSDNode *FINode = dyn_cast<FrameIndexSDNode>(Ptr);
-    if (!FINode)
-      return false;
-    FI = FINode->getIndex();
-  } else if (Arg.getOpcode() == ISD::FrameIndex && Flags.isByVal()) {
-    FrameIndexSDNode *FINode = cast<FrameIndexSDNode>(Arg);
-    FI = FINode->getIndex();
-    Bytes = Flags.getByValSize();
-  } else
-    return false;
-
-  assert(FI != INT_MAX);
-  return MFI.isFixedObjectIndex(FI) && Offset == MFI.getObjectOffset(FI) &&
-    Bytes == MFI.getObjectSize(FI);
-}
-
 /// Check whether the call is eligible for tail call optimization. Targets
 /// that want to do tail call optimization should implement this function.
+/// The callee's stack arguments are stored over the caller's incoming ones, so
+/// it must not need more of them, and both functions must leave the same
+/// number of bytes for the caller's caller to pop.
 bool Z80TargetLowering::IsEligibleForTailCallOptimization(
     SDValue Callee, CallingConv::ID CalleeCC, bool isVarArg, Type *RetTy,
     const SmallVectorImpl<ISD::OutputArg> &Outs,
@@ -1645,38 +1933,49 @@ bool Z80TargetLowering::IsEligibleForTailCallOptimization(
   MachineFunction &MF = DAG.getMachineFunction();
   const Function *CallerF = MF.getFunction();
   CallingConv::ID CallerCC = CallerF->getCallingConv();
-  // TODO: Handle other calling conventions when they exist
-  if (CalleeCC != CallingConv::C || CallerCC != CallingConv::C)
+  // An interrupt handler has to restore the registers and return with reti.
+  if (Z80FrameLowering::isInterrupt(MF))
+    return false;
+  // These conventions all preserve the same registers.
+  for (CallingConv::ID CC : {CalleeCC, CallerCC})
+    if (CC != CallingConv::C && CC != CallingConv::Fast &&
+        CC != CallingConv::X86_StdCall)
+      return false;
+  // The address of a returned struct is not preserved for the caller.
+  if (CallerF->hasStructRetAttr())
     return false;
   LLVMContext &C = *DAG.getContext();
   if (!CCState::resultsCompatible(CalleeCC, CallerCC, MF, C, Ins,
-                                  RetCC_Z80_C, RetCC_Z80_C))
+                                  getRetCCAssignFn(CalleeCC),
+                                  getRetCCAssignFn(CallerCC)))
     return false;
-  // If the callee takes no arguments then go on to check the results of the
-  // call.
-  if (!Outs.empty()) {
-    // Check if stack adjustment is needed. For now, do not do this if any
-    // argument is passed on the stack.
-    SmallVector<CCValAssign, 16> ArgLocs;
-    CCState CCInfo(CalleeCC, isVarArg, MF, ArgLocs, C);
-    CCInfo.AnalyzeCallOperands(Outs, getCCAssignFn(CalleeCC));
-    if (CCInfo.getNextStackOffset()) {
-      // Check if the arguments are already laid out in the right way as
-      // the caller's fixed stack objects.
-      MachineFrameInfo &MFI = MF.getFrameInfo();
-      const MachineRegisterInfo *MRI = &MF.getRegInfo();
-      const TargetInstrInfo *TII = Subtarget.getInstrInfo();
-      for (unsigned i = 0, e = ArgLocs.size(); i != e; ++i) {
-        CCValAssign &VA = ArgLocs[i];
-        SDValue Arg = OutVals[i];
-        ISD::ArgFlagsTy Flags = Outs[i].Flags;
-        if (VA.getLocInfo() == CCValAssign::Indirect)
-          return false;
-        if (!VA.isRegLoc() && !MatchingStackOffset(Arg, VA.getLocMemOffset(),
-                                                   Flags, MFI, MRI, TII/*, VA*/))
-          return false;
-      }
-    }
+
+  SmallVector<CCValAssign, 16> ArgLocs;
+  CCState CCInfo(CalleeCC, isVarArg, MF, ArgLocs, C);
+  CCInfo.AnalyzeCallOperands(Outs, getCCAssignFn(CalleeCC));
+  unsigned NumBytes = CCInfo.getAlignedCallFrameSize();
+  const Z80MachineFunctionInfo *FuncInfo = MF.getInfo<Z80MachineFunctionInfo>();
+  if (NumBytes > FuncInfo->getArgumentStackSize())
+    return false;
+  unsigned CalleePop =
+    isCalleePop(CalleeCC, isVarArg, RetTy, DAG.getDataLayout()) ? NumBytes : 0;
+  if (CalleePop != FuncInfo->getBytesToPopOnReturn())
+    return false;
+
+  // A byval argument would have to be copied within the area it is copied
+  // from, so it has to already be in place.
+  MachineFrameInfo &MFI = MF.getFrameInfo();
+  const MachineRegisterInfo *MRI = &MF.getRegInfo();
+  const TargetInstrInfo *TII = Subtarget.getInstrInfo();
+  for (unsigned I = 0, E = ArgLocs.size(); I != E; ++I) {
+    CCValAssign &VA = ArgLocs[I];
+    ISD::ArgFlagsTy Flags = Outs[I].Flags;
+    if (VA.getLocInfo() == CCValAssign::Indirect || Flags.isSRet())
+      return false;
+    if (Flags.isByVal() &&
+        !MatchingStackOffset(OutVals[I], VA.getLocMemOffset(), Flags, MFI, MRI,
+                             TII))
+      return false;
   }
   return true;
 }
@@ -1688,6 +1987,8 @@ SDValue Z80TargetLowering::LowerReturn(SDValue Chain,
                                        const SDLoc &DL, SelectionDAG &DAG) const {
   const TargetRegisterInfo *TRI = Subtarget.getRegisterInfo();
   MachineFunction &MF = DAG.getMachineFunction();
+  if (Z80FrameLowering::isInterrupt(MF) && !Outs.empty())
+    report_fatal_error("Interrupt handlers cannot return a value");
 
   SmallVector<CCValAssign, 16> RVLocs;
   CCState CCInfo(CallConv, IsVarArg, MF, RVLocs, *DAG.getContext());
@@ -1771,22 +2072,42 @@ SDValue Z80TargetLowering::LowerFormalArguments(
     SelectionDAG &DAG, SmallVectorImpl<SDValue> &InVals) const {
   MachineFunction &MF = DAG.getMachineFunction();
   MachineFrameInfo &MFI = MF.getFrameInfo();
-  bool Is24Bit = Subtarget.is24Bit();
 
-  assert(CallConv == CallingConv::C && "Unsupported calling convention");
+  assert((CallConv == CallingConv::C || CallConv == CallingConv::Fast ||
+          CallConv == CallingConv::X86_StdCall) &&
+         "Unsupported calling convention");
   assert(!IsVarArg && "Var args not supported yet");
+  if (Z80FrameLowering::isInterrupt(MF) && !Ins.empty())
+    report_fatal_error("Interrupt handlers cannot have arguments");
 
   // Assign locations to all of the incoming arguments.
   SmallVector<CCValAssign, 16> ArgLocs;
   CCState CCInfo(CallConv, IsVarArg, MF, ArgLocs, *DAG.getContext());
-  CCInfo.AnalyzeFormalArguments(Ins, Is24Bit ? CC_EZ80_C : CC_Z80_C);
+  CCInfo.AnalyzeFormalArguments(Ins, getCCAssignFn(CallConv));
+  Z80MachineFunctionInfo *FuncInfo = MF.getInfo<Z80MachineFunctionInfo>();
+  FuncInfo->setArgumentStackSize(CCInfo.getNextStackOffset());
+  if (isCalleePop(CallConv, IsVarArg, MF.getFunction()->getReturnType(),
+                  DAG.getDataLayout()))
+    FuncInfo->setBytesToPopOnReturn(CCInfo.getNextStackOffset());
 
   SDValue ArgValue;
   assert(Ins.size() == ArgLocs.size());
   for (unsigned I = 0, E = ArgLocs.size(); I != E; ++I) {
     const ISD::InputArg &IA = Ins[I];
     CCValAssign &VA = ArgLocs[I];
-    assert(VA.isMemLoc() && "Don't support register passed arguments yet");
+    if (VA.isRegLoc()) {
+      const TargetRegisterClass *RC;
+      switch (VA.getLocVT().getSimpleVT().SimpleTy) {
+      default: llvm_unreachable("Unexpected register argument type");
+      case MVT::i8:  RC = &Z80::R8RegClass;  break;
+      case MVT::i16: RC = &Z80::R16RegClass; break;
+      case MVT::i24: RC = &Z80::R24RegClass; break;
+      }
+      unsigned Reg = MF.addLiveIn(VA.getLocReg(), RC);
+      InVals.push_back(DAG.getCopyFromReg(Chain, DL, Reg, VA.getLocVT()));
+      continue;
+    }
+    assert(VA.isMemLoc());
     int FI = MFI.CreateFixedObject(VA.getValVT().getStoreSize(),
                                    VA.getLocMemOffset(), false);
     SDValue FIN = DAG.getFrameIndex(FI, getPointerTy(DAG.getDataLayout()));
@@ -1830,6 +2151,11 @@ const char *Z80TargetLowering::getTargetNodeName(unsigned Opcode) const {
   case Z80ISD::TC_RETURN:    return "Z80ISD::TC_RETURN";
   case Z80ISD::BRCOND:       return "Z80ISD::BRCOND";
   case Z80ISD::SELECT:       return "Z80ISD::SELECT";
+  case Z80ISD::LDI:          return "Z80ISD::LDI";
+  case Z80ISD::LDD:          return "Z80ISD::LDD";
+  case Z80ISD::LDIR:         return "Z80ISD::LDIR";
+  case Z80ISD::LDDR:         return "Z80ISD::LDDR";
+  case Z80ISD::MEMMOVE:      return "Z80ISD::MEMMOVE";
   }
   return nullptr;
 }
@@ -61,7 +61,15 @@ enum NodeType : unsigned {
 
   /// SELECT - Z80 select - This selects between a true value and a false
   /// value (ops #1 and #2) based on the condition in op #0 and flag in op #3.
-  SELECT
+  SELECT,
+
+  /// Block transfers between the pointers in hl and de, glued to the copies
+  /// into hl, de, and bc.
+  LDI, LDD, LDIR, LDDR,
+
+  /// MEMMOVE - Copy bc bytes from hl to de, choosing the direction at run
+  /// time.
+  MEMMOVE
 };
 } // end Z80ISD namespace
 
@@ -92,6 +100,7 @@ public:
   SDValue LowerOperation(SDValue Op, SelectionDAG &DAG) const override;
   SDValue LowerLoad(LoadSDNode *Node, SelectionDAG &DAG) const;
   SDValue LowerStore(StoreSDNode *Node, SelectionDAG &DAG) const;
+  SDValue LowerBitwise(SDValue Op, SelectionDAG &DAG) const;
 
   /// ---------------------------------------------------------------------- ///
 
@@ -265,6 +274,8 @@ public:
                                     MachineBasicBlock *BB) const;
   MachineBasicBlock *EmitLoweredSelect(MachineInstr &MI,
                                        MachineBasicBlock *BB) const;
+  MachineBasicBlock *EmitLoweredMemmove(MachineInstr &MI,
+                                        MachineBasicBlock *BB) const;
 
   SDValue combineCopyFromReg(SDNode *N, DAGCombinerInfo &DCI) const;
   SDValue combineStore(StoreSDNode *N, DAGCombinerInfo &DCI) const;
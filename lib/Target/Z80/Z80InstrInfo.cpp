@@ -37,6 +37,30 @@ Z80InstrInfo::Z80InstrInfo(Z80Subtarget &STI)
       Subtarget(STI), RI(STI.getTargetTriple()) {
 }
 
+/// getSPAdjust - Return the stack pointer adjustment made by MI.  This counts
+/// the pushes that set up arguments within a call sequence, so a call frame
+/// setup only accounts for the part of the frame that is not pushed.
+int Z80InstrInfo::getSPAdjust(const MachineInstr &MI) const {
+  int SlotSize = Subtarget.is24Bit() ? 3 : 2;
+  switch (MI.getOpcode()) {
+  case Z80::ADJCALLSTACKDOWN16:
+  case Z80::ADJCALLSTACKDOWN24:
+    return MI.getOperand(0).getImm() - MI.getOperand(1).getImm();
+  case Z80::ADJCALLSTACKUP16:
+  case Z80::ADJCALLSTACKUP24:
+    return MI.getOperand(2).getImm() - MI.getOperand(0).getImm();
+  case Z80::PUSH16r:
+  case Z80::PUSH24r:
+  case Z80::PEA16o:
+  case Z80::PEA24o:
+    return SlotSize;
+  case Z80::POP16r:
+  case Z80::POP24r:
+    return -SlotSize;
+  }
+  return 0;
+}
+
 /// Return the inverse of the specified condition,
 /// e.g. turning COND_E to COND_NE.
 Z80::CondCode Z80::GetOppositeBranchCondition(Z80::CondCode CC) {
@@ -77,8 +101,8 @@ bool Z80InstrInfo::analyzeBranch(MachineBasicBlock &MBB,
     if (!I->isBranch())
       return true;
 
-    // Cannot handle indirect branches.
-    if (I->getOpcode() == Z80::JPr)
+    // Cannot handle indirect branches or loop branches.
+    if (I->getOpcode() == Z80::JPr || I->getOpcode() == Z80::DJNZ)
       return true;
 
     // Handle unconditional branches.
@@ -732,6 +756,16 @@ bool Z80InstrInfo::analyzeCompare(const MachineInstr &MI,
     CmpMask = ~0;
     CmpValue = 0;
     break;
+  case Z80::OR8ar:
+  case Z80::AND8ar:
+    // or a and and a compare a with zero.
+    if (MI.getOperand(0).getReg() != Z80::A)
+      return false;
+    SrcReg = Z80::A;
+    SrcReg2 = 0;
+    CmpMask = ~0;
+    CmpValue = 0;
+    break;
   }
   MachineBasicBlock::const_reverse_iterator I = MI, E = MI.getParent()->rend();
   while (++I != E && I->isFullCopy())
@@ -741,6 +775,133 @@ bool Z80InstrInfo::analyzeCompare(const MachineInstr &MI,
   return true;
 }
 
+/// getZeroTestFlags - Return true if Def sets z and s from Reg, the value it
+/// computes, just like comparing it with zero would, and set ClearsCarry if it
+/// also clears c.
+static bool getZeroTestFlags(const MachineInstr &Def, unsigned Reg,
+                             bool &ClearsCarry) {
+  switch (Def.getOpcode()) {
+  case Z80::AND8ar: case Z80::AND8ai: case Z80::AND8am: case Z80::AND8ao:
+  case Z80::XOR8ar: case Z80::XOR8ai: case Z80::XOR8am: case Z80::XOR8ao:
+  case Z80::OR8ar:  case Z80::OR8ai:  case Z80::OR8am:  case Z80::OR8ao:
+    ClearsCarry = true;
+    return Reg == Z80::A;
+  case Z80::ADD8ar: case Z80::ADD8ai: case Z80::ADD8am: case Z80::ADD8ao:
+  case Z80::ADC8ar: case Z80::ADC8ai: case Z80::ADC8am: case Z80::ADC8ao:
+  case Z80::SUB8ar: case Z80::SUB8ai: case Z80::SUB8am: case Z80::SUB8ao:
+  case Z80::SBC8ar: case Z80::SBC8ai: case Z80::SBC8am: case Z80::SBC8ao:
+    ClearsCarry = false;
+    return Reg == Z80::A;
+  case Z80::INC8r: case Z80::DEC8r:
+  case Z80::RLC8r: case Z80::RRC8r: case Z80::RL8r: case Z80::RR8r:
+  case Z80::SLA8r: case Z80::SRA8r: case Z80::SRL8r:
+    ClearsCarry = false;
+    return Def.getOperand(0).getReg() == Reg;
+  default:
+    return false;
+  }
+}
+
+/// eraseRedundantZeroTest - Erase CmpInstr, which compares SrcReg with zero,
+/// if the instruction that computed SrcReg already set the flags it tests.
+static bool eraseRedundantZeroTest(MachineInstr &CmpInstr, unsigned SrcReg,
+                                   const MachineRegisterInfo *MRI,
+                                   const TargetRegisterInfo *TRI) {
+  MachineBasicBlock &CmpMBB = *CmpInstr.getParent();
+
+  // Find the instruction that computed the value being tested.  A result in a
+  // is copied out of it, so look for the last def of a before the copy.
+  MachineInstr *Def = nullptr;
+  MachineBasicBlock::iterator DefEnd = CmpInstr;
+  if (TargetRegisterInfo::isVirtualRegister(SrcReg)) {
+    Def = MRI->getUniqueVRegDef(SrcReg);
+    if (Def && Def->isFullCopy() && Def->getOperand(1).getReg() == Z80::A) {
+      DefEnd = Def;
+      Def = nullptr;
+      SrcReg = Z80::A;
+    }
+  } else if (SrcReg != Z80::A)
+    return false;
+  if (!Def) {
+    MachineBasicBlock &MBB = *DefEnd->getParent();
+    for (MachineBasicBlock::iterator I = DefEnd; I != MBB.begin();)
+      if ((--I)->modifiesRegister(Z80::A, TRI)) {
+        Def = &*I;
+        break;
+      }
+  }
+  if (!Def)
+    return false;
+  bool ClearsCarry;
+  if (!getZeroTestFlags(*Def, SrcReg, ClearsCarry))
+    return false;
+
+  // Nothing may change the flags between Def and CmpInstr.  Def is either in
+  // the same block or in its only predecessor.
+  MachineBasicBlock &DefMBB = *Def->getParent();
+  auto ModifiesFlags = [&](MachineBasicBlock::iterator I,
+                           MachineBasicBlock::iterator E) {
+    for (; I != E; ++I)
+      if (I->modifiesRegister(Z80::F, TRI) || I->isCall())
+        return true;
+    return false;
+  };
+  if (&DefMBB == &CmpMBB) {
+    if (ModifiesFlags(std::next(Def->getIterator()), CmpInstr))
+      return false;
+  } else if (CmpMBB.pred_size() != 1 || *CmpMBB.pred_begin() != &DefMBB ||
+             ModifiesFlags(std::next(Def->getIterator()), DefMBB.end()) ||
+             ModifiesFlags(CmpMBB.begin(), CmpInstr))
+    return false;
+
+  // Every user of the flags must only look at the ones that Def sets in the
+  // same way as the compare.
+  MachineBasicBlock::iterator I = std::next(CmpInstr.getIterator());
+  for (MachineBasicBlock::iterator E = CmpMBB.end(); I != E; ++I) {
+    if (I->readsRegister(Z80::F, TRI)) {
+      int CC;
+      switch (I->getOpcode()) {
+      default:
+        return false;
+      case Z80::JQCC:
+        CC = I->getOperand(1).getImm();
+        break;
+      case Z80::Select8:
+      case Z80::Select16:
+      case Z80::Select24:
+        CC = I->getOperand(3).getImm();
+        break;
+      }
+      switch (CC) {
+      default:
+        return false;
+      case Z80::COND_NZ:
+      case Z80::COND_Z:
+      case Z80::COND_P:
+      case Z80::COND_M:
+        break;
+      case Z80::COND_NC:
+      case Z80::COND_C:
+        if (!ClearsCarry)
+          return false;
+        break;
+      }
+    }
+    if (I->modifiesRegister(Z80::F, TRI))
+      break;
+  }
+  if (I == CmpMBB.end())
+    for (MachineBasicBlock *Succ : CmpMBB.successors())
+      if (Succ->isLiveIn(Z80::F))
+        return false;
+
+  Def->findRegisterDefOperand(Z80::F)->setIsDead(false);
+  if (&DefMBB != &CmpMBB && !CmpMBB.isLiveIn(Z80::F))
+    CmpMBB.addLiveIn(Z80::F);
+  CmpInstr.eraseFromParent();
+  return true;
+}
+
 bool Z80InstrInfo::optimizeCompareInstr(MachineInstr &CmpInstr,
                                         unsigned SrcReg, unsigned SrcReg2,
                                         int CmpMask, int CmpValue,
@@ -748,12 +909,17 @@ bool Z80InstrInfo::optimizeCompareInstr(MachineInstr &CmpInstr,
   // Check whether we can replace SUB with CMP.
   switch (CmpInstr.getOpcode()) {
   default: return false;
+  case Z80::CP8ai:
+  case Z80::OR8ar:
+  case Z80::AND8ar:
+    break;
   case Z80::SUB8ai:
     // cp a,0 -> or a,a (a szhc have same behavior)
     // FIXME: This doesn't work if the pv flag is used.
     if (!CmpInstr.getOperand(0).getImm()) {
       CmpInstr.setDesc(get(Z80::OR8ar));
       CmpInstr.getOperand(0).ChangeToRegister(Z80::A, /*isDef=*/false);
+      eraseRedundantZeroTest(CmpInstr, SrcReg, MRI, &getRegisterInfo());
       return true;
     }
     LLVM_FALLTHROUGH;
@@ -778,57 +944,184 @@ bool Z80InstrInfo::optimizeCompareInstr(MachineInstr &CmpInstr,
   }
   }
 
-  // Get the unique definition of SrcReg.
-  MachineInstr *MI = MRI->getUniqueVRegDef(SrcReg);
-  if (!MI) return false;
+  // The remaining compares test a against zero, which sets z and s from a,
+  // and clears c and p/v.
+  return !SrcReg2 && !CmpValue &&
+         eraseRedundantZeroTest(CmpInstr, SrcReg, MRI, &getRegisterInfo());
+}
+
+namespace {
+/// The register form of an instruction, and the forms that access memory
+/// through an offset from an index register or through a pointer instead.
+struct MemoryFoldTableEntry {
+  uint16_t RegOp, OffOp, PtrOp;
+};
+} // end anonymous namespace
 
-  // CmpInstr is the first instruction of the BB.
-  MachineBasicBlock::iterator I = CmpInstr, Def = MI;
+/// Operations on a that take their other operand from a register.
+static const MemoryFoldTableEntry MemoryFoldTableALU[] = {
+  { Z80::ADD8ar, Z80::ADD8ao, Z80::ADD8am },
+  { Z80::ADC8ar, Z80::ADC8ao, Z80::ADC8am },
+  { Z80::SUB8ar, Z80::SUB8ao, Z80::SUB8am },
+  { Z80::SBC8ar, Z80::SBC8ao, Z80::SBC8am },
+  { Z80::AND8ar, Z80::AND8ao, Z80::AND8am },
+  { Z80::XOR8ar, Z80::XOR8ao, Z80::XOR8am },
+  { Z80::OR8ar,  Z80::OR8ao,  Z80::OR8am  },
+  { Z80::CP8ar,  Z80::CP8ao,  Z80::CP8am  },
+  { Z80::TST8ar, Z80::TST8ao, Z80::TST8am },
+};
 
-  // If we are comparing against zero, check whether we can use MI to update F.
-  // If MI is not in the same BB as CmpInstr, do not optimize.
-  bool IsCmpZero = (SrcReg2 == 0 && CmpValue == 0);
-  if (IsCmpZero && MI->getParent() != CmpInstr.getParent())
-    return false;
+/// Operations that modify a register in place.
+static const MemoryFoldTableEntry MemoryFoldTableRMW[] = {
+  { Z80::RLC8r, Z80::RLC8o, Z80::RLC8m },
+  { Z80::RRC8r, Z80::RRC8o, Z80::RRC8m },
+  { Z80::RL8r,  Z80::RL8o,  Z80::RL8m  },
+  { Z80::RR8r,  Z80::RR8o,  Z80::RR8m  },
+  { Z80::SLA8r, Z80::SLA8o, Z80::SLA8m },
+  { Z80::SRA8r, Z80::SRA8o, Z80::SRA8m },
+  { Z80::SRL8r, Z80::SRL8o, Z80::SRL8m },
+  { Z80::INC8r, Z80::INC8o, Z80::INC8m },
+  { Z80::DEC8r, Z80::DEC8o, Z80::DEC8m },
+};
 
-  llvm_unreachable("Unimplemented!");
+template <size_t N>
+static const MemoryFoldTableEntry *
+lookupMemoryFold(const MemoryFoldTableEntry (&Table)[N], unsigned Opc) {
+  for (const MemoryFoldTableEntry &Entry : Table)
+    if (Entry.RegOp == Opc)
+      return &Entry;
+  return nullptr;
+}
+
+/// isRegInClass - Return true if Reg, physical or virtual, can be used as an
+/// operand of class RC.
+static bool isRegInClass(unsigned Reg, const TargetRegisterClass &RC,
+                         const MachineRegisterInfo &MRI) {
+  if (TargetRegisterInfo::isPhysicalRegister(Reg))
+    return RC.contains(Reg);
+  return RC.hasSubClassEq(MRI.getRegClass(Reg));
+}
+
+/// buildFoldedInstr - Build an instruction with opcode Opc, whose memory
+/// operand is given by AddrOps, and which keeps the implicit operands of MI.
+static MachineInstr *buildFoldedInstr(MachineFunction &MF, MachineInstr &MI,
+                                      MachineBasicBlock::iterator InsertPt,
+                                      const MCInstrDesc &MCID,
+                                      ArrayRef<MachineOperand> AddrOps) {
+  MachineInstr *NewMI = MF.CreateMachineInstr(MCID, MI.getDebugLoc(), true);
+  MachineInstrBuilder MIB(MF, NewMI);
+  for (const MachineOperand &MO : AddrOps) {
+    MIB.addOperand(MO);
+    if (MO.isReg())
+      NewMI->getOperand(NewMI->getNumOperands() - 1).setIsKill(false);
+  }
+  for (const MachineOperand &MO : MI.implicit_operands())
+    MIB.addOperand(MO);
+  InsertPt->getParent()->insert(InsertPt, NewMI);
+  return NewMI;
 }
 
+/// foldMemoryOperandImpl - Fold a spill slot into an 8-bit operation on a, into
+/// an operation that modifies a register in place when the slot holds both its
+/// input and its result, or into a copy, which becomes a plain load or store.
 MachineInstr *
 Z80InstrInfo::foldMemoryOperandImpl(MachineFunction &MF, MachineInstr &MI,
                                     ArrayRef<unsigned> Ops,
                                     MachineBasicBlock::iterator InsertPt,
                                     int FrameIndex, LiveIntervals *LIS) const {
-  return nullptr;
-  bool Is24Bit = Subtarget.is24Bit();
-  MachineBasicBlock &MBB = *InsertPt->getParent();
-  if (Ops.size() == 1 && Ops[0] == 1 && MI.isFullCopy()) {
-    unsigned DstReg = MI.getOperand(0).getReg();
-    if (TargetRegisterInfo::isPhysicalRegister(DstReg)) {
-      unsigned Opc;
-      if (Z80::R8RegClass.contains(DstReg)) {
-        Opc = Z80::LD8ro;
-      } else {
-        assert((Is24Bit ? Z80::R24RegClass : Z80::R16RegClass)
-               .contains(DstReg) && "Unexpected physical reg");
-        Opc = Is24Bit ? Z80::LD24ro : Z80::LD16ro;
-      }
-      return BuildMI(MBB, InsertPt, MI.getDebugLoc(), get(Opc), DstReg)
-        .addFrameIndex(FrameIndex).addImm(0);
-    }
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  MachineOperand AddrOps[] = { MachineOperand::CreateFI(FrameIndex),
+                               MachineOperand::CreateImm(0) };
+  unsigned Opc = MI.getOpcode();
+
+  if (MI.isFullCopy() && Ops.size() == 1) {
+    // Reloading into the destination, or spilling the source.
+    bool IsLoad = Ops[0] == 1;
+    unsigned Reg = MI.getOperand(IsLoad ? 0 : 1).getReg();
+    if (isRegInClass(Reg, Z80::R8RegClass, MRI))
+      Opc = IsLoad ? Z80::LD8ro : Z80::LD8or;
+    else if (isRegInClass(Reg, Z80::R16RegClass, MRI))
+      Opc = Subtarget.hasEZ80Ops() ? IsLoad ? Z80::LD16ro : Z80::LD16or
+                                   : IsLoad ? Z80::LD88ro : Z80::LD88or;
+    else if (Subtarget.is24Bit() && isRegInClass(Reg, Z80::R24RegClass, MRI))
+      Opc = IsLoad ? Z80::LD24ro : Z80::LD24or;
+    else
+      return nullptr;
+    MachineInstrBuilder MIB = BuildMI(*InsertPt->getParent(), InsertPt,
+                                      MI.getDebugLoc(), get(Opc));
+    if (IsLoad)
+      MIB.addReg(Reg, RegState::Define);
+    MIB.addOperand(AddrOps[0]).addOperand(AddrOps[1]);
+    if (!IsLoad)
+      MIB.addReg(Reg, getKillRegState(MI.getOperand(1).isKill()));
+    return MIB;
   }
-  dbgs() << Ops.size() << ": ";
-  for (unsigned Op : Ops)
-    dbgs() << Op << ' ';
-  MI.dump();
+
+  if (Ops.size() == 1 && Ops[0] == 0)
+    if (const MemoryFoldTableEntry *Entry =
+            lookupMemoryFold(MemoryFoldTableALU, Opc))
+      return buildFoldedInstr(MF, MI, InsertPt, get(Entry->OffOp), AddrOps);
+
+  // The result is written back to the slot that the input came from.
+  if (Ops.size() == 2 && Ops[0] == 0 && Ops[1] == 1)
+    if (const MemoryFoldTableEntry *Entry =
+            lookupMemoryFold(MemoryFoldTableRMW, Opc))
+      return buildFoldedInstr(MF, MI, InsertPt, get(Entry->OffOp), AddrOps);
+
   return nullptr;
 }
+
+/// foldMemoryOperandImpl - Fold an 8-bit load into the operation on a that
+/// uses it, keeping the address of the load.
 MachineInstr *
 Z80InstrInfo::foldMemoryOperandImpl(MachineFunction &MF, MachineInstr &MI,
                                     ArrayRef<unsigned> Ops,
                                     MachineBasicBlock::iterator InsertPt,
                                     MachineInstr &LoadMI,
                                     LiveIntervals *LIS) const {
+  if (Ops.size() != 1 || Ops[0] != 0)
+    return nullptr;
+  const MemoryFoldTableEntry *Entry =
+    lookupMemoryFold(MemoryFoldTableALU, MI.getOpcode());
+  if (!Entry)
+    return nullptr;
+  switch (LoadMI.getOpcode()) {
+  default:
+    return nullptr;
+  case Z80::LD8ro:
+    return buildFoldedInstr(MF, MI, InsertPt, get(Entry->OffOp),
+                            { LoadMI.getOperand(1), LoadMI.getOperand(2) });
+  case Z80::LD8rp:
+    return buildFoldedInstr(MF, MI, InsertPt, get(Entry->PtrOp),
+                            LoadMI.getOperand(1));
+  }
+}
+
+/// optimizeLoadInstr - Try to fold the load that defines FoldAsLoadDefReg into
+/// MI, which is only done if the load can be moved down to MI.
+MachineInstr *
+Z80InstrInfo::optimizeLoadInstr(MachineInstr &MI,
+                                const MachineRegisterInfo *MRI,
+                                unsigned &FoldAsLoadDefReg,
+                                MachineInstr *&DefMI) const {
+  DefMI = MRI->getVRegDef(FoldAsLoadDefReg);
+  bool SawStore = false;
+  if (!DefMI || !DefMI->isSafeToMove(nullptr, SawStore))
+    return nullptr;
+  SmallVector<unsigned, 1> Ops;
+  for (unsigned I = 0, E = MI.getNumOperands(); I != E; ++I) {
+    const MachineOperand &MO = MI.getOperand(I);
+    if (!MO.isReg() || MO.getReg() != FoldAsLoadDefReg)
+      continue;
+    if (MO.getSubReg() || MO.isDef())
+      return nullptr;
+    Ops.push_back(I);
+  }
+  if (Ops.empty())
+    return nullptr;
+  if (MachineInstr *FoldMI = foldMemoryOperand(MI, Ops, *DefMI)) {
+    FoldAsLoadDefReg = 0;
+    return FoldMI;
+  }
   return nullptr;
-  llvm_unreachable("Unimplemented");
 }
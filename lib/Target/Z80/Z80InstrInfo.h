@@ -66,6 +66,8 @@ public:
   ///
   const Z80RegisterInfo &getRegisterInfo() const { return RI; }
 
+  int getSPAdjust(const MachineInstr &MI) const override;
+
   // Branch analysis.
   bool isUnpredicatedTerminator(const MachineInstr &MI) const override;
   bool analyzeBranch(MachineBasicBlock &MBB, MachineBasicBlock *&TBB,
@@ -125,6 +127,10 @@ public:
                         MachineBasicBlock::iterator InsertPt,
                         MachineInstr &LoadMI,
                         LiveIntervals *LIS = nullptr) const override;
+  MachineInstr *optimizeLoadInstr(MachineInstr &MI,
+                                  const MachineRegisterInfo *MRI,
+                                  unsigned &FoldAsLoadDefReg,
+                                  MachineInstr *&DefMI) const override;
 
 private:
   /// canExchange - This returns whether the two instructions can be directly
@@ -13,6 +13,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "Z80AsmPrinter.h"
+#include "Z80Subtarget.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/MC/MCContext.h"
 #include "llvm/MC/MCInst.h"
@@ -92,6 +93,17 @@ Z80MCInstLower::LowerMachineOperand(const MachineInstr *MI,
 }
 
 void Z80MCInstLower::Lower(const MachineInstr *MI, MCInst &OutMI) const {
+  // A call to a runtime routine that has an rst vector goes through the
+  // vector, which is a third of the size.
+  if ((MI->getOpcode() == Z80::CALL16i || MI->getOpcode() == Z80::CALL24i) &&
+      MI->getOperand(0).isSymbol())
+    if (unsigned Vector = Func.getSubtarget<Z80Subtarget>().getRSTVector(
+            MI->getOperand(0).getSymbolName())) {
+      OutMI.setOpcode(Z80::RST);
+      OutMI.addOperand(MCOperand::createImm(Vector));
+      return;
+    }
+
   OutMI.setOpcode(MI->getOpcode());
 
   MCOperand MCOp;
@@ -0,0 +1,14 @@
+//===-- Z80MachineFunctionInfo.cpp - Z80 machine function info ------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Z80MachineFunctionInfo.h"
+
+using namespace llvm;
+
+void Z80MachineFunctionInfo::anchor() { }
@@ -0,0 +1,48 @@
+//===-- Z80MachineFunctionInfo.h - Z80 machine function info ----*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares Z80-specific per-machine-function information.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_LIB_TARGET_Z80_Z80MACHINEFUNCTIONINFO_H
+#define LLVM_LIB_TARGET_Z80_Z80MACHINEFUNCTIONINFO_H
+
+#include "llvm/CodeGen/MachineFunction.h"
+
+namespace llvm {
+
+/// Z80MachineFunctionInfo - This class is derived from MachineFunction and
+/// contains private Z80 target-specific information for each MachineFunction.
+class Z80MachineFunctionInfo : public MachineFunctionInfo {
+  virtual void anchor();
+
+  /// BytesToPopOnReturn - Number of bytes of arguments this function has to
+  /// pop before returning, when it uses a callee-pop convention.
+  unsigned BytesToPopOnReturn = 0;
+
+  /// ArgumentStackSize - Number of bytes of arguments this function receives
+  /// on the stack, which a sibling call can reuse for its own.
+  unsigned ArgumentStackSize = 0;
+
+public:
+  Z80MachineFunctionInfo() = default;
+
+  explicit Z80MachineFunctionInfo(MachineFunction &MF) {}
+
+  unsigned getBytesToPopOnReturn() const { return BytesToPopOnReturn; }
+  void setBytesToPopOnReturn(unsigned Bytes) { BytesToPopOnReturn = Bytes; }
+
+  unsigned getArgumentStackSize() const { return ArgumentStackSize; }
+  void setArgumentStackSize(unsigned Size) { ArgumentStackSize = Size; }
+};
+
+} // End llvm namespace
+
+#endif
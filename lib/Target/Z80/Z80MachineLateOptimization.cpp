@@ -10,10 +10,26 @@
 // This file defines a pass that optimizes machine instructions after register
 // selection.
 //
+// Peephole rewrites are described as data in Z80Peephole.def and applied by a
+// generic matcher, subject to the flags and registers being dead where the
+// rule requires.
+//
+// The flags each instruction writes and reads are known to TableGen only as
+// whole Defs and Uses of F, so the per-flag effects are described here, keyed
+// on opcode.  They drive a forward analysis of the flags with known values and
+// a backward analysis of the flags that are live, both over the whole
+// function, which are used to remove instructions that only set flags to the
+// values they already have.
+//
 //===----------------------------------------------------------------------===//
 
 #include "Z80.h"
+#include "Z80InstrInfo.h"
 #include "Z80RegisterInfo.h"
+#include "Z80Subtarget.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
 #include "llvm/CodeGen/MachineFunctionPass.h"
 #include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
@@ -23,7 +39,62 @@ using namespace llvm;
 
 #define DEBUG_TYPE "z80-ml-opt"
 
+STATISTIC(NumPeepholes, "Number of peephole rules applied");
+STATISTIC(NumRedundantFlagOps, "Number of redundant flag settings removed");
+
 namespace {
+/// KnownFlags - The flags known to be clear and known to be set.
+struct KnownFlags {
+  uint8_t Zero = 0, One = 0;
+
+  /// meet - Keep only the flags that are known the same way in Other.
+  void meet(const KnownFlags &Other) {
+    Zero &= Other.Zero;
+    One &= Other.One;
+  }
+  bool operator!=(const KnownFlags &Other) const {
+    return Zero != Other.Zero || One != Other.One;
+  }
+};
+
+/// FlagEffects - The flags an instruction leaves alone, and those it clears
+/// and sets.  Any other flag is given an unknown value.
+struct FlagEffects {
+  uint8_t Preserved, Zero, One;
+};
+
+enum {
+  MaxPeepholeOperands = 3,
+  MaxPeepholeLength = 3,
+  MaxPeepholeVars = 4,
+  MaxPeepholeDeadRegs = 2
+};
+
+/// PeepholeOperand - An explicit operand of an instruction in a peephole rule,
+/// as described in Z80Peephole.def.
+struct PeepholeOperand {
+  enum KindTy : uint8_t { End, Any, Reg, Imm, Var, Undef } Kind;
+  int64_t Value;     ///< The register, immediate, or variable number.
+  unsigned RegClass; ///< For Var, one more than the register class ID, or 0.
+};
+
+/// PeepholeInst - An instruction in a peephole rule.  Unused entries have an
+/// opcode of 0, and unused operands have a kind of End.
+struct PeepholeInst {
+  unsigned Opcode;
+  PeepholeOperand Ops[MaxPeepholeOperands];
+};
+
+/// PeepholeRule - A rule from Z80Peephole.def.
+struct PeepholeRule {
+  const char *Name;
+  enum PredicateTy : uint8_t { Always, NotOptSize, Not24Bit } Predicate;
+  uint8_t DeadFlags;
+  unsigned DeadRegs[MaxPeepholeDeadRegs];
+  PeepholeInst Match[MaxPeepholeLength];
+  PeepholeInst Replace[MaxPeepholeLength];
+};
+
 class Z80MachineLateOptimization : public MachineFunctionPass {
 public:
   Z80MachineLateOptimization() : MachineFunctionPass(ID) {}
@@ -36,23 +107,76 @@ protected:
   }
 
 private:
-  void computeKnownFlags(MachineInstr &MI, APInt &KnownZero,
-                         APInt &KnownOne) const;
+  bool matchPeepholeInst(const PeepholeInst &Inst, const MachineInstr &MI,
+                         const MachineOperand **Vars) const;
+  MachineInstr *buildPeepholeInst(MachineBasicBlock &MBB,
+                                  MachineBasicBlock::iterator InsertPt,
+                                  const DebugLoc &DL, const PeepholeInst &Inst,
+                                  const MachineOperand *const *Vars) const;
+  bool applyPeepholeRule(const PeepholeRule &Rule,
+                         MachineBasicBlock::iterator &I, uint8_t Live,
+                         const LivePhysRegs &LiveRegs) const;
+  bool applyPeepholeRules(MachineFunction &MF);
+  void computeLiveFlags(MachineFunction &MF);
+  void computeKnownFlags(MachineFunction &MF);
+  bool removeRedundantFlagOps(MachineFunction &MF);
+
+  FlagEffects getFlagEffects(const MachineInstr &MI,
+                             const KnownFlags &Known) const;
+  uint8_t getFlagsRead(const MachineInstr &MI) const;
+  uint8_t getLiveFlagsBefore(const MachineInstr &MI, uint8_t Live) const;
+  void getLiveFlagsAfter(const MachineBasicBlock &MBB,
+                         SmallVectorImpl<uint8_t> &LiveAfter) const;
+  void transferKnownFlags(const MachineInstr &MI, uint8_t Live,
+                          KnownFlags &Known) const;
 
   StringRef getPassName() const override {
     return "Z80 Machine Late Optimization";
   }
 
-  static const uint8_t Carry, Subtract, ParityOverflow, HalfCarry, Zero, Sign;
+  const TargetInstrInfo *TII;
+  const TargetRegisterInfo *TRI;
+  DenseMap<const MachineBasicBlock *, KnownFlags> KnownIn;
+  DenseMap<const MachineBasicBlock *, uint8_t> LiveOut;
+
+  static const uint8_t Carry, Subtract, ParityOverflow, HalfCarry, Zero, Sign,
+    AllFlags;
+  static const PeepholeRule PeepholeRules[];
   static char ID;
 };
 
 const uint8_t Z80MachineLateOptimization::Carry = 1 << 0;
-const uint8_t Z80MachineLateOptimization::Subtract = 1 << 0;
-const uint8_t Z80MachineLateOptimization::ParityOverflow = 1 << 0;
-const uint8_t Z80MachineLateOptimization::HalfCarry = 1 << 0;
-const uint8_t Z80MachineLateOptimization::Zero = 1 << 0;
-const uint8_t Z80MachineLateOptimization::Sign = 1 << 0;
+const uint8_t Z80MachineLateOptimization::Subtract = 1 << 1;
+const uint8_t Z80MachineLateOptimization::ParityOverflow = 1 << 2;
+const uint8_t Z80MachineLateOptimization::HalfCarry = 1 << 4;
+const uint8_t Z80MachineLateOptimization::Zero = 1 << 6;
+const uint8_t Z80MachineLateOptimization::Sign = 1 << 7;
+const uint8_t Z80MachineLateOptimization::AllFlags =
+  Carry | Subtract | ParityOverflow | HalfCarry | Zero | Sign;
+
+#define INST(X) {Z80::X},
+#define ANY , PeepholeOperand::Any, 0, 0u
+#define REG(R) , PeepholeOperand::Reg, Z80::R, 0u
+#define IMM(V) , PeepholeOperand::Imm, V, 0u
+#define VAR(N) , PeepholeOperand::Var, N, 0u
+#define VAR_IN(N, RC) , PeepholeOperand::Var, N, Z80::RC##RegClassID + 1u
+#define UNDEF(R) , PeepholeOperand::Undef, Z80::R, 0u
+#define NO_REGS
+#define DEAD(R) Z80::R,
+#define Z80_PEEPHOLE(NAME, PRED, DEAD_FLAGS, DEAD_REGS, MATCH, REPLACE) \
+  {#NAME, PeepholeRule::PRED, DEAD_FLAGS, {DEAD_REGS}, {MATCH}, {REPLACE}},
+const PeepholeRule Z80MachineLateOptimization::PeepholeRules[] = {
+#include "Z80Peephole.def"
+};
+#undef INST
+#undef ANY
+#undef REG
+#undef IMM
+#undef VAR
+#undef VAR_IN
+#undef UNDEF
+#undef NO_REGS
+#undef DEAD
 
 char Z80MachineLateOptimization::ID = 0;
 } // end anonymous namespace
@@ -64,122 +188,442 @@ FunctionPass *llvm::createZ80MachineLateOptimization() {
 bool Z80MachineLateOptimization::runOnMachineFunction(MachineFunction &MF) {
   const TargetSubtargetInfo &STI = MF.getSubtarget();
   assert(MF.getRegInfo().tracksLiveness() && "Liveness not being tracked!");
-  const TargetInstrInfo *TII = STI.getInstrInfo();
+  TII = STI.getInstrInfo();
+  TRI = STI.getRegisterInfo();
+  computeLiveFlags(MF);
+  bool Changed = applyPeepholeRules(MF);
+  if (Changed)
+    computeLiveFlags(MF);
+  computeKnownFlags(MF);
+  Changed |= removeRedundantFlagOps(MF);
+  KnownIn.clear();
+  LiveOut.clear();
+  return Changed;
+}
+
+/// matchPeepholeInst - Return true if MI is an instance of Inst, binding any
+/// variables of Inst not yet in Vars to the operands of MI.
+bool Z80MachineLateOptimization::matchPeepholeInst(
+    const PeepholeInst &Inst, const MachineInstr &MI,
+    const MachineOperand **Vars) const {
+  if (MI.getOpcode() != Inst.Opcode)
+    return false;
+  unsigned OpNo = 0;
+  for (; OpNo != MaxPeepholeOperands &&
+         Inst.Ops[OpNo].Kind != PeepholeOperand::End; ++OpNo) {
+    if (OpNo == MI.getNumExplicitOperands())
+      return false;
+    const PeepholeOperand &Op = Inst.Ops[OpNo];
+    const MachineOperand &MO = MI.getOperand(OpNo);
+    switch (Op.Kind) {
+    default:
+      llvm_unreachable("Unexpected peephole operand kind");
+    case PeepholeOperand::Any:
+      break;
+    case PeepholeOperand::Reg:
+    case PeepholeOperand::Undef:
+      if (!MO.isReg() || MO.getReg() != Op.Value)
+        return false;
+      break;
+    case PeepholeOperand::Imm:
+      if (!MO.isImm() || MO.getImm() != Op.Value)
+        return false;
+      break;
+    case PeepholeOperand::Var:
+      if (Op.RegClass && (!MO.isReg() || !TRI->getRegClass(Op.RegClass - 1)
+                                              ->contains(MO.getReg())))
+        return false;
+      if (const MachineOperand *Bound = Vars[Op.Value]) {
+        if (Bound->isReg() ? !MO.isReg() || MO.getReg() != Bound->getReg()
+                           : !MO.isIdenticalTo(*Bound))
+          return false;
+      } else
+        Vars[Op.Value] = &MO;
+      break;
+    }
+  }
+  return OpNo == MI.getNumExplicitOperands();
+}
+
+/// buildPeepholeInst - Build Inst before InsertPt, with its variables taken
+/// from Vars.
+MachineInstr *Z80MachineLateOptimization::buildPeepholeInst(
+    MachineBasicBlock &MBB, MachineBasicBlock::iterator InsertPt,
+    const DebugLoc &DL, const PeepholeInst &Inst,
+    const MachineOperand *const *Vars) const {
+  const MCInstrDesc &Desc = TII->get(Inst.Opcode);
+  MachineInstrBuilder MIB = BuildMI(MBB, InsertPt, DL, Desc);
+  for (unsigned OpNo = 0; OpNo != MaxPeepholeOperands &&
+         Inst.Ops[OpNo].Kind != PeepholeOperand::End; ++OpNo) {
+    const PeepholeOperand &Op = Inst.Ops[OpNo];
+    unsigned Flags = getDefRegState(OpNo < Desc.getNumDefs());
+    switch (Op.Kind) {
+    default:
+      llvm_unreachable("Unexpected peephole operand kind");
+    case PeepholeOperand::Reg:
+      MIB.addReg(Op.Value, Flags);
+      break;
+    case PeepholeOperand::Undef:
+      MIB.addReg(Op.Value, Flags | RegState::Undef);
+      break;
+    case PeepholeOperand::Imm:
+      MIB.addImm(Op.Value);
+      break;
+    case PeepholeOperand::Var: {
+      assert(Vars[Op.Value] && "Peephole variable is never matched");
+      const MachineOperand &MO = *Vars[Op.Value];
+      if (MO.isReg())
+        MIB.addReg(MO.getReg(), Flags);
+      else
+        MIB.addOperand(MO);
+      break;
+    }
+    }
+  }
+  return MIB;
+}
+
+/// applyPeepholeRule - Try to apply Rule to the instructions ending at I, with
+/// Live the flags and LiveRegs the registers that are live after them.  On
+/// success, I is left at the first replacement instruction, or after the
+/// replaced ones if there are none.
+bool Z80MachineLateOptimization::applyPeepholeRule(
+    const PeepholeRule &Rule, MachineBasicBlock::iterator &I, uint8_t Live,
+    const LivePhysRegs &LiveRegs) const {
+  if (Live & Rule.DeadFlags)
+    return false;
+  MachineBasicBlock &MBB = *I->getParent();
+  const MachineRegisterInfo &MRI = MBB.getParent()->getRegInfo();
+  for (unsigned Reg : Rule.DeadRegs)
+    if (Reg && !LiveRegs.available(MRI, Reg))
+      return false;
+  const MachineOperand *Vars[MaxPeepholeVars] = {};
+  unsigned Length = 0;
+  while (Length != MaxPeepholeLength && Rule.Match[Length].Opcode)
+    ++Length;
+  MachineBasicBlock::iterator First = I;
+  for (unsigned Idx = Length; Idx--; ) {
+    if (!matchPeepholeInst(Rule.Match[Idx], *First, Vars))
+      return false;
+    if (Idx) {
+      if (First == MBB.begin())
+        return false;
+      --First;
+    }
+  }
+  DEBUG(dbgs() << "Applying peephole " << Rule.Name << " to "; I->dump());
+  MachineBasicBlock::iterator End = std::next(I);
+  LivePhysRegs LiveBefore(TRI), LiveAfter(TRI);
+  for (unsigned Reg : LiveRegs) {
+    LiveBefore.addReg(Reg);
+    LiveAfter.addReg(Reg);
+  }
+  for (MachineBasicBlock::iterator J = End; J != First; )
+    LiveBefore.stepBackward(*--J);
+  DebugLoc DL = I->getDebugLoc();
+  SmallVector<MachineInstr *, MaxPeepholeLength> NewMIs;
+  for (unsigned Idx = 0; Idx != MaxPeepholeLength &&
+         Rule.Replace[Idx].Opcode; ++Idx)
+    NewMIs.push_back(buildPeepholeInst(MBB, First, DL, Rule.Replace[Idx],
+                                       Vars));
+  MBB.erase(First, End);
+  // Registers that the replacement reads before anything sets them are
+  // undefined, and those that it sets and nothing reads are dead.
+  for (MachineInstr *NewMI : NewMIs) {
+    for (MachineOperand &MO : NewMI->operands())
+      if (MO.isReg() && MO.isUse() && MO.getReg() &&
+          LiveBefore.available(MRI, MO.getReg()))
+        MO.setIsUndef();
+    for (const MachineOperand &MO : NewMI->operands())
+      if (MO.isReg() && MO.isDef())
+        LiveBefore.addReg(MO.getReg());
+  }
+  for (MachineInstr *NewMI : reverse(NewMIs)) {
+    for (MachineOperand &MO : NewMI->operands())
+      if (MO.isReg() && MO.isDef() && LiveAfter.available(MRI, MO.getReg()))
+        MO.setIsDead();
+    LiveAfter.stepBackward(*NewMI);
+  }
+  I = NewMIs.empty() ? End : MachineBasicBlock::iterator(NewMIs.front());
+  ++NumPeepholes;
+  return true;
+}
+
+/// applyPeepholeRules - Apply the rules in Z80Peephole.def.
+bool Z80MachineLateOptimization::applyPeepholeRules(MachineFunction &MF) {
   bool Changed = false;
   bool OptSize = MF.getFunction()->getAttributes()
     .hasAttribute(AttributeSet::FunctionIndex, Attribute::OptimizeForSize);
-  APInt FlagsZero(8, 0), FlagsOne(8, 0);
-  for (auto &MBB : MF) {
-    bool UnusedFlags = true;
-    for (MachineBasicBlock *Successor : MBB.successors())
-      if (Successor->isLiveIn(Z80::F))
-        UnusedFlags = false;
-    for (auto I = MBB.rbegin(), E = MBB.rend(); I != E; ++I) {
-      if (UnusedFlags)
-        switch (I->getOpcode()) {
-        case Z80::LD8ri: // ld a, 0 -> xor a, a
-          if (I->getOperand(0).getReg() == Z80::A &&
-              I->getOperand(1).getImm() == 0) {
-            I->setDesc(TII->get(Z80::XOR8ar));
-            I->RemoveOperand(1);
-            I->getOperand(0).setIsUse();
-            I->addImplicitDefUseOperands(MF);
-            for (auto &Op : I->uses())
-              Op.setIsUndef();
-            FlagsZero = HalfCarry | Subtract | Carry;
-            FlagsOne = 0;
-            DEBUG(dbgs() << '!');
-            Changed = true;
-          }
-          break;
-        case Z80::LD24ri: // ld hl, -1/0 -> set-cf \ sbc hl, hl
-          if (I->getOperand(0).getReg() == Z80::UHL) {
-            int Imm = I->getOperand(1).getImm();
-            if (Imm == 0 || Imm == -1) {
-              I->setDesc(TII->get(Z80::SBC24ar));
-              I->RemoveOperand(1);
-              I->getOperand(0).setIsUse();
-              I->addImplicitDefUseOperands(MF);
-              for (auto &Op : I->uses())
-                Op.setIsUndef();
-              MachineInstrBuilder MIB =
-                BuildMI(MBB, I.getReverse(), I->getDebugLoc(),
-                        TII->get(Imm ? Z80::SCF : Z80::OR8ar));
-              if (!Imm)
-                MIB.addReg(Z80::A);
-              I = *MIB;
-              for (auto &Op : I->uses())
-                Op.setIsUndef();
-              FlagsZero = (Imm & (Sign | HalfCarry | Carry)) | (~Imm & Zero) |
-                ParityOverflow;
-              FlagsOne = (~Imm & (Sign | HalfCarry | Carry)) | (Imm & Zero) |
-                Subtract;
-              DEBUG(dbgs() << '!');
-              Changed = true;
-            }
-          }
-          break;
-        case Z80::POP24r: // push reg \ pop hl -> rcf \ sbc hl,hl \ add hl,reg
-          if (!OptSize && I->getOperand(0).getReg() == Z80::UHL) {
-            auto P = std::next(I);
-            if (P != E && P->getOpcode() == Z80::PUSH24r &&
-                Z80::O24RegClass.contains(P->getOperand(0).getReg())) {
-              while (I->getNumOperands() != I->getNumExplicitOperands())
-                I->RemoveOperand(I->getNumExplicitOperands());
-              I->setDesc(TII->get(Z80::ADD24ao));
-              I->addOperand(MachineOperand::CreateReg(Z80::UHL,
-                                                      /*isDef*/false));
-              I->addOperand(P->getOperand(0));
-              I->addImplicitDefUseOperands(MF);
-              I->findRegisterDefOperand(Z80::F)->setIsDead();
-              while (P->getNumOperands() != P->getNumExplicitOperands())
-                P->RemoveOperand(P->getNumExplicitOperands());
-              P->setDesc(TII->get(Z80::SBC24ar));
-              P->getOperand(0).setReg(Z80::UHL);
-              P->addImplicitDefUseOperands(MF);
-              for (auto &Op : P->uses())
-                Op.setIsUndef();
-              I = *BuildMI(MBB, P.getReverse(), P->getDebugLoc(),
-                           TII->get(Z80::OR8ar)).addReg(Z80::A);
-              for (auto &Op : I->uses())
-                Op.setIsUndef();
-              FlagsZero = Sign | ParityOverflow | Subtract | Carry;
-              FlagsOne = Zero;
-              DEBUG(dbgs() << '!');
-              Changed = true;
-            }
-          }
-          break;
-        default:
-          computeKnownFlags(*I, FlagsZero, FlagsOne);
+  bool Is24Bit = MF.getSubtarget<Z80Subtarget>().is24Bit();
+  auto isEnabled = [&](const PeepholeRule &Rule) {
+    switch (Rule.Predicate) {
+    case PeepholeRule::Always:     return true;
+    case PeepholeRule::NotOptSize: return !OptSize;
+    case PeepholeRule::Not24Bit:   return !Is24Bit;
+    }
+    llvm_unreachable("Unknown peephole predicate");
+  };
+  for (MachineBasicBlock &MBB : MF) {
+    uint8_t Live = LiveOut.lookup(&MBB);
+    LivePhysRegs LiveRegs(TRI);
+    LiveRegs.addLiveOuts(MBB);
+    MachineBasicBlock::iterator I = MBB.end();
+    while (I != MBB.begin()) {
+      MachineBasicBlock::iterator End = I--;
+      for (const PeepholeRule &Rule : PeepholeRules)
+        if (isEnabled(Rule) && applyPeepholeRule(Rule, I, Live, LiveRegs)) {
+          Changed = true;
           break;
         }
-      UnusedFlags |= I->definesRegister(Z80::F);
-      if (MachineOperand *FlagsUse = I->findRegisterUseOperand(Z80::F))
-        UnusedFlags &= FlagsUse->isUndef();
-      DEBUG(dbgs() << (UnusedFlags ? "unused" : "used") << '\t'; I->dump());
+      for (MachineBasicBlock::iterator J = End; J != I; ) {
+        Live = getLiveFlagsBefore(*--J, Live);
+        LiveRegs.stepBackward(*J);
+      }
     }
-    DEBUG(dbgs() << '\n');
   }
   return Changed;
 }
 
-void Z80MachineLateOptimization::
-computeKnownFlags(MachineInstr &MI, APInt &KnownZero, APInt &KnownOne) const {
+/// getFlagEffects - Describe how MI changes the flags, given the flags that
+/// are known before it.
+FlagEffects
+Z80MachineLateOptimization::getFlagEffects(const MachineInstr &MI,
+                                           const KnownFlags &Known) const {
+  if (!MI.modifiesRegister(Z80::F, TRI))
+    return {AllFlags, 0, 0};
   switch (MI.getOpcode()) {
   default:
-    if (MI.definesRegister(Z80::F)) {
-      KnownZero = KnownOne = 0;
-      DEBUG(dbgs() << '?');
+    return {0, 0, 0};
+  case Z80::RCF:
+    return {0, HalfCarry | Subtract | Carry, 0};
+  case Z80::SCF:
+    return {Sign | Zero | ParityOverflow, HalfCarry | Subtract, Carry};
+  case Z80::CCF: {
+    // The half carry flag gets the old carry, which is then complemented.
+    FlagEffects Effects = {Sign | Zero | ParityOverflow, Subtract, 0};
+    if (Known.Zero & Carry)
+      Effects.Zero |= HalfCarry, Effects.One |= Carry;
+    if (Known.One & Carry)
+      Effects.One |= HalfCarry, Effects.Zero |= Carry;
+    return Effects;
+  }
+  case Z80::XOR8ar:
+    if (MI.getOperand(0).getReg() == Z80::A)
+      // xor a always clears a.
+      return {0, Sign | HalfCarry | Subtract | Carry, Zero | ParityOverflow};
+    LLVM_FALLTHROUGH;
+  case Z80::XOR8ai: case Z80::XOR8am: case Z80::XOR8ao:
+  case Z80::OR8ar:  case Z80::OR8ai:  case Z80::OR8am:  case Z80::OR8ao:
+    return {0, HalfCarry | Subtract | Carry, 0};
+  case Z80::AND8ar: case Z80::AND8ai: case Z80::AND8am: case Z80::AND8ao:
+  case Z80::TST8ar: case Z80::TST8ai: case Z80::TST8am: case Z80::TST8ao:
+    return {0, Subtract | Carry, HalfCarry};
+  case Z80::ADD8ar: case Z80::ADD8ai: case Z80::ADD8am: case Z80::ADD8ao:
+  case Z80::ADC8ar: case Z80::ADC8ai: case Z80::ADC8am: case Z80::ADC8ao:
+  case Z80::ADC16ar: case Z80::ADC16SP: case Z80::ADC24ar: case Z80::ADC24SP:
+    return {0, Subtract, 0};
+  case Z80::SUB8ar: case Z80::SUB8ai: case Z80::SUB8am: case Z80::SUB8ao:
+  case Z80::SBC8ar: case Z80::SBC8ai: case Z80::SBC8am: case Z80::SBC8ao:
+  case Z80::CP8ar:  case Z80::CP8ai:  case Z80::CP8am:  case Z80::CP8ao:
+  case Z80::SBC16SP: case Z80::SBC24SP:
+    return {0, 0, Subtract};
+  case Z80::SBC16ar: case Z80::SBC24ar: {
+    unsigned Reg = MI.getOperand(0).getReg();
+    if (Reg == Z80::HL || Reg == Z80::UHL) {
+      // sbc hl, hl is 0 with the carry clear and -1 with it set.
+      if (Known.Zero & Carry)
+        return {0, Sign | HalfCarry | ParityOverflow | Carry, Zero | Subtract};
+      if (Known.One & Carry)
+        return {0, Zero | ParityOverflow, Sign | HalfCarry | Subtract | Carry};
     }
-    break;
+    return {0, 0, Subtract};
+  }
+  case Z80::INC8r: case Z80::INC8o: case Z80::INC8m:
+    return {Carry, Subtract, 0};
+  case Z80::DEC8r: case Z80::DEC8o: case Z80::DEC8m:
+    return {Carry, 0, Subtract};
+  case Z80::RLC8r: case Z80::RLC8o: case Z80::RLC8m:
+  case Z80::RRC8r: case Z80::RRC8o: case Z80::RRC8m:
+  case Z80::RL8r:  case Z80::RL8o:  case Z80::RL8m:
+  case Z80::RR8r:  case Z80::RR8o:  case Z80::RR8m:
+  case Z80::SLA8r: case Z80::SLA8o: case Z80::SLA8m:
+  case Z80::SRA8r: case Z80::SRA8o: case Z80::SRA8m:
+  case Z80::SRL8r: case Z80::SRL8o: case Z80::SRL8m:
+    return {0, HalfCarry | Subtract, 0};
+  case Z80::ADD16aa: case Z80::ADD16ao: case Z80::ADD16SP:
+  case Z80::ADD24aa: case Z80::ADD24ao: case Z80::ADD24SP:
+    return {Sign | Zero | ParityOverflow, Subtract, 0};
+  }
+}
+
+/// getFlagsRead - Return the flags that MI looks at.
+uint8_t Z80MachineLateOptimization::getFlagsRead(const MachineInstr &MI) const {
+  if (!MI.readsRegister(Z80::F, TRI))
+    return 0;
+  auto getCondFlags = [](int64_t CC) -> uint8_t {
+    switch (CC) {
+    case Z80::COND_NZ: case Z80::COND_Z:  return Zero;
+    case Z80::COND_NC: case Z80::COND_C:  return Carry;
+    case Z80::COND_PO: case Z80::COND_PE: return ParityOverflow;
+    case Z80::COND_P:  case Z80::COND_M:  return Sign;
+    default: return AllFlags;
+    }
+  };
+  switch (MI.getOpcode()) {
+  default:
+    return AllFlags;
+  case Z80::JQCC: case Z80::JRCC: case Z80::JPCC:
+  case Z80::CALLCC16i: case Z80::CALLCC24i:
+    return getCondFlags(MI.getOperand(1).getImm());
+  case Z80::RETCC:
+    return getCondFlags(MI.getOperand(0).getImm());
+  case Z80::ADC8ar: case Z80::ADC8ai: case Z80::ADC8am: case Z80::ADC8ao:
+  case Z80::SBC8ar: case Z80::SBC8ai: case Z80::SBC8am: case Z80::SBC8ao:
+  case Z80::ADC16ar: case Z80::ADC16SP: case Z80::ADC24ar: case Z80::ADC24SP:
+  case Z80::SBC16ar: case Z80::SBC16SP: case Z80::SBC24ar: case Z80::SBC24SP:
+  case Z80::RL8r: case Z80::RL8o: case Z80::RL8m:
+  case Z80::RR8r: case Z80::RR8o: case Z80::RR8m:
+  case Z80::CCF:
+    return Carry;
+  }
+}
+
+/// getLiveFlagsBefore - Return the flags that are live before MI, given those
+/// that are live after it.
+uint8_t Z80MachineLateOptimization::getLiveFlagsBefore(const MachineInstr &MI,
+                                                       uint8_t Live) const {
+  return (Live & getFlagEffects(MI, KnownFlags()).Preserved) |
+    getFlagsRead(MI);
+}
+
+/// getLiveFlagsAfter - Compute the flags that are live after each instruction
+/// in MBB, in order.
+void Z80MachineLateOptimization::getLiveFlagsAfter(
+    const MachineBasicBlock &MBB, SmallVectorImpl<uint8_t> &LiveAfter) const {
+  LiveAfter.clear();
+  uint8_t Live = LiveOut.lookup(&MBB);
+  for (auto I = MBB.rbegin(), E = MBB.rend(); I != E; ++I) {
+    LiveAfter.push_back(Live);
+    Live = getLiveFlagsBefore(*I, Live);
+  }
+  std::reverse(LiveAfter.begin(), LiveAfter.end());
+}
+
+/// isFlagSetting - Return true if MI does nothing but set flags.
+static bool isFlagSetting(const MachineInstr &MI) {
+  switch (MI.getOpcode()) {
+  default:
+    return false;
   case Z80::RCF:
-    KnownZero = HalfCarry | Subtract | Carry;
-    KnownOne = 0;
-    break;
   case Z80::SCF:
-    KnownZero = HalfCarry | Subtract;
-    KnownOne = Carry;
-    break;
+    return true;
+  case Z80::OR8ar:
+  case Z80::AND8ar:
+    // or a and and a leave a alone.
+    return MI.getOperand(0).getReg() == Z80::A;
+  }
+}
+
+/// transferKnownFlags - Update Known to hold after MI, with Live the flags
+/// that are live after it.  The values that an instruction which only sets
+/// flags gives to dead flags are forgotten, so that removing it never changes
+/// what is known about a flag that is later read.
+void Z80MachineLateOptimization::transferKnownFlags(const MachineInstr &MI,
+                                                    uint8_t Live,
+                                                    KnownFlags &Known) const {
+  FlagEffects Effects = getFlagEffects(MI, Known);
+  if (isFlagSetting(MI)) {
+    Effects.Zero &= Live;
+    Effects.One &= Live;
+  }
+  Known.Zero = (Known.Zero & Effects.Preserved) | Effects.Zero;
+  Known.One = (Known.One & Effects.Preserved) | Effects.One;
+}
+
+/// computeLiveFlags - Find the flags that are live out of each block.
+void Z80MachineLateOptimization::computeLiveFlags(MachineFunction &MF) {
+  DenseMap<const MachineBasicBlock *, uint8_t> LiveIn;
+  bool Changed;
+  do {
+    Changed = false;
+    for (MachineBasicBlock *MBB : post_order(&MF)) {
+      uint8_t Live = 0;
+      for (MachineBasicBlock *Succ : MBB->successors())
+        Live |= LiveIn.lookup(Succ);
+      LiveOut[MBB] = Live;
+      for (auto I = MBB->rbegin(), E = MBB->rend(); I != E; ++I)
+        Live = getLiveFlagsBefore(*I, Live);
+      uint8_t &In = LiveIn[MBB];
+      Changed |= In != Live;
+      In = Live;
+    }
+  } while (Changed);
+}
+
+/// computeKnownFlags - Find the flags that are known on entry to each block,
+/// which are those known the same way at the end of all its predecessors.
+void Z80MachineLateOptimization::computeKnownFlags(MachineFunction &MF) {
+  ReversePostOrderTraversal<MachineFunction *> RPOT(&MF);
+  SmallVector<uint8_t, 32> LiveAfter;
+  KnownIn[&MF.front()] = KnownFlags();
+  bool Changed;
+  do {
+    Changed = false;
+    for (MachineBasicBlock *MBB : RPOT) {
+      auto In = KnownIn.find(MBB);
+      if (In == KnownIn.end())
+        continue;
+      KnownFlags Known = In->second;
+      getLiveFlagsAfter(*MBB, LiveAfter);
+      unsigned Idx = 0;
+      for (const MachineInstr &MI : *MBB)
+        transferKnownFlags(MI, LiveAfter[Idx++], Known);
+      for (MachineBasicBlock *Succ : MBB->successors()) {
+        KnownFlags SuccIn = Succ->isEHPad() ? KnownFlags() : Known;
+        auto Ins = KnownIn.insert(std::make_pair(Succ, SuccIn));
+        if (Ins.second) {
+          Changed = true;
+          continue;
+        }
+        KnownFlags Old = Ins.first->second;
+        Ins.first->second.meet(SuccIn);
+        Changed |= Ins.first->second != Old;
+      }
+    }
+  } while (Changed);
+}
+
+/// removeRedundantFlagOps - Remove the instructions that only set flags, when
+/// each flag they set to a known value already has it, and each flag they set
+/// to an unknown value is dead.
+bool Z80MachineLateOptimization::removeRedundantFlagOps(MachineFunction &MF) {
+  bool Changed = false;
+  SmallVector<uint8_t, 32> LiveAfter;
+  for (MachineBasicBlock &MBB : MF) {
+    auto In = KnownIn.find(&MBB);
+    if (In == KnownIn.end())
+      continue;
+    KnownFlags Known = In->second;
+    getLiveFlagsAfter(MBB, LiveAfter);
+    unsigned Idx = 0;
+    for (auto I = MBB.begin(), E = MBB.end(); I != E;) {
+      MachineInstr &MI = *I++;
+      uint8_t Live = LiveAfter[Idx++];
+      if (isFlagSetting(MI)) {
+        FlagEffects Effects = getFlagEffects(MI, Known);
+        uint8_t Written = AllFlags & ~Effects.Preserved;
+        uint8_t Set = Effects.Zero | Effects.One;
+        uint8_t Same = (Known.Zero & Effects.Zero) | (Known.One & Effects.One);
+        if (!(Written & Set & Live & ~Same) && !(Written & ~Set & Live)) {
+          DEBUG(dbgs() << "Removing redundant flag setting: "; MI.dump());
+          MI.eraseFromParent();
+          ++NumRedundantFlagOps;
+          Changed = true;
+          continue;
+        }
+      }
+      transferKnownFlags(MI, Live, Known);
+    }
   }
+  return Changed;
 }
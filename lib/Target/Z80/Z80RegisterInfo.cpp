@@ -15,8 +15,10 @@
 #include "Z80FrameLowering.h"
 #include "Z80Subtarget.h"
 #include "MCTargetDesc/Z80MCTargetDesc.h"
+#include "llvm/CodeGen/LivePhysRegs.h"
 #include "llvm/CodeGen/MachineFrameInfo.h"
 #include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
 #include "llvm/CodeGen/MachineRegisterInfo.h"
 #include "llvm/Target/TargetFrameLowering.h"
 using namespace llvm;
@@ -62,9 +64,14 @@ Z80RegisterInfo::getLargestLegalSuperClass(const TargetRegisterClass *RC,
 
 const MCPhysReg *
 Z80RegisterInfo::getCalleeSavedRegs(const MachineFunction *MF) const {
+  // Interrupt handlers save exactly what they clobber in their prologue.
+  if (Z80FrameLowering::isInterrupt(*MF))
+    return CSR_NoRegs_SaveList;
   switch (MF->getFunction()->getCallingConv()) {
   default: llvm_unreachable("Unsupported calling convention");
   case CallingConv::C:
+  case CallingConv::Fast:
+  case CallingConv::X86_StdCall:
     return Is24Bit ? CSR_EZ80_C_SaveList : CSR_Z80_C_SaveList;
   case CallingConv::Z80_LibCall:
     return Is24Bit ? CSR_EZ80_LC_SaveList : CSR_Z80_LC_SaveList;
@@ -77,6 +84,8 @@ Z80RegisterInfo::getCallPreservedMask(const MachineFunction &MF,
   switch (CC) {
   default: llvm_unreachable("Unsupported calling convention");
   case CallingConv::C:
+  case CallingConv::Fast:
+  case CallingConv::X86_StdCall:
     return Is24Bit ? CSR_EZ80_C_RegMask : CSR_Z80_C_RegMask;
   case CallingConv::Z80_LibCall:
   case CallingConv::Z80_LibCall_AC:
@@ -117,23 +126,120 @@ void Z80RegisterInfo::eliminateFrameIndex(MachineBasicBlock::iterator II,
   MachineInstr &MI = *II;
   MachineFunction &MF = *MI.getParent()->getParent();
   const Z80FrameLowering *TFI = getFrameLowering(MF);
+  const MachineFrameInfo &MFI = MF.getFrameInfo();
   int FrameIndex = MI.getOperand(FIOperandNum).getIndex();
-  unsigned BasePtr = getFrameRegister(MF);
   DEBUG(MF.dump(); II->dump(); dbgs() << MF.getFunction()->arg_size() << '\n');
-  assert(TFI->hasFP(MF) && "Stack slot use without fp unimplemented");
-  int Offset = MF.getFrameInfo().getObjectOffset(FrameIndex);
+  int Offset = MFI.getObjectOffset(FrameIndex);
   int SlotSize = Is24Bit ? 3 : 2;
-  // Skip saved frame pointer if used
-  if (TFI->hasFP(MF))
-    Offset += SlotSize;
+  Offset += MI.getOperand(FIOperandNum + 1).getImm();
+  if (!TFI->hasFP(MF)) {
+    // Both arguments and locals are addressed relative to the sp that was
+    // left by the prologue, which is past the return address and the locals.
+    Offset += SlotSize + MFI.getStackSize() + SPAdj;
+    eliminateFrameIndexWithoutFP(II, FIOperandNum, Offset);
+    return;
+  }
+  unsigned BasePtr = getFrameRegister(MF);
+  // Skip saved frame pointer
+  Offset += SlotSize;
   // Skip return address for arguments
   if (FrameIndex < 0)
     Offset += SlotSize;
-  Offset += MI.getOperand(FIOperandNum + 1).getImm();
   MI.getOperand(FIOperandNum).ChangeToRegister(BasePtr, false);
   MI.getOperand(FIOperandNum + 1).ChangeToImmediate(Offset);
 }
 
+/// eliminateFrameIndexWithoutFP - There is no sp-relative addressing mode, so
+/// point an index register at the stack slot, which is Offset bytes above sp,
+/// and address the slot through it instead.
+void Z80RegisterInfo::eliminateFrameIndexWithoutFP(
+    MachineBasicBlock::iterator II, unsigned FIOperandNum, int Offset) const {
+  MachineInstr &MI = *II;
+  MachineBasicBlock &MBB = *MI.getParent();
+  MachineFunction &MF = *MBB.getParent();
+  const TargetInstrInfo &TII = *MF.getSubtarget().getInstrInfo();
+  DebugLoc DL = MI.getDebugLoc();
+  unsigned IndexRegs[] = { Is24Bit ? Z80::UIX : Z80::IX,
+                           Is24Bit ? Z80::UIY : Z80::IY };
+  unsigned StackReg = Is24Bit ? Z80::SPL : Z80::SPS;
+  unsigned PushOpc = Is24Bit ? Z80::PUSH24r : Z80::PUSH16r;
+  unsigned PopOpc = Is24Bit ? Z80::POP24r : Z80::POP16r;
+  unsigned LoadOpc = Is24Bit ? Z80::LD24ri : Z80::LD16ri;
+  unsigned AddOpc = Is24Bit ? Z80::ADD24SP : Z80::ADD16SP;
+  unsigned SlotSize = Is24Bit ? 3 : 2;
+  auto SetOperands = [&](unsigned BaseReg, int Disp) {
+    MI.getOperand(FIOperandNum).ChangeToRegister(BaseReg, false);
+    MI.getOperand(FIOperandNum + 1).ChangeToImmediate(Disp);
+  };
+
+  // Reuse an index register that an earlier access in this block already
+  // pointed into the frame, as long as neither it nor sp has changed since.
+  for (auto I = II, E = MBB.begin(); I != E;) {
+    MachineInstr &Prev = *--I;
+    if (Prev.isCall() || Prev.modifiesRegister(StackReg, this) ||
+        Prev.getOpcode() == PushOpc || Prev.getOpcode() == PopOpc)
+      break;
+    if (Prev.getOpcode() != AddOpc || I == E)
+      continue;
+    unsigned BaseReg = Prev.getOperand(0).getReg();
+    MachineInstr &Load = *std::prev(I);
+    if (is_contained(IndexRegs, BaseReg) && Load.getOpcode() == LoadOpc &&
+        Load.getOperand(0).getReg() == BaseReg && Load.getOperand(1).isImm() &&
+        !MI.readsRegister(BaseReg, this) &&
+        !MI.modifiesRegister(BaseReg, this) &&
+        isInt<8>(Offset - Load.getOperand(1).getImm())) {
+      bool Clobbered = false;
+      for (auto J = std::next(I); &*J != &MI; ++J)
+        Clobbered |= J->modifiesRegister(BaseReg, this);
+      if (!Clobbered) {
+        SetOperands(BaseReg, Offset - Load.getOperand(1).getImm());
+        return;
+      }
+    }
+  }
+
+  // Otherwise, find an index register that is free across this instruction.
+  LivePhysRegs LiveRegs(this);
+  LiveRegs.addLiveOuts(MBB);
+  for (auto I = MBB.rbegin(); &*I != &MI; ++I)
+    LiveRegs.stepBackward(*I);
+  const MachineRegisterInfo &MRI = MF.getRegInfo();
+  unsigned BaseReg = 0;
+  bool Save = true;
+  for (unsigned Reg : IndexRegs)
+    if (!MI.readsRegister(Reg, this) && !MI.modifiesRegister(Reg, this)) {
+      if (LiveRegs.available(MRI, Reg)) {
+        BaseReg = Reg;
+        Save = false;
+        break;
+      }
+      if (!BaseReg)
+        BaseReg = Reg;
+    }
+  assert(BaseReg && "Instruction uses both index registers");
+
+  // Adding sp clobbers the flags, so preserve them if they are still needed.
+  bool SaveFlags =
+    MI.readsRegister(Z80::F, this) || !LiveRegs.available(MRI, Z80::F);
+  // Whatever is still pushed when sp is added has to be skipped over.
+  int Adjust = 0;
+  if (Save) {
+    BuildMI(MBB, II, DL, TII.get(PushOpc)).addReg(BaseReg);
+    Adjust += SlotSize;
+  }
+  if (SaveFlags) {
+    BuildMI(MBB, II, DL, TII.get(PushOpc)).addReg(Z80::AF, RegState::Undef);
+    Adjust += SlotSize;
+  }
+  BuildMI(MBB, II, DL, TII.get(LoadOpc), BaseReg).addImm(Offset + Adjust);
+  BuildMI(MBB, II, DL, TII.get(AddOpc), BaseReg).addReg(BaseReg);
+  if (SaveFlags)
+    BuildMI(MBB, II, DL, TII.get(PopOpc), Z80::AF);
+  if (Save)
+    BuildMI(MBB, std::next(II), DL, TII.get(PopOpc), BaseReg);
+  SetOperands(BaseReg, 0);
+}
+
 unsigned Z80RegisterInfo::getFrameRegister(const MachineFunction &MF) const {
   return getFrameLowering(MF)->hasFP(MF) ? (Is24Bit ? Z80::UIX : Z80::IX)
                                          : (Is24Bit ? Z80::SPL : Z80::SPS);
@@ -65,6 +65,10 @@ public:
 
   // Debug information queries.
   unsigned getFrameRegister(const MachineFunction &MF) const override;
+
+private:
+  void eliminateFrameIndexWithoutFP(MachineBasicBlock::iterator II,
+                                    unsigned FIOperandNum, int Offset) const;
 };
 } // End llvm namespace
 
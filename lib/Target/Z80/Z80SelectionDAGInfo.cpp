@@ -0,0 +1,129 @@
+//===-- Z80SelectionDAGInfo.cpp - Z80 SelectionDAG Info -------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the Z80SelectionDAGInfo class, which lowers memcpy,
+// memmove, and memset to the block transfer instructions.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Z80SelectionDAGInfo.h"
+#include "Z80ISelLowering.h"
+#include "Z80Subtarget.h"
+#include "llvm/CodeGen/SelectionDAG.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "z80-selectiondag-info"
+
+/// getUnrollLimit - Return the largest copy that is done with a sequence of
+/// ldi instead of ldir.  Each ldi takes 2 bytes and 16 T-states, while setting
+/// up bc and ldir takes 5 bytes and 21 T-states per byte, so unrolling is
+/// always faster but only smaller for very short copies.
+static uint64_t getUnrollLimit(SelectionDAG &DAG) {
+  return DAG.getMachineFunction().getFunction()->optForSize() ? 2 : 8;
+}
+
+/// EmitBlockCopy - Copy Count bytes from Src to Dst with ldi or ldir, or with
+/// ldd or lddr when Reverse is set, in which case Src and Dst point to the last
+/// byte of each block.
+static SDValue EmitBlockCopy(SelectionDAG &DAG, const SDLoc &DL, SDValue Chain,
+                             SDValue Dst, SDValue Src, uint64_t Count,
+                             bool Reverse) {
+  const Z80Subtarget &STI = DAG.getSubtarget<Z80Subtarget>();
+  bool Is24Bit = STI.is24Bit();
+  MVT PtrVT = Is24Bit ? MVT::i24 : MVT::i16;
+  SDValue Glue;
+  Chain = DAG.getCopyToReg(Chain, DL, Is24Bit ? Z80::UDE : Z80::DE,
+                           DAG.getZExtOrTrunc(Dst, DL, PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  Chain = DAG.getCopyToReg(Chain, DL, Is24Bit ? Z80::UHL : Z80::HL,
+                           DAG.getZExtOrTrunc(Src, DL, PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  SDVTList VTs = DAG.getVTList(MVT::Other, MVT::Glue);
+  if (Count <= getUnrollLimit(DAG)) {
+    while (Count--) {
+      Chain = DAG.getNode(Reverse ? Z80ISD::LDD : Z80ISD::LDI, DL, VTs,
+                          Chain, Glue);
+      Glue = Chain.getValue(1);
+    }
+    return Chain;
+  }
+  Chain = DAG.getCopyToReg(Chain, DL, Is24Bit ? Z80::UBC : Z80::BC,
+                           DAG.getConstant(Count, DL, PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  return DAG.getNode(Reverse ? Z80ISD::LDDR : Z80ISD::LDIR, DL, VTs,
+                     Chain, Glue);
+}
+
+/// isCountInRange - Return true if Count is a valid nonzero block transfer
+/// count, which is at most 65535 in 16-bit mode, since bc = 0 means 65536.
+static bool isCountInRange(SelectionDAG &DAG, uint64_t Count) {
+  bool Is24Bit = DAG.getSubtarget<Z80Subtarget>().is24Bit();
+  return Count && Count < (Is24Bit ? 1u << 24 : 1u << 16);
+}
+
+SDValue Z80SelectionDAGInfo::EmitTargetCodeForMemcpy(
+    SelectionDAG &DAG, const SDLoc &dl, SDValue Chain, SDValue Dst, SDValue Src,
+    SDValue Size, unsigned Align, bool isVolatile, bool AlwaysInline,
+    MachinePointerInfo DstPtrInfo, MachinePointerInfo SrcPtrInfo) const {
+  // A variable count of zero would copy the whole address space.
+  ConstantSDNode *ConstantSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstantSize || !isCountInRange(DAG, ConstantSize->getZExtValue()))
+    return SDValue();
+  return EmitBlockCopy(DAG, dl, Chain, Dst, Src, ConstantSize->getZExtValue(),
+                       /*Reverse=*/false);
+}
+
+SDValue Z80SelectionDAGInfo::EmitTargetCodeForMemmove(
+    SelectionDAG &DAG, const SDLoc &dl, SDValue Chain, SDValue Dst, SDValue Src,
+    SDValue Size, unsigned Align, bool isVolatile,
+    MachinePointerInfo DstPtrInfo, MachinePointerInfo SrcPtrInfo) const {
+  ConstantSDNode *ConstantSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstantSize || !isCountInRange(DAG, ConstantSize->getZExtValue()))
+    return SDValue();
+  // The direction of the copy depends on whether the blocks overlap, so the
+  // choice between ldir and lddr is made at run time by the Memmove pseudo.
+  const Z80Subtarget &STI = DAG.getSubtarget<Z80Subtarget>();
+  bool Is24Bit = STI.is24Bit();
+  MVT PtrVT = Is24Bit ? MVT::i24 : MVT::i16;
+  SDValue Glue;
+  Chain = DAG.getCopyToReg(Chain, dl, Is24Bit ? Z80::UDE : Z80::DE,
+                           DAG.getZExtOrTrunc(Dst, dl, PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  Chain = DAG.getCopyToReg(Chain, dl, Is24Bit ? Z80::UHL : Z80::HL,
+                           DAG.getZExtOrTrunc(Src, dl, PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  Chain = DAG.getCopyToReg(Chain, dl, Is24Bit ? Z80::UBC : Z80::BC,
+                           DAG.getConstant(ConstantSize->getZExtValue(), dl,
+                                           PtrVT), Glue);
+  Glue = Chain.getValue(1);
+  return DAG.getNode(Z80ISD::MEMMOVE, dl, DAG.getVTList(MVT::Other, MVT::Glue),
+                     Chain, Glue);
+}
+
+SDValue Z80SelectionDAGInfo::EmitTargetCodeForMemset(
+    SelectionDAG &DAG, const SDLoc &dl, SDValue Chain, SDValue Dst, SDValue Val,
+    SDValue Size, unsigned Align, bool isVolatile,
+    MachinePointerInfo DstPtrInfo) const {
+  ConstantSDNode *ConstantSize = dyn_cast<ConstantSDNode>(Size);
+  if (!ConstantSize || !isCountInRange(DAG, ConstantSize->getZExtValue()))
+    return SDValue();
+  uint64_t Count = ConstantSize->getZExtValue();
+  // Store the value to the first byte, and then copy each byte to the next,
+  // which propagates it through the rest of the block.
+  Chain = DAG.getStore(Chain, dl, DAG.getZExtOrTrunc(Val, dl, MVT::i8), Dst,
+                       DstPtrInfo, Align,
+                       isVolatile ? MachineMemOperand::MOVolatile
+                                  : MachineMemOperand::MONone);
+  if (Count == 1)
+    return Chain;
+  SDValue Next = DAG.getNode(ISD::ADD, dl, Dst.getValueType(), Dst,
+                             DAG.getConstant(1, dl, Dst.getValueType()));
+  return EmitBlockCopy(DAG, dl, Chain, Next, Dst, Count - 1,
+                       /*Reverse=*/false);
+}
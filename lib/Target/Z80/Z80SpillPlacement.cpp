@@ -0,0 +1,459 @@
+//===-- Z80SpillPlacement.cpp - Place spills in cheaper locations ---------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines a pass that moves spilled values out of their stack slots,
+// which are accessed through ix at 19 cycles per byte, into cheaper places.
+// The pass runs after register allocation and before frame lowering, and only
+// considers spill slots that are stored once and then reloaded within a single
+// block, so that the value never lives across blocks.
+//
+// Spills whose live ranges nest within a block are kept on top of the stack:
+// the store becomes a push and the last reload a pop, while any earlier
+// reloads pop and push the value back.  Nothing in between may use the stack
+// pointer, apart from balanced pushes and pops.  Without a frame pointer, the
+// frame indices are resolved relative to sp, so the offsets of any accesses
+// to the frame in between are moved up past the pushed value.
+//
+// With -z80-shadow-spill, the shadow registers, which the register allocator
+// does not model, are used first:
+//
+//   - A spilled a becomes an ex af, af' on both sides, when the flags are dead
+//     at both ends and a is reloaded only once.
+//   - A spilled pair is pushed and popped into a shadow pair between two exx,
+//     which beats the two indexed loads or stores of the plain z80.  The eZ80
+//     accesses a whole pair at an offset in a single instruction, so it only
+//     uses af'.
+//
+// This is only correct if nothing else uses the shadow registers, in
+// particular no interrupt handler, so it is opt-in.  Calls are assumed to
+// clobber them, so no value is kept in them across one.
+//
+//===----------------------------------------------------------------------===//
+
+#include "Z80.h"
+#include "Z80FrameLowering.h"
+#include "Z80InstrInfo.h"
+#include "Z80Subtarget.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineInstrBuilder.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "z80-spill-placement"
+
+STATISTIC(NumShadowSpills, "Number of spill slots moved to shadow registers");
+STATISTIC(NumStackSpills, "Number of spill slots moved to pushes and pops");
+
+static cl::opt<bool>
+    Z80ShadowSpill("z80-shadow-spill",
+                   cl::desc("Spill to the shadow registers, which must not "
+                            "be used by anything else in the program"),
+                   cl::init(false), cl::Hidden);
+
+static cl::opt<bool>
+    NoZ80StackSpill("no-z80-stack-spill",
+                    cl::desc("Avoid spilling with pushes and pops"),
+                    cl::init(false), cl::Hidden);
+
+namespace {
+/// A spill slot that is stored once and then reloaded within one block.
+struct SpillSlot {
+  int FI;
+  MachineInstr *Store;
+  SmallVector<MachineInstr *, 4> Loads;
+  // The positions of the store and of each reload in the block.
+  unsigned Begin;
+  SmallVector<unsigned, 4> LoadPos;
+  // Set once the slot has been moved somewhere else.
+  bool Placed;
+
+  unsigned getEnd() const { return LoadPos.back(); }
+};
+
+class Z80SpillPlacement : public MachineFunctionPass {
+public:
+  Z80SpillPlacement() : MachineFunctionPass(ID) {}
+
+  bool runOnMachineFunction(MachineFunction &MF) override;
+
+  MachineFunctionProperties getRequiredProperties() const override {
+    return MachineFunctionProperties()
+      .set(MachineFunctionProperties::Property::NoVRegs)
+      .set(MachineFunctionProperties::Property::TracksLiveness);
+  }
+
+  StringRef getPassName() const override { return "Z80 Spill Placement"; }
+
+private:
+  void collectSpillSlots(MachineFunction &MF);
+  bool placeInShadowRegs(MachineBasicBlock &MBB,
+                         SmallVectorImpl<SpillSlot> &Slots);
+  bool placeOnStack(MachineBasicBlock &MBB, SmallVectorImpl<SpillSlot> &Slots);
+
+  bool isLiveAt(MachineBasicBlock::iterator I, unsigned Reg) const;
+  bool canUseAF(const SpillSlot &S) const;
+  bool canUsePair(const SpillSlot &S) const;
+  bool canUseStack(const SpillSlot &S) const;
+  void buildEXX(MachineBasicBlock::iterator I) const;
+  void spillToAF(SpillSlot &S);
+  void spillToPair(SpillSlot &S, unsigned Pair);
+  void spillToStack(SpillSlot &S);
+
+  const Z80Subtarget *STI;
+  const Z80InstrInfo *TII;
+  const TargetRegisterInfo *TRI;
+  MachineFrameInfo *MFI;
+  bool Is24Bit, HasFP;
+  DenseMap<MachineBasicBlock *, SmallVector<SpillSlot, 4>> BlockSlots;
+
+  static char ID;
+};
+
+char Z80SpillPlacement::ID = 0;
+} // end anonymous namespace
+
+FunctionPass *llvm::createZ80SpillPlacement() {
+  return new Z80SpillPlacement();
+}
+
+bool Z80SpillPlacement::runOnMachineFunction(MachineFunction &MF) {
+  if (skipFunction(*MF.getFunction()) || Z80FrameLowering::isInterrupt(MF))
+    return false;
+  STI = &MF.getSubtarget<Z80Subtarget>();
+  TII = STI->getInstrInfo();
+  TRI = STI->getRegisterInfo();
+  MFI = &MF.getFrameInfo();
+  Is24Bit = STI->is24Bit();
+  HasFP = STI->getFrameLowering()->hasFP(MF);
+
+  collectSpillSlots(MF);
+  bool Changed = false;
+  for (auto &Entry : BlockSlots) {
+    if (Z80ShadowSpill.getValue())
+      Changed |= placeInShadowRegs(*Entry.first, Entry.second);
+    if (!NoZ80StackSpill.getValue())
+      Changed |= placeOnStack(*Entry.first, Entry.second);
+  }
+  BlockSlots.clear();
+  return Changed;
+}
+
+/// getSpillLoadOpcode - Return the opcode that reloads a slot spilled by Opc,
+/// or zero if Opc is not a spill.
+static unsigned getSpillLoadOpcode(unsigned Opc) {
+  switch (Opc) {
+  default:
+    return 0;
+  case Z80::LD8or:
+    return Z80::LD8ro;
+  case Z80::LD16or:
+    return Z80::LD16ro;
+  case Z80::LD88or:
+    return Z80::LD88ro;
+  case Z80::LD24or:
+    return Z80::LD24ro;
+  }
+}
+
+/// collectSpillSlots - Find the spill slots that are stored once and then only
+/// reloaded whole, all in the same block, in order of their stores.
+void Z80SpillPlacement::collectSpillSlots(MachineFunction &MF) {
+  DenseMap<int, SmallVector<MachineInstr *, 4>> Accesses;
+  for (MachineBasicBlock &MBB : MF)
+    for (MachineInstr &MI : MBB)
+      for (const MachineOperand &MO : MI.operands())
+        if (MO.isFI() && MFI->isSpillSlotObjectIndex(MO.getIndex()))
+          Accesses[MO.getIndex()].push_back(&MI);
+
+  // The accesses are found in layout order, so the store has to come first.
+  for (auto &Entry : Accesses) {
+    SmallVectorImpl<MachineInstr *> &MIs = Entry.second;
+    MachineBasicBlock *MBB = MIs.front()->getParent();
+    MachineInstr *Store = MIs.front();
+    unsigned LoadOpc = getSpillLoadOpcode(Store->getOpcode());
+    bool Valid = LoadOpc && MIs.size() > 1 &&
+                 Store->getOperand(1).getImm() == 0;
+    for (MachineInstr *MI : make_range(std::next(MIs.begin()), MIs.end()))
+      Valid &= MI->getParent() == MBB && MI->getOpcode() == LoadOpc &&
+               MI->getOperand(2).getImm() == 0;
+    if (!Valid)
+      continue;
+    SpillSlot S;
+    S.FI = Entry.first;
+    S.Store = Store;
+    S.Loads.append(std::next(MIs.begin()), MIs.end());
+    S.Begin = 0;
+    S.Placed = false;
+    unsigned Pos = 0;
+    for (MachineInstr &MI : *MBB) {
+      ++Pos;
+      if (&MI == Store)
+        S.Begin = Pos;
+      else if (is_contained(S.Loads, &MI))
+        S.LoadPos.push_back(Pos);
+    }
+    BlockSlots[MBB].push_back(S);
+  }
+  for (auto &Entry : BlockSlots)
+    std::sort(Entry.second.begin(), Entry.second.end(),
+              [](const SpillSlot &L, const SpillSlot &R) {
+                return L.Begin < R.Begin;
+              });
+}
+
+/// placeInShadowRegs - Assign the shadow registers greedily, each one to a
+/// single slot at a time, in the order the slots become live.
+bool Z80SpillPlacement::placeInShadowRegs(MachineBasicBlock &MBB,
+                                          SmallVectorImpl<SpillSlot> &Slots) {
+  // Nothing that might use the shadow registers may come between the store
+  // and the last reload.
+  SmallVector<unsigned, 8> Barriers;
+  unsigned Pos = 0;
+  for (MachineInstr &MI : MBB) {
+    ++Pos;
+    if (MI.isCall() || MI.isInlineAsm() || MI.getOpcode() == Z80::EXX ||
+        MI.getOpcode() == Z80::EXAF)
+      Barriers.push_back(Pos);
+  }
+
+  bool Changed = false;
+  unsigned AFEnd = 0;
+  unsigned PairEnd[] = {0, 0, 0};
+  const unsigned Pairs[] = {Z80::HL, Z80::DE, Z80::BC};
+  for (SpillSlot &S : Slots) {
+    if (any_of(Barriers, [&](unsigned B) {
+          return B > S.Begin && B < S.getEnd();
+        }))
+      continue;
+    if (AFEnd < S.Begin && canUseAF(S)) {
+      DEBUG(dbgs() << "Spilling fi#" << S.FI << " to a'\n");
+      AFEnd = S.getEnd();
+      spillToAF(S);
+    } else if (!STI->hasEZ80Ops() && canUsePair(S)) {
+      unsigned I = 0;
+      while (I != array_lengthof(Pairs) && PairEnd[I] >= S.Begin)
+        ++I;
+      if (I == array_lengthof(Pairs))
+        continue;
+      DEBUG(dbgs() << "Spilling fi#" << S.FI << " to "
+                   << TRI->getName(Pairs[I]) << "'\n");
+      PairEnd[I] = S.getEnd();
+      spillToPair(S, Pairs[I]);
+    } else
+      continue;
+    MFI->RemoveStackObject(S.FI);
+    S.Placed = true;
+    ++NumShadowSpills;
+    Changed = true;
+  }
+  return Changed;
+}
+
+/// placeOnStack - Keep the values of properly nested slots on the stack.  A
+/// slot can be nested inside another one as long as it is stored and last
+/// reloaded between two consecutive accesses of the outer one.
+bool Z80SpillPlacement::placeOnStack(MachineBasicBlock &MBB,
+                                     SmallVectorImpl<SpillSlot> &Slots) {
+  bool Changed = false;
+  SmallVector<SpillSlot *, 4> Active;
+  for (SpillSlot &S : Slots) {
+    if (S.Placed)
+      continue;
+    while (!Active.empty() && Active.back()->getEnd() < S.Begin)
+      Active.pop_back();
+    if (!Active.empty()) {
+      const SmallVectorImpl<unsigned> &Outer = Active.back()->LoadPos;
+      if (*std::upper_bound(Outer.begin(), Outer.end(), S.Begin) < S.getEnd())
+        continue;
+    }
+    if (!canUseStack(S))
+      continue;
+    DEBUG(dbgs() << "Spilling fi#" << S.FI << " to the stack\n");
+    spillToStack(S);
+    MFI->RemoveStackObject(S.FI);
+    S.Placed = true;
+    Active.push_back(&S);
+    ++NumStackSpills;
+    Changed = true;
+  }
+  return Changed;
+}
+
+/// isLiveAt - Return true if Reg is read at or after I before it is completely
+/// redefined, including by being live out of the block.  The exx pairs formed
+/// by this pass leave the main registers alone, so they are looked through.
+bool Z80SpillPlacement::isLiveAt(MachineBasicBlock::iterator I,
+                                 unsigned Reg) const {
+  MachineBasicBlock &MBB = *I->getParent();
+  bool Swapped = false;
+  for (auto E = MBB.end(); I != E; ++I) {
+    if (I->getOpcode() == Z80::EXX) {
+      Swapped = !Swapped;
+      continue;
+    }
+    if (Swapped || I->isDebugValue())
+      continue;
+    if (I->readsRegister(Reg, TRI))
+      return true;
+    for (const MachineOperand &MO : I->operands()) {
+      if (MO.isRegMask() && MO.clobbersPhysReg(Reg))
+        return false;
+      if (MO.isReg() && MO.isDef() && MO.getReg() &&
+          TRI->isSubRegisterEq(MO.getReg(), Reg))
+        return false;
+    }
+  }
+  for (MachineBasicBlock *Succ : MBB.successors())
+    for (MCRegAliasIterator AI(Reg, TRI, true); AI.isValid(); ++AI)
+      if (Succ->isLiveIn(*AI))
+        return true;
+  return false;
+}
+
+/// canUseAF - Return true if S can be kept in a', which is swapped in and out
+/// together with the flags, so both swaps have to leave a and f dead.
+bool Z80SpillPlacement::canUseAF(const SpillSlot &S) const {
+  if (S.Store->getOpcode() != Z80::LD8or || S.Loads.size() != 1)
+    return false;
+  MachineInstr *Load = S.Loads.front();
+  return S.Store->getOperand(2).getReg() == Z80::A &&
+         Load->getOperand(0).getReg() == Z80::A &&
+         !isLiveAt(std::next(S.Store->getIterator()), Z80::A) &&
+         !isLiveAt(std::next(S.Store->getIterator()), Z80::F) &&
+         !isLiveAt(std::next(Load->getIterator()), Z80::F);
+}
+
+/// canUsePair - Return true if S can be kept in a shadow pair.
+bool Z80SpillPlacement::canUsePair(const SpillSlot &S) const {
+  return S.Store->getOpcode() == Z80::LD88or;
+}
+
+/// canUseStack - Return true if the value of S can stay on top of the stack
+/// from its store to its last reload.
+bool Z80SpillPlacement::canUseStack(const SpillSlot &S) const {
+  unsigned Opc = S.Store->getOpcode();
+  if (Is24Bit ? Opc != Z80::LD24or : Opc != Z80::LD88or && Opc != Z80::LD16or)
+    return false;
+  unsigned PushOpc = Is24Bit ? Z80::PUSH24r : Z80::PUSH16r;
+  unsigned PopOpc = Is24Bit ? Z80::POP24r : Z80::POP16r;
+  int Depth = 0;
+  for (auto I = std::next(S.Store->getIterator()),
+            E = std::next(S.Loads.back()->getIterator()); I != E; ++I) {
+    // Each reload finds the value on top of the stack.
+    if (is_contained(S.Loads, &*I)) {
+      if (Depth)
+        return false;
+      continue;
+    }
+    if (I->getOpcode() == PushOpc) {
+      ++Depth;
+      continue;
+    }
+    if (I->getOpcode() == PopOpc) {
+      if (--Depth < 0)
+        return false;
+      continue;
+    }
+    if (I->isCall() || I->isInlineAsm() ||
+        I->readsRegister(Z80::SPS, TRI) || I->modifiesRegister(Z80::SPS, TRI) ||
+        I->readsRegister(Z80::SPL, TRI) || I->modifiesRegister(Z80::SPL, TRI))
+      return false;
+  }
+  return true;
+}
+
+/// buildEXX - Switch register banks before I.  The registers that are dead
+/// there are marked undef, so that the swap does not keep them alive.
+void Z80SpillPlacement::buildEXX(MachineBasicBlock::iterator I) const {
+  MachineBasicBlock &MBB = *I->getParent();
+  SmallVector<unsigned, 3> Dead;
+  for (unsigned Reg : {Z80::UBC, Z80::UDE, Z80::UHL})
+    if (!isLiveAt(I, Reg))
+      Dead.push_back(Reg);
+  MachineInstrBuilder MIB =
+    BuildMI(MBB, I, I->getDebugLoc(), TII->get(Z80::EXX));
+  for (MachineOperand &MO : MIB->implicit_operands())
+    if (MO.isUse() && is_contained(Dead, MO.getReg()))
+      MO.setIsUndef();
+}
+
+/// spillToAF - Replace the store and reload of S with ex af, af'.
+void Z80SpillPlacement::spillToAF(SpillSlot &S) {
+  MachineInstr *Load = S.Loads.front();
+  BuildMI(*S.Store->getParent(), S.Store, S.Store->getDebugLoc(),
+          TII->get(Z80::EXAF));
+  // The reload overwrites a, and the flags are dead after it.
+  MachineInstrBuilder MIB = BuildMI(*Load->getParent(), Load,
+                                    Load->getDebugLoc(), TII->get(Z80::EXAF));
+  for (MachineOperand &MO : MIB->implicit_operands())
+    if (MO.isUse())
+      MO.setIsUndef();
+  S.Store->eraseFromParent();
+  Load->eraseFromParent();
+}
+
+/// spillToPair - Replace the store and reloads of S with pushes and pops to and
+/// from the shadow pair Pair.
+///   store:  push src  exx  pop pair  exx
+///   reload: exx  push pair  exx  pop dst
+void Z80SpillPlacement::spillToPair(SpillSlot &S, unsigned Pair) {
+  MachineBasicBlock &MBB = *S.Store->getParent();
+  const MachineOperand &Src = S.Store->getOperand(2);
+  DebugLoc DL = S.Store->getDebugLoc();
+  BuildMI(MBB, S.Store, DL, TII->get(Z80::PUSH16r))
+    .addReg(Src.getReg(), getKillRegState(Src.isKill()));
+  buildEXX(S.Store);
+  BuildMI(MBB, S.Store, DL, TII->get(Z80::POP16r), Pair);
+  BuildMI(MBB, S.Store, DL, TII->get(Z80::EXX));
+  S.Store->eraseFromParent();
+
+  for (MachineInstr *Load : S.Loads) {
+    DL = Load->getDebugLoc();
+    buildEXX(Load);
+    BuildMI(MBB, Load, DL, TII->get(Z80::PUSH16r))
+      .addReg(Pair, Load == S.Loads.back() ? RegState::Kill : 0);
+    BuildMI(MBB, Load, DL, TII->get(Z80::EXX));
+    BuildMI(MBB, Load, DL, TII->get(Z80::POP16r),
+            Load->getOperand(0).getReg());
+    Load->eraseFromParent();
+  }
+}
+
+/// spillToStack - Replace the store of S with a push and its reloads with
+/// pops, pushing the value back for every reload but the last.
+void Z80SpillPlacement::spillToStack(SpillSlot &S) {
+  unsigned PushOpc = Is24Bit ? Z80::PUSH24r : Z80::PUSH16r;
+  unsigned PopOpc = Is24Bit ? Z80::POP24r : Z80::POP16r;
+  MachineBasicBlock &MBB = *S.Store->getParent();
+  // Without a frame pointer, sp is the base of every frame access, and it is
+  // one slot lower while the value is on the stack.  The offset of a frame
+  // index is the operand that follows it.
+  if (!HasFP)
+    for (auto I = std::next(S.Store->getIterator()),
+              E = S.Loads.back()->getIterator(); I != E; ++I)
+      if (!I->isDebugValue())
+        for (unsigned Idx = 0, End = I->getNumOperands(); Idx != End; ++Idx)
+          if (I->getOperand(Idx).isFI()) {
+            MachineOperand &Offset = I->getOperand(Idx + 1);
+            Offset.setImm(Offset.getImm() + (Is24Bit ? 3 : 2));
+          }
+  const MachineOperand &Src = S.Store->getOperand(2);
+  BuildMI(MBB, S.Store, S.Store->getDebugLoc(), TII->get(PushOpc))
+    .addReg(Src.getReg(), getKillRegState(Src.isKill()));
+  S.Store->eraseFromParent();
+  for (MachineInstr *Load : S.Loads) {
+    unsigned DstReg = Load->getOperand(0).getReg();
+    BuildMI(MBB, Load, Load->getDebugLoc(), TII->get(PopOpc), DstReg);
+    if (Load != S.Loads.back())
+      BuildMI(MBB, Load, Load->getDebugLoc(), TII->get(PushOpc))
+        .addReg(DstReg);
+    Load->eraseFromParent();
+  }
+}
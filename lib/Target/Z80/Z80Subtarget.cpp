@@ -14,10 +14,19 @@
 #include "Z80Subtarget.h"
 #include "MCTargetDesc/Z80MCTargetDesc.h"
 #include "Z80FrameLowering.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/ErrorHandling.h"
 using namespace llvm;
 
 #define DEBUG_TYPE "z80-subtarget"
 
+// The vectors are set up by the runtime, so every object in a program has to
+// be compiled with the same assignment.
+static cl::list<std::string>
+    Z80RSTCalls("z80-rst-call", cl::CommaSeparated,
+                cl::desc("Call a runtime routine through an rst vector"),
+                cl::value_desc("routine=vector"));
+
 #define GET_SUBTARGETINFO_TARGET_DESC
 #define GET_SUBTARGETINFO_CTOR
 #include "Z80GenSubtargetInfo.inc"
@@ -26,9 +35,24 @@ Z80Subtarget &Z80Subtarget::initializeSubtargetDependencies(StringRef CPU,
                                                             StringRef FS) {
   ParseSubtargetFeatures(CPU, FS);
   HasIdxHalfRegs = HasUndocOps || HasEZ80Ops;
+  initializeRSTVectors();
   return *this;
 }
 
+/// initializeRSTVectors - Parse the routines that are called through rst
+/// vectors.  Vector 0 is the reset vector, so it is not available.
+void Z80Subtarget::initializeRSTVectors() {
+  for (StringRef Call : Z80RSTCalls) {
+    StringRef Routine, VectorStr;
+    std::tie(Routine, VectorStr) = Call.split('=');
+    unsigned Vector;
+    if (Routine.empty() || VectorStr.getAsInteger(0, Vector) || !Vector ||
+        Vector > 0x38 || Vector % 8)
+      report_fatal_error("Invalid rst call '" + Call + "'");
+    RSTVectors[Routine] = Vector;
+  }
+}
+
 Z80Subtarget::Z80Subtarget(const Triple &TT, const std::string &CPU,
                            const std::string &FS, const Z80TargetMachine &TM)
     : Z80GenSubtargetInfo(TT, CPU, FS), TargetTriple(TT),
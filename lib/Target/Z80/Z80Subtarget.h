@@ -17,6 +17,8 @@
 #include "Z80FrameLowering.h"
 #include "Z80ISelLowering.h"
 #include "Z80InstrInfo.h"
+#include "Z80SelectionDAGInfo.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Target/TargetSubtargetInfo.h"
 
 #define GET_SUBTARGETINFO_HEADER
@@ -47,11 +49,16 @@ class Z80Subtarget final : public Z80GenSubtargetInfo {
   /// True if target has index half registers (HasUndocOps || HasEZ80Ops).
   bool HasIdxHalfRegs;
 
+  /// The rst vectors through which runtime routines are called instead of
+  /// with call, keyed by routine name.
+  StringMap<unsigned> RSTVectors;
+
   // Ordering here is important. Z80InstrInfo initializes Z80RegisterInfo which
   // Z80TargetLowering needs.
   Z80InstrInfo InstrInfo;
   Z80TargetLowering TLInfo;
   Z80FrameLowering FrameLowering;
+  Z80SelectionDAGInfo TSInfo;
 
 public:
   /// This constructor initializes the data members to match that
@@ -69,6 +76,9 @@ public:
   const Z80RegisterInfo *getRegisterInfo() const override {
     return &getInstrInfo()->getRegisterInfo();
   }
+  const Z80SelectionDAGInfo *getSelectionDAGInfo() const override {
+    return &TSInfo;
+  }
   /// Because of the 32-bit pseudo-regclasses, we definitely want to track
   /// liveness of the more common 16/24-bit regclasses.
   bool enableSubRegLiveness() const override { return true; }
@@ -80,6 +90,7 @@ public:
 private:
   Z80Subtarget &initializeSubtargetDependencies(StringRef CPU, StringRef FS);
   void initializeEnvironment();
+  void initializeRSTVectors();
 public:
   const Triple &getTargetTriple() const { return TargetTriple; }
   /// Is this ez80 (disregarding specific ABI / programming model)
@@ -91,6 +102,12 @@ public:
   bool hasIndexHalfRegs() const { return HasIdxHalfRegs; }
   bool has24BitEZ80Ops()  const { return is24Bit() && hasEZ80Ops(); }
   bool has16BitEZ80Ops()  const { return is16Bit() && hasEZ80Ops(); }
+
+  /// getRSTVector - Return the address of the rst vector that calls Routine,
+  /// or zero if it is called normally.
+  unsigned getRSTVector(StringRef Routine) const {
+    return RSTVectors.lookup(Routine);
+  }
 };
 } // End llvm namespace
 
@@ -19,6 +19,11 @@
 #include "llvm/Support/TargetRegistry.h"
 using namespace llvm;
 
+static cl::opt<bool>
+    NoZ80IPRA("no-z80-ipra",
+              cl::desc("Avoid interprocedural register allocation on z80"),
+              cl::init(false), cl::Hidden);
+
 extern "C" void LLVMInitializeZ80Target() {
   // Register the target.
   RegisterTargetMachine<Z80TargetMachine> X(TheZ80Target);
@@ -68,6 +73,11 @@ Z80TargetMachine::Z80TargetMachine(const Target &T, const Triple &TT,
   : LLVMTargetMachine(T, computeDataLayout(TT), TT, CPU, FS, Options,
                       getEffectiveRelocModel(RM), CM, OL),
     TLOF(make_unique<TargetLoweringObjectFileELF>()) {
+  // With so few registers, every call would otherwise clobber nearly all of
+  // them, so let callers see which registers each callee actually uses, and
+  // let functions local to the module skip saving registers for their callers.
+  if (OL != CodeGenOpt::None && !NoZ80IPRA)
+    this->Options.EnableIPRA = true;
   initAsmInfo();
 }
 
@@ -119,7 +129,9 @@ public:
   bool addInstSelector() override;
   void addPreRegAlloc() override;
   bool addPreRewrite() override;
+  void addPostRegAlloc() override;
   void addPreSched2() override;
+  void addPreEmitPass() override;
 };
 } // namespace
 
@@ -136,7 +148,7 @@ bool Z80PassConfig::addInstSelector() {
 void Z80PassConfig::addPreRegAlloc() {
   TargetPassConfig::addPreRegAlloc();
   if (getOptLevel() != CodeGenOpt::None)
-    ;//addPass(createZ80CallFrameOptimization());
+    addPass(createZ80CallFrameOptimization());
 }
 
 bool Z80PassConfig::addPreRewrite() {
@@ -144,9 +156,21 @@ bool Z80PassConfig::addPreRewrite() {
   return TargetPassConfig::addPreRewrite();
 }
 
+void Z80PassConfig::addPostRegAlloc() {
+  if (getOptLevel() != CodeGenOpt::None)
+    addPass(createZ80SpillPlacement());
+}
+
 void Z80PassConfig::addPreSched2() {
   // Z80MachineLateOptimization pass must be run after ExpandPostRAPseudos
   if (getOptLevel() != CodeGenOpt::None)
     addPass(createZ80MachineLateOptimization());
   TargetPassConfig::addPreSched2();
 }
+
+void Z80PassConfig::addPreEmitPass() {
+  if (getOptLevel() != CodeGenOpt::None) {
+    addPass(createZ80ConditionalCallRet());
+    addPass(createZ80HardwareLoops());
+  }
+}
@@ -0,0 +1,63 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=z80 -no-z80-call-frame-opt < %s \
+; RUN:   | FileCheck %s --check-prefix=NOOPT
+
+declare void @g(i16, i16)
+declare i16 @r()
+
+; The arguments of consecutive calls are freed together after the last one.
+define void @two_calls(i16 %a, i16 %b) {
+; CHECK-LABEL: two_calls:
+; CHECK: call	{{_?}}g
+; CHECK-NOT: pop	{{hl|de|bc|iy}}
+; CHECK-NOT: add	{{hl|iy}}, sp
+; CHECK: push
+; CHECK: call	{{_?}}g
+; CHECK-NEXT: ld	[[R:hl|iy]], 8
+; CHECK-NEXT: add	[[R]], sp
+; CHECK-NEXT: ld	sp, [[R]]
+; NOOPT-LABEL: two_calls:
+; NOOPT: call	{{_?}}g
+; NOOPT-NEXT: pop
+; NOOPT-NEXT: pop
+; NOOPT: call	{{_?}}g
+; NOOPT-NEXT: pop
+; NOOPT-NEXT: pop
+  call void @g(i16 %a, i16 %b)
+  call void @g(i16 %b, i16 %a)
+  ret void
+}
+
+; A call without stack arguments in between does not stop the merging.
+define void @between(i16 %a) {
+; CHECK-LABEL: between:
+; CHECK: call	{{_?}}g
+; CHECK-NOT: pop	{{hl|de|bc|iy}}
+; CHECK: call	{{_?}}r
+; CHECK-NOT: pop	{{hl|de|bc|iy}}
+; CHECK: call	{{_?}}g
+; CHECK-NEXT: ld	[[R:hl|iy]], 8
+; CHECK-NEXT: add	[[R]], sp
+; CHECK-NEXT: ld	sp, [[R]]
+  call void @g(i16 %a, i16 %a)
+  %x = call i16 @r()
+  call void @g(i16 %x, i16 %a)
+  ret void
+}
+
+; The cleanup is not deferred past the end of a block.
+define void @branch(i16 %a, i1 %c) {
+; CHECK-LABEL: branch:
+; CHECK: call	{{_?}}g
+; CHECK-NEXT: pop
+; CHECK-NEXT: pop
+  call void @g(i16 %a, i16 %a)
+  br i1 %c, label %then, label %done
+
+then:
+  call void @g(i16 %a, i16 %a)
+  br label %done
+
+done:
+  ret void
+}
@@ -0,0 +1,59 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+declare void @g(i16, i16)
+declare void @h(i8*)
+declare void @k(i8)
+
+; Stack arguments are pushed from the last one down rather than stored into
+; the call frame through an index register.
+define void @push_args(i16 %a, i16 %b) {
+; CHECK-LABEL: push_args:
+; CHECK-NOT: ld	(ix
+; CHECK: push	{{hl|de|bc}}
+; CHECK-NEXT: push	{{hl|de|bc}}
+; CHECK-NEXT: call	{{_?}}g
+; EZ80-LABEL: push_args:
+; EZ80: push	{{hl|de|bc}}
+; EZ80-NEXT: push	{{hl|de|bc}}
+; EZ80-NEXT: call	{{_?}}g
+  call void @g(i16 %b, i16 %a)
+  ret void
+}
+
+; Constants are materialized in a register, since there is no push of an
+; immediate.
+define void @push_consts() {
+; CHECK-LABEL: push_consts:
+; CHECK-NOT: ld	(ix
+; CHECK: ld	{{hl|de|bc}}, {{[12]}}
+; CHECK: push	{{hl|de|bc}}
+; CHECK: push	{{hl|de|bc}}
+; CHECK-NEXT: call	{{_?}}g
+  call void @g(i16 1, i16 2)
+  ret void
+}
+
+; A byte argument takes a whole slot, whose upper byte is left undefined.
+define void @push_byte(i8 %c) {
+; CHECK-LABEL: push_byte:
+; CHECK: push	{{hl|de|bc|af}}
+; CHECK-NEXT: call	{{_?}}k
+  call void @k(i8 %c)
+  ret void
+}
+
+; On the eZ80, the address of a local is pushed with pea.
+define void @push_local() {
+; EZ80-LABEL: push_local:
+; EZ80-NOT: lea
+; EZ80: pea	ix - {{[0-9]+}}
+; EZ80-NEXT: call	{{_?}}h
+; CHECK-LABEL: push_local:
+; CHECK-NOT: pea
+; CHECK: push	{{hl|de|bc}}
+; CHECK-NEXT: call	{{_?}}h
+  %x = alloca i8
+  call void @h(i8* %x)
+  ret void
+}
@@ -0,0 +1,81 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+
+declare void @f()
+
+; The flags of the operation that computed a are tested directly.
+define void @and_zero(i8 %a, i8 %b) {
+; CHECK-LABEL: and_zero:
+; CHECK: and	a, {{.*}}
+; CHECK-NOT: or	a, a
+; CHECK-NOT: cp	a, 0
+; CHECK: j{{[pqr]}}	{{n?z}},
+  %x = and i8 %a, %b
+  %c = icmp eq i8 %x, 0
+  br i1 %c, label %t, label %e
+t:
+  call void @f()
+  br label %e
+e:
+  ret void
+}
+
+define void @dec_zero(i8 %a) {
+; CHECK-LABEL: dec_zero:
+; CHECK: dec	{{[abcdehl]}}
+; CHECK-NOT: or	a, a
+; CHECK-NOT: cp	a, 0
+; CHECK: j{{[pqr]}}	{{n?z}},
+  %x = add i8 %a, -1
+  %c = icmp ne i8 %x, 0
+  br i1 %c, label %t, label %e
+t:
+  call void @f()
+  br label %e
+e:
+  ret void
+}
+
+; A load leaves the flags alone, so the value still has to be tested.
+define void @load_zero(i8* %p) {
+; CHECK-LABEL: load_zero:
+; CHECK: ld	a, (hl)
+; CHECK-NEXT: or	a, a
+  %x = load i8, i8* %p
+  %c = icmp eq i8 %x, 0
+  br i1 %c, label %t, label %e
+t:
+  call void @f()
+  br label %e
+e:
+  ret void
+}
+
+; The call clobbers the flags between the operation and the test.
+define void @call_between(i8 %a, i8 %b) {
+; CHECK-LABEL: call_between:
+; CHECK: call	{{_?}}f
+; CHECK: or	a, a
+  %x = and i8 %a, %b
+  call void @f()
+  %c = icmp eq i8 %x, 0
+  br i1 %c, label %t, label %e
+t:
+  call void @f()
+  br label %e
+e:
+  ret void
+}
+
+; A subtract whose result is unused becomes a compare.
+define void @sub_to_cp(i8 %a, i8 %b) {
+; CHECK-LABEL: sub_to_cp:
+; CHECK: cp	a, {{.*}}
+; CHECK-NOT: sub	a,
+  %c = icmp eq i8 %a, %b
+  br i1 %c, label %t, label %e
+t:
+  call void @f()
+  br label %e
+e:
+  ret void
+}
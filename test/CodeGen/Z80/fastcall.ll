@@ -0,0 +1,75 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+
+declare void @use(i16)
+declare fastcc i16 @fast2(i16, i16)
+
+; fastcc passes words in de and bc, and bytes in a, e, and c.
+define fastcc i16 @add_fast(i16 %a, i16 %b) {
+; CHECK-LABEL: add_fast:
+; CHECK-NOT: (ix
+; CHECK: add	hl, {{bc|de}}
+; CHECK-NOT: (ix
+; CHECK: ret
+  %r = add i16 %a, %b
+  ret i16 %r
+}
+
+define fastcc i8 @sub_fast(i8 %a, i8 %b, i8 %c) {
+; CHECK-LABEL: sub_fast:
+; CHECK-NOT: (ix
+; CHECK: sub	a, e
+; CHECK-NEXT: sub	a, c
+; CHECK-NEXT: ret
+  %t = sub i8 %a, %b
+  %r = sub i8 %t, %c
+  ret i8 %r
+}
+
+define i16 @call_fast() {
+; CHECK-LABEL: call_fast:
+; CHECK-NOT: push	{{hl|de|bc}}
+; CHECK-DAG: ld	de, 1
+; CHECK-DAG: ld	bc, 2
+; CHECK: call	{{_?}}fast2
+  %r = call fastcc i16 @fast2(i16 1, i16 2)
+  ret i16 %r
+}
+
+; C functions take inreg words in hl, de, and bc.
+define i16 @add_inreg(i16 inreg %a, i16 inreg %b) {
+; CHECK-LABEL: add_inreg:
+; CHECK-NOT: (ix
+; CHECK: add	hl, de
+; CHECK-NEXT: ret
+  %r = add i16 %a, %b
+  ret i16 %r
+}
+
+; _frameset takes the frame size in hl.
+define void @frameset(i16 %a) optsize {
+; CHECK-LABEL: frameset:
+; CHECK: ld	hl, -4
+; CHECK-NEXT: call	_frameset
+  %s = alloca [4 x i8]
+  %p = getelementptr [4 x i8], [4 x i8]* %s, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  call void @use(i16 %a)
+  ret void
+}
+
+; When hl holds an argument, the frame is set up inline so that the argument
+; survives.
+define void @frameset_hl_live(i16 inreg %a) optsize {
+; CHECK-LABEL: frameset_hl_live:
+; CHECK-NOT: _frameset
+; CHECK-NOT: ld	hl,
+; CHECK: push	ix
+; CHECK-NEXT: ld	ix, 0
+; CHECK-NEXT: add	ix, sp
+; CHECK: call	{{_?}}use
+  %s = alloca [4 x i8]
+  %p = getelementptr [4 x i8], [4 x i8]* %s, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  call void @use(i16 %a)
+  ret void
+}
@@ -0,0 +1,65 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+; A byte loaded only for an operation on a is used straight from memory.
+define i8 @add_ptr(i8 %a, i8* %p) {
+; CHECK-LABEL: add_ptr:
+; CHECK: add	a, (hl)
+; CHECK-NEXT: ret
+; EZ80-LABEL: add_ptr:
+; EZ80: add	a, (hl)
+; EZ80-NEXT: ret
+  %x = load i8, i8* %p
+  %r = add i8 %a, %x
+  ret i8 %r
+}
+
+define i8 @sub_ptr(i8 %a, i8* %p) {
+; CHECK-LABEL: sub_ptr:
+; CHECK: sub	a, (hl)
+; CHECK-NEXT: ret
+  %x = load i8, i8* %p
+  %r = sub i8 %a, %x
+  ret i8 %r
+}
+
+define i8 @xor_ptr(i8 %a, i8* %p) {
+; CHECK-LABEL: xor_ptr:
+; CHECK: xor	a, (hl)
+; CHECK-NEXT: ret
+  %x = load i8, i8* %p
+  %r = xor i8 %a, %x
+  ret i8 %r
+}
+
+; Stack arguments are used from their slots.
+define i8 @and_arg(i8 %a, i8 %b) "no-frame-pointer-elim"="true" {
+; CHECK-LABEL: and_arg:
+; CHECK: ld	a, (ix + {{[0-9]+}})
+; CHECK-NEXT: and	a, (ix + {{[0-9]+}})
+; EZ80-LABEL: and_arg:
+; EZ80: ld	a, (ix + {{[0-9]+}})
+; EZ80-NEXT: and	a, (ix + {{[0-9]+}})
+  %r = and i8 %a, %b
+  ret i8 %r
+}
+
+define i8 @or_arg(i8 %a, i8 %b) "no-frame-pointer-elim"="true" {
+; CHECK-LABEL: or_arg:
+; CHECK: ld	a, (ix + {{[0-9]+}})
+; CHECK-NEXT: or	a, (ix + {{[0-9]+}})
+  %r = or i8 %a, %b
+  ret i8 %r
+}
+
+; A load that a store might clobber before the operation stays separate.
+define i8 @stored_between(i8 %a, i8* %p, i8* %q) {
+; CHECK-LABEL: stored_between:
+; CHECK: ld	{{[bcdehl]}}, (hl)
+; CHECK: ld	({{hl|de|bc|iy|ix}}
+; CHECK: add	a, {{[bcdehl]$}}
+  %x = load i8, i8* %p
+  store i8 0, i8* %q
+  %r = add i8 %a, %x
+  ret i8 %r
+}
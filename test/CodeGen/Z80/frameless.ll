@@ -0,0 +1,62 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+; Functions without calls or variable sized objects need no frame pointer.
+define i16 @leaf(i16 %a, i16 %b) {
+; CHECK-LABEL: leaf:
+; CHECK-NOT: push	ix
+; CHECK-NOT: ld	ix, 0
+; CHECK: ret
+; EZ80-LABEL: leaf:
+; EZ80-NOT: push	ix
+; EZ80: ret
+  %r = add i16 %a, %b
+  ret i16 %r
+}
+
+; A call needs the frame pointer.
+declare void @f()
+
+define void @caller() {
+; CHECK-LABEL: caller:
+; CHECK: push	ix
+; CHECK: ld	ix, 0
+; CHECK-NEXT: add	ix, sp
+; CHECK: call	{{_?}}f
+; CHECK: pop	ix
+; CHECK-NEXT: ret
+  call void @f()
+  ret void
+}
+
+; The frame is dropped through iy, which the result in hl leaves free.
+define i16 @locals(i16 %a) {
+; CHECK-LABEL: locals:
+; CHECK: pop	iy
+; CHECK-NEXT: pop	iy
+; CHECK-NEXT: ret
+  %s = alloca [4 x i8]
+  %p = getelementptr [4 x i8], [4 x i8]* %s, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  ret i16 %a
+}
+
+; The results occupy hl, de, bc, and iy, so the frame can only be dropped by
+; incrementing sp.
+define { i16, i16, i16, i16 } @iy_result(i16 %a) {
+; CHECK-LABEL: iy_result:
+; CHECK-NOT: pop	iy
+; CHECK: inc	sp
+; CHECK-NEXT: inc	sp
+; CHECK-NEXT: inc	sp
+; CHECK-NEXT: inc	sp
+; CHECK-NEXT: ret
+  %s = alloca [4 x i8]
+  %p = getelementptr [4 x i8], [4 x i8]* %s, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  %r0 = insertvalue { i16, i16, i16, i16 } undef, i16 %a, 0
+  %r1 = insertvalue { i16, i16, i16, i16 } %r0, i16 %a, 1
+  %r2 = insertvalue { i16, i16, i16, i16 } %r1, i16 %a, 2
+  %r3 = insertvalue { i16, i16, i16, i16 } %r2, i16 %a, 3
+  ret { i16, i16, i16, i16 } %r3
+}
@@ -0,0 +1,92 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=z80 -no-z80-hardware-loops < %s \
+; RUN:   | FileCheck %s --check-prefix=NOLOOPS
+
+; A loop counted down to zero by an 8-bit register becomes a djnz loop.
+define void @fill(i8* %p, i8 %n) {
+; CHECK-LABEL: fill:
+; CHECK: ld	b,
+; CHECK: [[LOOP:[.A-Za-z0-9_]+]]:
+; CHECK-NOT: dec	b
+; CHECK: djnz	[[LOOP]]
+; CHECK: ret
+; NOLOOPS-LABEL: fill:
+; NOLOOPS-NOT: djnz
+; NOLOOPS: ret
+entry:
+  br label %loop
+
+loop:
+  %i = phi i8 [ %n, %entry ], [ %dec, %loop ]
+  %ptr = phi i8* [ %p, %entry ], [ %next, %loop ]
+  store volatile i8 0, i8* %ptr
+  %next = getelementptr i8, i8* %ptr, i16 1
+  %dec = add i8 %i, -1
+  %cmp = icmp ne i8 %dec, 0
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; b is not free when bc holds a value across the loop.
+define i16 @bc_live(i8* %p, i8 %n) {
+; CHECK-LABEL: bc_live:
+; CHECK-NOT: djnz
+; CHECK: ret
+entry:
+  %bc = call i16 asm sideeffect "", "={bc}"()
+  br label %loop
+
+loop:
+  %i = phi i8 [ %n, %entry ], [ %dec, %loop ]
+  %ptr = phi i8* [ %p, %entry ], [ %next, %loop ]
+  store volatile i8 0, i8* %ptr
+  %next = getelementptr i8, i8* %ptr, i16 1
+  %dec = add i8 %i, -1
+  %cmp = icmp ne i8 %dec, 0
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  call void asm sideeffect "", "{bc}"(i16 %bc)
+  ret i16 %bc
+}
+
+; Inline asm is sized by its statements, and 24 of them might put the loop
+; branch out of range of the djnz displacement.
+define void @asm_loop(i8 %n) {
+; CHECK-LABEL: asm_loop:
+; CHECK-NOT: djnz
+; CHECK: ret
+entry:
+  br label %loop
+
+loop:
+  %i = phi i8 [ %n, %entry ], [ %dec, %loop ]
+  call void asm sideeffect "nop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop\0Anop", ""()
+  %dec = add i8 %i, -1
+  %cmp = icmp ne i8 %dec, 0
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
+
+; A short inline asm statement leaves the loop in range.
+define void @short_asm_loop(i8 %n) {
+; CHECK-LABEL: short_asm_loop:
+; CHECK: djnz
+; CHECK: ret
+entry:
+  br label %loop
+
+loop:
+  %i = phi i8 [ %n, %entry ], [ %dec, %loop ]
+  call void asm sideeffect "nop", ""()
+  %dec = add i8 %i, -1
+  %cmp = icmp ne i8 %dec, 0
+  br i1 %cmp, label %loop, label %exit
+
+exit:
+  ret void
+}
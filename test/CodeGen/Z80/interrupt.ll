@@ -0,0 +1,82 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+
+@counter = global i8 0
+@word = global i16 0
+
+; Only the flags and the registers that the handler modifies are saved.
+define void @isr() "interrupt" {
+; CHECK-LABEL: isr:
+; CHECK: push	af
+; CHECK-NOT: push
+; CHECK-NOT: exx
+; CHECK: pop	af
+; CHECK-NEXT: ei
+; CHECK-NEXT: reti
+  %v = load volatile i8, i8* @counter
+  %i = add i8 %v, 1
+  store volatile i8 %i, i8* @counter
+  ret void
+}
+
+define void @isr_word() "interrupt" {
+; CHECK-LABEL: isr_word:
+; CHECK: push	af
+; CHECK-NEXT: push	hl
+; CHECK: pop	hl
+; CHECK-NEXT: pop	af
+; CHECK-NEXT: ei
+; CHECK-NEXT: reti
+  %v = load volatile i16, i16* @word
+  %i = add i16 %v, 1
+  store volatile i16 %i, i16* @word
+  ret void
+}
+
+; A non-maskable interrupt returns with retn and leaves interrupts alone.
+define void @nmi() "interrupt"="nmi" {
+; CHECK-LABEL: nmi:
+; CHECK: push	af
+; CHECK-NOT: ei
+; CHECK: pop	af
+; CHECK-NEXT: retn
+  %v = load volatile i8, i8* @counter
+  %i = add i8 %v, 1
+  store volatile i8 %i, i8* @counter
+  ret void
+}
+
+; With the shadow registers, the main registers are swapped out instead of
+; pushed.
+define void @isr_shadow() "interrupt" "interrupt-shadow" {
+; CHECK-LABEL: isr_shadow:
+; CHECK-NOT: push
+; CHECK: ex	af, af'
+; CHECK-NEXT: exx
+; CHECK-NOT: push
+; CHECK: exx
+; CHECK-NEXT: ex	af, af'
+; CHECK-NEXT: ei
+; CHECK-NEXT: reti
+  %v = load volatile i16, i16* @word
+  %i = add i16 %v, 1
+  store volatile i16 %i, i16* @word
+  ret void
+}
+
+; A call clobbers every register that the caller does not preserve, and a
+; handler returns with reti rather than a tail call.
+declare void @f()
+
+define void @isr_call() "interrupt" {
+; CHECK-LABEL: isr_call:
+; CHECK-DAG: push	af
+; CHECK-DAG: push	bc
+; CHECK-DAG: push	de
+; CHECK-DAG: push	hl
+; CHECK-DAG: push	iy
+; CHECK: call	{{_?}}f
+; CHECK-NOT: jq
+; CHECK: reti
+  tail call void @f()
+  ret void
+}
@@ -0,0 +1,27 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=z80 -no-z80-ipra < %s | FileCheck %s --check-prefix=NOIPRA
+
+; inc only touches a and the flags, so with interprocedural register
+; allocation its caller keeps the word in a register across the call.
+define internal fastcc i8 @inc(i8 %x) noinline {
+  %r = add i8 %x, 1
+  ret i8 %r
+}
+
+define i16 @keep(i16 %a, i8 %b) {
+; CHECK-LABEL: keep:
+; CHECK-NOT: ld	(ix - {{[0-9]+}}),
+; CHECK: call	{{_?}}inc
+; CHECK-NOT: (ix - {{[0-9]+}})
+; CHECK: ret
+; NOIPRA-LABEL: keep:
+; NOIPRA: ld	(ix - {{[0-9]+}}),
+; NOIPRA: call	{{_?}}inc
+; NOIPRA: (ix - {{[0-9]+}})
+; NOIPRA: ret
+  %a2 = add i16 %a, %a
+  %c = call fastcc i8 @inc(i8 %b)
+  %z = zext i8 %c to i16
+  %r = add i16 %a2, %z
+  ret i16 %r
+}
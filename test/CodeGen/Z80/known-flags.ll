@@ -0,0 +1,70 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+
+; The carry is already clear after and, so the subtract does not clear it
+; again.
+define i16 @and_sub(i16 %a, i8 %x, i8 %y) {
+; CHECK-LABEL: and_sub:
+; CHECK: and	a, {{.*}}
+; CHECK-NOT: or	a, a
+; CHECK: sbc	hl, {{de|bc}}
+  %m = and i8 %x, %y
+  %z = zext i8 %m to i16
+  %r = sub i16 %a, %z
+  ret i16 %r
+}
+
+define i16 @xor_sub(i16 %a, i8 %x, i8 %y) {
+; CHECK-LABEL: xor_sub:
+; CHECK: xor	a, {{.*}}
+; CHECK-NOT: or	a, a
+; CHECK: sbc	hl, {{de|bc}}
+  %m = xor i8 %x, %y
+  %z = zext i8 %m to i16
+  %r = sub i16 %a, %z
+  ret i16 %r
+}
+
+; add leaves the carry unknown.
+define i16 @add_sub(i16 %a, i8 %x, i8 %y) {
+; CHECK-LABEL: add_sub:
+; CHECK: add	a, {{.*}}
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, {{de|bc}}
+  %m = add i8 %x, %y
+  %z = zext i8 %m to i16
+  %r = sub i16 %a, %z
+  ret i16 %r
+}
+
+; So does sbc, so each of two subtracts clears it.
+define i16 @sub_sub(i16 %a, i16 %b, i16 %c) {
+; CHECK-LABEL: sub_sub:
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, {{de|bc}}
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, {{de|bc}}
+  %d = sub i16 %a, %b
+  %r = sub i16 %d, %c
+  ret i16 %r
+}
+
+; The carry is known on entry to a block only if it is known at the end of
+; every predecessor.
+define i16 @join(i16 %a, i8 %x, i8 %y, i1 %c) {
+; CHECK-LABEL: join:
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, {{de|bc}}
+entry:
+  br i1 %c, label %t, label %f
+t:
+  %m1 = and i8 %x, %y
+  br label %j
+f:
+  %m2 = add i8 %x, %y
+  br label %j
+j:
+  %m = phi i8 [ %m1, %t ], [ %m2, %f ]
+  %z = zext i8 %m to i16
+  %r = sub i16 %a, %z
+  ret i16 %r
+}
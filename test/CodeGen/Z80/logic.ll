@@ -0,0 +1,108 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+; Bitwise operations on words are done a byte at a time through a.
+
+define i16 @and16(i16 %a, i16 %b) {
+; CHECK-LABEL: and16:
+; CHECK-NOT: call
+; CHECK: and	a,
+; CHECK-NOT: call
+; CHECK: and	a,
+; CHECK-NOT: call
+; CHECK: ret
+  %r = and i16 %a, %b
+  ret i16 %r
+}
+
+define i16 @or16(i16 %a, i16 %b) {
+; CHECK-LABEL: or16:
+; CHECK-NOT: call
+; CHECK: or	a,
+; CHECK-NOT: call
+; CHECK: or	a,
+; CHECK-NOT: call
+; CHECK: ret
+  %r = or i16 %a, %b
+  ret i16 %r
+}
+
+define i16 @xor16(i16 %a, i16 %b) {
+; CHECK-LABEL: xor16:
+; CHECK-NOT: call
+; CHECK: xor	a,
+; CHECK-NOT: call
+; CHECK: xor	a,
+; CHECK-NOT: call
+; CHECK: ret
+  %r = xor i16 %a, %b
+  ret i16 %r
+}
+
+; Each byte of a constant operand is used on its own.
+define i16 @and16_const(i16 %a) {
+; CHECK-LABEL: and16_const:
+; CHECK-DAG: and	a, 52
+; CHECK-DAG: and	a, 18
+; CHECK-NOT: call
+; CHECK: ret
+  %r = and i16 %a, 4660
+  ret i16 %r
+}
+
+define i16 @or16_const(i16 %a) {
+; CHECK-LABEL: or16_const:
+; CHECK-DAG: or	a, 52
+; CHECK-DAG: or	a, 18
+; CHECK-NOT: call
+; CHECK: ret
+  %r = or i16 %a, 4660
+  ret i16 %r
+}
+
+define i16 @xor16_const(i16 %a) {
+; CHECK-LABEL: xor16_const:
+; CHECK-DAG: xor	a, 120
+; CHECK-DAG: xor	a, 86
+; CHECK-NOT: call
+; CHECK: ret
+  %r = xor i16 %a, 22136
+  ret i16 %r
+}
+
+; An i32 operation is split into words, which are then done inline.
+define i32 @and32(i32 %a, i32 %b) {
+; CHECK-LABEL: and32:
+; CHECK-NOT: call
+; CHECK: ret
+  %r = and i32 %a, %b
+  ret i32 %r
+}
+
+; The upper byte of an i24 is only known here because the mask leaves it
+; unchanged.
+define i24 @and24_const(i24 %a) {
+; EZ80-LABEL: and24_const:
+; EZ80-DAG: and	a, 51
+; EZ80-DAG: and	a, 112
+; EZ80-NOT: call
+; EZ80: ret
+  %r = and i24 %a, 16740403
+  ret i24 %r
+}
+
+; Otherwise, the upper byte needs the library call.
+define i24 @and24(i24 %a, i24 %b) {
+; EZ80-LABEL: and24:
+; EZ80: call	_iand
+  %r = and i24 %a, %b
+  ret i24 %r
+}
+
+; The library call is smaller.
+define i16 @and16_minsize(i16 %a, i16 %b) minsize {
+; CHECK-LABEL: and16_minsize:
+; CHECK: call	_sand
+  %r = and i16 %a, %b
+  ret i16 %r
+}
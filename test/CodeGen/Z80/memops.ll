@@ -0,0 +1,105 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+declare void @llvm.memcpy.p0i8.p0i8.i16(i8*, i8*, i16, i32, i1)
+declare void @llvm.memmove.p0i8.p0i8.i16(i8*, i8*, i16, i32, i1)
+declare void @llvm.memset.p0i8.i16(i8*, i8, i16, i32, i1)
+
+; Short copies are unrolled into ldi.
+define void @memcpy4(i8* %dst, i8* %src) {
+; CHECK-LABEL: memcpy4:
+; CHECK-NOT: call
+; CHECK: ldi
+; CHECK-NEXT: ldi
+; CHECK-NEXT: ldi
+; CHECK-NEXT: ldi
+; CHECK-NOT: ldi
+; CHECK: ret
+; EZ80-LABEL: memcpy4:
+; EZ80-NOT: call
+; EZ80: ldi
+; EZ80-NEXT: ldi
+; EZ80-NEXT: ldi
+; EZ80-NEXT: ldi
+; EZ80: ret
+  call void @llvm.memcpy.p0i8.p0i8.i16(i8* %dst, i8* %src, i16 4, i32 1, i1 false)
+  ret void
+}
+
+; Longer copies load the count into bc for ldir.
+define void @memcpy100(i8* %dst, i8* %src) {
+; CHECK-LABEL: memcpy100:
+; CHECK-NOT: call
+; CHECK: ld	bc, 100
+; CHECK-NEXT: ldir
+; CHECK: ret
+; EZ80-LABEL: memcpy100:
+; EZ80-NOT: call
+; EZ80: ld	bc, 100
+; EZ80-NEXT: ldir
+; EZ80: ret
+  call void @llvm.memcpy.p0i8.p0i8.i16(i8* %dst, i8* %src, i16 100, i32 1, i1 false)
+  ret void
+}
+
+; When optimizing for size, only copies of up to two bytes are unrolled.
+define void @memcpy4_optsize(i8* %dst, i8* %src) optsize {
+; CHECK-LABEL: memcpy4_optsize:
+; CHECK-NOT: ldi{{$}}
+; CHECK: ld	bc, 4
+; CHECK-NEXT: ldir
+; CHECK: ret
+  call void @llvm.memcpy.p0i8.p0i8.i16(i8* %dst, i8* %src, i16 4, i32 1, i1 false)
+  ret void
+}
+
+; A variable count of zero would copy everything, so it stays a call.
+define void @memcpy_var(i8* %dst, i8* %src, i16 %n) {
+; CHECK-LABEL: memcpy_var:
+; CHECK-NOT: ldir
+; CHECK: call	{{_?}}memcpy
+  call void @llvm.memcpy.p0i8.p0i8.i16(i8* %dst, i8* %src, i16 %n, i32 1, i1 false)
+  ret void
+}
+
+; The direction of a move is picked at run time by comparing the pointers.
+define void @memmove10(i8* %dst, i8* %src) {
+; CHECK-LABEL: memmove10:
+; CHECK-NOT: call
+; CHECK: ld	bc, 10
+; CHECK: sbc	hl, de
+; CHECK-NEXT: add	hl, de
+; CHECK: ldir
+; CHECK: lddr
+; CHECK: ret
+; EZ80-LABEL: memmove10:
+; EZ80-NOT: call
+; EZ80: sbc	hl, de
+; EZ80: ldir
+; EZ80: lddr
+; EZ80: ret
+  call void @llvm.memmove.p0i8.p0i8.i16(i8* %dst, i8* %src, i16 10, i32 1, i1 false)
+  ret void
+}
+
+; A fill stores the first byte and then copies each byte to the next.
+define void @memset10(i8* %dst, i8 %c) {
+; CHECK-LABEL: memset10:
+; CHECK-NOT: call
+; CHECK: ld	bc, 9
+; CHECK-NEXT: ldir
+; CHECK: ret
+  call void @llvm.memset.p0i8.i16(i8* %dst, i8 %c, i16 10, i32 1, i1 false)
+  ret void
+}
+
+define void @memset3(i8* %dst) {
+; CHECK-LABEL: memset3:
+; CHECK-NOT: call
+; CHECK: ldi
+; CHECK-NEXT: ldi
+; CHECK-NOT: ldir
+; CHECK: ret
+  call void @llvm.memset.p0i8.i16(i8* %dst, i8 0, i16 3, i32 1, i1 false)
+  ret void
+}
@@ -0,0 +1,72 @@
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s
+
+; LoadZeroHL
+define i24 @zero24() {
+; CHECK-LABEL: zero24:
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, hl
+; CHECK-NEXT: ret
+  ret i24 0
+}
+
+; LoadAllOnesHL
+define i24 @ones24() {
+; CHECK-LABEL: ones24:
+; CHECK: scf
+; CHECK-NEXT: sbc	hl, hl
+; CHECK-NEXT: ret
+  ret i24 -1
+}
+
+; PushPopHLToDE and PushPopDEToHL
+define void @uhl_to_ude() {
+; CHECK-LABEL: uhl_to_ude:
+; CHECK-NOT: push	hl
+; CHECK: ex	de, hl
+  %v = call i24 asm sideeffect "", "={hl}"()
+  call void asm sideeffect "", "{de}"(i24 %v)
+  ret void
+}
+
+define void @uhl_to_ude_live() {
+; CHECK-LABEL: uhl_to_ude_live:
+; CHECK-NOT: ex	de, hl
+; CHECK: push	hl
+; CHECK-NEXT: pop	de
+; CHECK-NOT: ex	de, hl
+; CHECK: ret
+  %v = call i24 asm sideeffect "", "={hl}"()
+  call void asm sideeffect "", "{de},{hl}"(i24 %v, i24 %v)
+  ret void
+}
+
+define i24 @ude_to_uhl() {
+; CHECK-LABEL: ude_to_uhl:
+; CHECK-NOT: push	de
+; CHECK: ex	de, hl
+; CHECK-NEXT: ret
+  %v = call i24 asm sideeffect "", "={de}"()
+  ret i24 %v
+}
+
+; CopyToHL is faster than push and pop, but a byte larger.
+define i24 @ubc_to_uhl() {
+; CHECK-LABEL: ubc_to_uhl:
+; CHECK-NOT: push	bc
+; CHECK: or	a, a
+; CHECK-NEXT: sbc	hl, hl
+; CHECK-NEXT: add	hl, bc
+; CHECK-NEXT: ret
+  %v = call i24 asm sideeffect "", "={bc}"()
+  ret i24 %v
+}
+
+define i24 @ubc_to_uhl_optsize() optsize {
+; CHECK-LABEL: ubc_to_uhl_optsize:
+; CHECK-NOT: sbc	hl, hl
+; CHECK: push	bc
+; CHECK-NEXT: pop	hl
+; CHECK-NEXT: ret
+  %v = call i24 asm sideeffect "", "={bc}"()
+  ret i24 %v
+}
@@ -0,0 +1,64 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+; LoadZeroA
+define i8 @zero8() {
+; CHECK-LABEL: zero8:
+; CHECK: xor	a, a
+; CHECK-NEXT: ret
+; EZ80-LABEL: zero8:
+; EZ80: xor	a, a
+; EZ80-NEXT: ret
+  ret i8 0
+}
+
+; LoadZeroHL only applies to the 24-bit load.
+define i16 @zero16() {
+; CHECK-LABEL: zero16:
+; CHECK: ld	hl, 0
+; CHECK-NEXT: ret
+  ret i16 0
+}
+
+; CopyHLToDE and CopyDEToHL only apply when the source is dead afterwards.
+define void @hl_to_de() {
+; CHECK-LABEL: hl_to_de:
+; CHECK-NOT: ld	{{[de]}}, {{[hl]}}
+; CHECK: ex	de, hl
+  %v = call i16 asm sideeffect "", "={hl}"()
+  call void asm sideeffect "", "{de}"(i16 %v)
+  ret void
+}
+
+define void @hl_to_de_live() {
+; CHECK-LABEL: hl_to_de_live:
+; CHECK-NOT: ex	de, hl
+; CHECK-DAG: ld	e, l
+; CHECK-DAG: ld	d, h
+; CHECK-NOT: ex	de, hl
+; CHECK: ret
+  %v = call i16 asm sideeffect "", "={hl}"()
+  call void asm sideeffect "", "{de},{hl}"(i16 %v, i16 %v)
+  ret void
+}
+
+define void @de_to_hl() {
+; CHECK-LABEL: de_to_hl:
+; CHECK-NOT: ld	{{[hl]}}, {{[de]}}
+; CHECK: ex	de, hl
+  %v = call i16 asm sideeffect "", "={de}"()
+  call void asm sideeffect "", "{hl}"(i16 %v)
+  ret void
+}
+
+define void @de_to_hl_live() {
+; CHECK-LABEL: de_to_hl_live:
+; CHECK-NOT: ex	de, hl
+; CHECK-DAG: ld	l, e
+; CHECK-DAG: ld	h, d
+; CHECK-NOT: ex	de, hl
+; CHECK: ret
+  %v = call i16 asm sideeffect "", "={de}"()
+  call void asm sideeffect "", "{hl},{de}"(i16 %v, i16 %v)
+  ret void
+}
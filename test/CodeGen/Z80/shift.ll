@@ -0,0 +1,111 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+; Constant shifts are expanded inline when that is cheaper than the _b library
+; routines.
+
+define i16 @shl16_2(i16 %a) {
+; CHECK-LABEL: shl16_2:
+; CHECK-NOT: call
+; CHECK: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; CHECK-NEXT: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; CHECK-NOT: call
+; CHECK: ret
+  %r = shl i16 %a, 2
+  ret i16 %r
+}
+
+define i16 @shl16_9(i16 %a) {
+; CHECK-LABEL: shl16_9:
+; CHECK-NOT: call
+; CHECK: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; CHECK-NOT: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; CHECK-NOT: call
+; CHECK: ret
+  %r = shl i16 %a, 9
+  ret i16 %r
+}
+
+define i16 @lshr16_1(i16 %a) {
+; CHECK-LABEL: lshr16_1:
+; CHECK-NOT: call
+; CHECK: srl	{{[a-z]+}}
+; CHECK: rr	{{[a-z]+}}
+; CHECK-NOT: call
+; CHECK: ret
+  %r = lshr i16 %a, 1
+  ret i16 %r
+}
+
+define i16 @ashr16_2(i16 %a) {
+; CHECK-LABEL: ashr16_2:
+; CHECK-NOT: call
+; CHECK: sra	{{[a-z]+}}
+; CHECK: rr	{{[a-z]+}}
+; CHECK: sra	{{[a-z]+}}
+; CHECK: rr	{{[a-z]+}}
+; CHECK-NOT: call
+; CHECK: ret
+  %r = ashr i16 %a, 2
+  ret i16 %r
+}
+
+define i16 @ashr16_15(i16 %a) {
+; CHECK-LABEL: ashr16_15:
+; CHECK-NOT: call
+; CHECK-NOT: sla
+; CHECK: add	a, a
+; CHECK-NEXT: sbc	a, a
+; CHECK-NOT: call
+; CHECK: ret
+  %r = ashr i16 %a, 15
+  ret i16 %r
+}
+
+; When optimizing for size, long sequences lose to the library routine.
+define i16 @lshr16_7_optsize(i16 %a) optsize {
+; CHECK-LABEL: lshr16_7_optsize:
+; CHECK: call	_sshru_b
+  %r = lshr i16 %a, 7
+  ret i16 %r
+}
+
+; Variable amounts always call the library routine.
+define i16 @shl16_var(i16 %a, i16 %b) {
+; CHECK-LABEL: shl16_var:
+; CHECK: call	_sshl
+  %r = shl i16 %a, %b
+  ret i16 %r
+}
+
+define i24 @shl24_3(i24 %a) {
+; EZ80-LABEL: shl24_3:
+; EZ80-NOT: call
+; EZ80: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; EZ80-NEXT: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; EZ80-NEXT: add	{{(hl|ix|iy), (hl|ix|iy)}}
+; EZ80-NOT: call
+; EZ80: ret
+  %r = shl i24 %a, 3
+  ret i24 %r
+}
+
+; An i24 shift right is only inline when the upper byte is known to be zero.
+define i24 @lshr24_1_masked(i24 %a) {
+; EZ80-LABEL: lshr24_1_masked:
+; EZ80-NOT: call
+; EZ80: srl
+; EZ80: rr
+; EZ80-NOT: call
+; EZ80: ret
+  %m = and i24 %a, 65535
+  %r = lshr i24 %m, 1
+  ret i24 %r
+}
+
+define i24 @lshr24_1(i24 %a) {
+; EZ80-LABEL: lshr24_1:
+; EZ80: call	_ishru_b
+  %r = lshr i24 %a, 1
+  ret i24 %r
+}
@@ -0,0 +1,63 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+declare void @g0()
+declare void @g1(i16)
+declare void @g2(i16, i16)
+declare x86_stdcallcc void @s1(i16)
+
+; A callee that needs no more stack arguments than its caller received is
+; jumped to, with its arguments stored over the incoming ones.
+define void @fewer(i16 %a, i16 %b) {
+; CHECK-LABEL: fewer:
+; CHECK-NOT: call
+; CHECK: jq	{{_?}}g1
+; EZ80-LABEL: fewer:
+; EZ80-NOT: call
+; EZ80: jq	{{_?}}g1
+  tail call void @g1(i16 %b)
+  ret void
+}
+
+define void @swapped(i16 %a, i16 %b) {
+; CHECK-LABEL: swapped:
+; CHECK-NOT: call
+; CHECK: jq	{{_?}}g2
+  tail call void @g2(i16 %b, i16 %a)
+  ret void
+}
+
+define void @none(i16 %a) {
+; CHECK-LABEL: none:
+; CHECK-NOT: call
+; CHECK: jq	{{_?}}g0
+  tail call void @g0()
+  ret void
+}
+
+; A callee that needs more stack arguments is called normally.
+define void @more(i16 %a) {
+; CHECK-LABEL: more:
+; CHECK: call	{{_?}}g2
+; CHECK: ret
+  tail call void @g2(i16 %a, i16 %a)
+  ret void
+}
+
+; A stdcall callee would pop bytes that the caller's caller pops again.
+define void @mismatched_pop(i16 %a) {
+; CHECK-LABEL: mismatched_pop:
+; CHECK: call	{{_?}}s1
+; CHECK: ret
+  tail call x86_stdcallcc void @s1(i16 %a)
+  ret void
+}
+
+; Indirect tail calls jump through a register.
+define void @indirect(void (i16)* %f, i16 %a) {
+; CHECK-LABEL: indirect:
+; CHECK-NOT: call
+; CHECK: jp	({{hl|ix|iy}})
+  tail call void %f(i16 %a)
+  ret void
+}
@@ -0,0 +1,67 @@
+; RUN: llc -mtriple=z80 -z80-shadow-spill < %s | FileCheck %s
+; RUN: llc -mtriple=z80 < %s | FileCheck %s --check-prefix=NOSHADOW
+
+@g0 = global i16 0
+@g1 = global i16 0
+@g2 = global i16 0
+@g3 = global i16 0
+@g4 = global i16 0
+@g5 = global i16 0
+@g6 = global i16 0
+
+declare void @f()
+
+; Spilled pairs are moved through a shadow pair between two exx.
+define i16 @shadow() "no-frame-pointer-elim"="true" {
+; CHECK-LABEL: shadow:
+; CHECK: push	{{hl|de|bc|iy}}
+; CHECK-NEXT: exx
+; CHECK-NEXT: pop	{{hl|de|bc}}
+; CHECK-NEXT: exx
+; CHECK: exx
+; CHECK-NEXT: push	{{hl|de|bc}}
+; CHECK-NEXT: exx
+; CHECK-NEXT: pop	{{hl|de|bc|iy}}
+; CHECK: ret
+; NOSHADOW-LABEL: shadow:
+; NOSHADOW-NOT: exx
+; NOSHADOW: ret
+  %v0 = load volatile i16, i16* @g0
+  %v1 = load volatile i16, i16* @g1
+  %v2 = load volatile i16, i16* @g2
+  %v3 = load volatile i16, i16* @g3
+  %v4 = load volatile i16, i16* @g4
+  %v5 = load volatile i16, i16* @g5
+  %v6 = load volatile i16, i16* @g6
+  %s5 = add i16 %v6, %v5
+  %s4 = add i16 %s5, %v4
+  %s3 = add i16 %s4, %v3
+  %s2 = add i16 %s3, %v2
+  %s1 = add i16 %s2, %v1
+  %s0 = add i16 %s1, %v0
+  ret i16 %s0
+}
+
+; Calls may use the shadow registers, so nothing is kept in them across one.
+define i16 @across_call() "no-frame-pointer-elim"="true" {
+; CHECK-LABEL: across_call:
+; CHECK-NOT: exx
+; CHECK: call	{{_?}}f
+; CHECK-NOT: exx
+; CHECK: ret
+  %v0 = load volatile i16, i16* @g0
+  %v1 = load volatile i16, i16* @g1
+  %v2 = load volatile i16, i16* @g2
+  %v3 = load volatile i16, i16* @g3
+  %v4 = load volatile i16, i16* @g4
+  %v5 = load volatile i16, i16* @g5
+  %v6 = load volatile i16, i16* @g6
+  call void @f()
+  %s5 = add i16 %v6, %v5
+  %s4 = add i16 %s5, %v4
+  %s3 = add i16 %s4, %v3
+  %s2 = add i16 %s3, %v2
+  %s1 = add i16 %s2, %v1
+  %s0 = add i16 %s1, %v0
+  ret i16 %s0
+}
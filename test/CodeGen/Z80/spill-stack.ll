@@ -0,0 +1,65 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=z80 -no-z80-stack-spill < %s \
+; RUN:   | FileCheck %s --check-prefix=NOSTACK
+
+@g0 = global i16 0
+@g1 = global i16 0
+@g2 = global i16 0
+@g3 = global i16 0
+@g4 = global i16 0
+@g5 = global i16 0
+@g6 = global i16 0
+
+; Seven words are live at once, so some are spilled.  Their live ranges nest,
+; so they are kept on the stack with pushes and pops instead of being stored
+; to the frame.
+define i16 @nested() "no-frame-pointer-elim"="true" {
+; CHECK-LABEL: nested:
+; CHECK-NOT: ld	(ix - {{[0-9]+}}),
+; CHECK: push	{{hl|de|bc|iy}}
+; CHECK-NOT: ld	(ix - {{[0-9]+}}),
+; CHECK: pop	{{hl|de|bc|iy}}
+; CHECK-NOT: (ix - {{[0-9]+}})
+; CHECK: ret
+; NOSTACK-LABEL: nested:
+; NOSTACK: ld	(ix - {{[0-9]+}}),
+; NOSTACK: ld	{{[a-z]+}}, (ix - {{[0-9]+}})
+; NOSTACK: ret
+  %v0 = load volatile i16, i16* @g0
+  %v1 = load volatile i16, i16* @g1
+  %v2 = load volatile i16, i16* @g2
+  %v3 = load volatile i16, i16* @g3
+  %v4 = load volatile i16, i16* @g4
+  %v5 = load volatile i16, i16* @g5
+  %v6 = load volatile i16, i16* @g6
+  %s5 = add i16 %v6, %v5
+  %s4 = add i16 %s5, %v4
+  %s3 = add i16 %s4, %v3
+  %s2 = add i16 %s3, %v2
+  %s1 = add i16 %s2, %v1
+  %s0 = add i16 %s1, %v0
+  ret i16 %s0
+}
+
+; Without a frame pointer, frame accesses between a push and its pop are kept,
+; with their offsets moved past the pushed value.
+define i16 @frameless() {
+; CHECK-LABEL: frameless:
+; CHECK: push	{{hl|de|bc|iy}}
+; CHECK: pop	{{hl|de|bc|iy}}
+; CHECK: ret
+  %v0 = load volatile i16, i16* @g0
+  %v1 = load volatile i16, i16* @g1
+  %v2 = load volatile i16, i16* @g2
+  %v3 = load volatile i16, i16* @g3
+  %v4 = load volatile i16, i16* @g4
+  %v5 = load volatile i16, i16* @g5
+  %v6 = load volatile i16, i16* @g6
+  %s5 = add i16 %v6, %v5
+  %s4 = add i16 %s5, %v4
+  %s3 = add i16 %s4, %v3
+  %s2 = add i16 %s3, %v2
+  %s1 = add i16 %s2, %v1
+  %s0 = add i16 %s1, %v0
+  ret i16 %s0
+}
@@ -0,0 +1,51 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+
+; Stack adjustments are costed in T-states from the scheduling model, and in
+; bytes when optimizing for size.
+
+; Two pushes take 22 T-states, which beats the 27 of ld, add, and ld sp.
+define void @frame4() {
+; CHECK-LABEL: frame4:
+; CHECK: push	hl
+; CHECK-NEXT: push	hl
+; CHECK: pop	iy
+; CHECK-NEXT: pop	iy
+; CHECK-NEXT: ret
+  %a = alloca [4 x i8]
+  %p = getelementptr [4 x i8], [4 x i8]* %a, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  ret void
+}
+
+; Three pushes take 33 T-states, so sp is computed instead.
+define void @frame6() {
+; CHECK-LABEL: frame6:
+; CHECK-NOT: push
+; CHECK: ld	hl, -6
+; CHECK-NEXT: add	hl, sp
+; CHECK-NEXT: ld	sp, hl
+; CHECK: ld	iy, 6
+; CHECK-NEXT: add	iy, sp
+; CHECK-NEXT: ld	sp, iy
+; CHECK-NEXT: ret
+  %a = alloca [6 x i8]
+  %p = getelementptr [6 x i8], [6 x i8]* %a, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  ret void
+}
+
+; Three pushes take 3 bytes, which beats the 5 of computing sp.
+define void @frame6_optsize() optsize {
+; CHECK-LABEL: frame6_optsize:
+; CHECK: push	hl
+; CHECK-NEXT: push	hl
+; CHECK-NEXT: push	hl
+; CHECK: pop	iy
+; CHECK-NEXT: pop	iy
+; CHECK-NEXT: pop	iy
+; CHECK-NEXT: ret
+  %a = alloca [6 x i8]
+  %p = getelementptr [6 x i8], [6 x i8]* %a, i16 0, i16 0
+  store volatile i8 0, i8* %p
+  ret void
+}
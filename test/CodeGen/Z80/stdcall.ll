@@ -0,0 +1,61 @@
+; RUN: llc -mtriple=z80 < %s | FileCheck %s
+; RUN: llc -mtriple=ez80 < %s | FileCheck %s --check-prefix=EZ80
+
+declare x86_stdcallcc void @callee_pop(i16, i16)
+declare void @caller_pop(i16, i16)
+
+; A stdcall function pops its own arguments: the return address is popped
+; first, then the arguments are dropped, and it returns through the register.
+define x86_stdcallcc void @pop_void(i16 %a, i16 %b) {
+; CHECK-LABEL: pop_void:
+; CHECK: pop	hl
+; CHECK-NEXT: pop	de
+; CHECK-NEXT: pop	de
+; CHECK-NEXT: jp	(hl)
+; EZ80-LABEL: pop_void:
+; EZ80: pop	hl
+; EZ80-NEXT: pop	de
+; EZ80-NEXT: pop	de
+; EZ80-NEXT: jp	(hl)
+  ret void
+}
+
+; The result in hl leaves the return address to iy.
+define x86_stdcallcc i16 @pop_result(i16 %a, i16 %b) {
+; CHECK-LABEL: pop_result:
+; CHECK: pop	iy
+; CHECK-NEXT: pop	de
+; CHECK-NEXT: pop	de
+; CHECK-NEXT: jp	(iy)
+  %r = add i16 %a, %b
+  ret i16 %r
+}
+
+; Variadic functions leave the cleanup to the caller.
+define x86_stdcallcc void @vararg(i16 %a, ...) {
+; CHECK-LABEL: vararg:
+; CHECK-NOT: jp	(
+; CHECK: ret
+  ret void
+}
+
+; The caller of a stdcall function does not free the arguments.
+define void @call_stdcall() {
+; CHECK-LABEL: call_stdcall:
+; CHECK: call	{{_?}}callee_pop
+; CHECK-NOT: pop	{{hl|de|bc|iy}}
+; CHECK-NOT: inc	sp
+; CHECK: pop	ix
+; CHECK-NEXT: ret
+  call x86_stdcallcc void @callee_pop(i16 1, i16 2)
+  ret void
+}
+
+define void @call_cdecl() {
+; CHECK-LABEL: call_cdecl:
+; CHECK: call	{{_?}}caller_pop
+; CHECK-NEXT: pop	{{hl|de|bc|iy}}
+; CHECK-NEXT: pop	{{hl|de|bc|iy}}
+  call void @caller_pop(i16 1, i16 2)
+  ret void
+}
@@ -0,0 +1,54 @@
+; RUN: llvm-mc -triple=ez80 -show-encoding %s | FileCheck %s
+
+; In ADL mode, words are 24 bits and .sis selects 16-bit operation.
+; CHECK: ld	hl, 1193046                 ; encoding: [0x21,0x56,0x34,0x12]
+	ld	hl, 1193046
+; CHECK: ld.sis	hl, 4660                ; encoding: [0x40,0x21,0x34,0x12]
+	ld.sis	hl, 4660
+; CHECK: add.sis	hl, de                 ; encoding: [0x40,0x19]
+	add.sis	hl, de
+; CHECK: push	hl                        ; encoding: [0xe5]
+	push	hl
+; CHECK: call	1193046                   ; encoding: [0xcd,0x56,0x34,0x12]
+	call	1193046
+; CHECK: ld	a, (1193046)                ; encoding: [0x3a,0x56,0x34,0x12]
+	ld	a, (1193046)
+
+; Word loads and stores through pointers
+; CHECK: ld	bc, (hl)                    ; encoding: [0xed,0x07]
+	ld	bc, (hl)
+; CHECK: ld	(hl), de                    ; encoding: [0xed,0x1f]
+	ld	(hl), de
+; CHECK: ld	hl, (ix + 3)                ; encoding: [0xdd,0x27,0x03]
+	ld	hl, (ix + 3)
+; CHECK: ld	(iy - 3), bc                ; encoding: [0xfd,0x0f,0xfd]
+	ld	(iy - 3), bc
+; CHECK: ld	ix, (ix + 6)                ; encoding: [0xdd,0x37,0x06]
+	ld	ix, (ix + 6)
+; CHECK: ld	iy, (ix + 6)                ; encoding: [0xdd,0x31,0x06]
+	ld	iy, (ix + 6)
+; CHECK: ld	(iy + 9), iy                ; encoding: [0xfd,0x3f,0x09]
+	ld	(iy + 9), iy
+
+; eZ80 and Z180 additions
+; CHECK: lea	hl, ix + 2                 ; encoding: [0xed,0x22,0x02]
+	lea	hl, ix + 2
+; CHECK: lea	iy, iy - 4                 ; encoding: [0xed,0x33,0xfc]
+	lea	iy, iy - 4
+; CHECK: pea	iy - 1                     ; encoding: [0xed,0x66,0xff]
+	pea	iy - 1
+; CHECK: mlt	bc                         ; encoding: [0xed,0x4c]
+	mlt	bc
+; CHECK: tst	a, b                       ; encoding: [0xed,0x04]
+	tst	a, b
+; CHECK: tst	a, 15                      ; encoding: [0xed,0x64,0x0f]
+	tst	a, 15
+
+; Outside of ADL mode, words are 16 bits and .lil selects 24-bit operation.
+	.assume	adl = 0
+; CHECK: encoding: [0x21,0x34,0x12]
+	ld	hl, 4660
+; CHECK: encoding: [0x5b,0x21,0x56,0x34,0x12]
+	ld.lil	hl, 1193046
+; CHECK: encoding: [0xcd,0x34,0x12]
+	call	4660
@@ -0,0 +1,20 @@
+; RUN: not llvm-mc -triple=z80 %s 2>&1 | FileCheck %s
+
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: invalid instruction mnemonic
+	foo	a
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: invalid instruction suffix
+	ld.xyz	a, b
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: expected ')'
+	ld	a, (hl + 1)
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: invalid register in memory operand
+	ld	a, (de + 1)
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: invalid operand for instruction
+	ld	h, ixl
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: instruction requires a CPU feature not currently enabled
+	lea	hl, ix + 2
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: expected 'adl'
+	.assume	mode = 0
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: adl must be 0 or 1
+	.assume	adl = 2
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: adl mode requires an eZ80
+	.assume	adl = 1
@@ -0,0 +1,34 @@
+; RUN: llvm-mc -triple=z80 %s | FileCheck %s
+; RUN: llvm-mc -triple=z80 %s | llvm-mc -triple=z80 | FileCheck %s
+
+; Mnemonics and registers are case insensitive, and spacing is free.
+; CHECK: ld	a, b
+	LD	A, B
+; CHECK: ld	a, (ix + 5)
+	ld a,(IX+5)
+; CHECK: ld	(iy - 2), c
+	ld (iy-2),c
+; CHECK: ld	hl, 4660
+	ld hl,0x1234
+; CHECK: ex	de, hl
+	EX DE,HL
+; CHECK: push	af
+	push AF
+
+; c is both a register and a condition.
+; CHECK: jr	c, label
+	jr c,label
+; CHECK: jp	z, label
+	jp Z,label
+; CHECK: ret	nc
+	ret nc
+
+; CHECK: label:
+label:
+; CHECK: ld	a, label
+	ld a,label
+; CHECK: call	label+2
+	call label+2
+
+; CHECK: .assume	adl = 0
+	.assume adl = 0
@@ -0,0 +1,11 @@
+; RUN: not llvm-mc -triple=z80 -filetype=obj %s -o /dev/null 2>&1 | FileCheck %s
+
+; An explicit jr or djnz is never relaxed.
+
+; CHECK: [[@LINE+1]]:{{[0-9]+}}: error: relative branch out of range
+	jr	1f
+	.space	128
+1:
+; CHECK: [[@LINE+2]]:{{[0-9]+}}: error: relative branch out of range
+	.space	127
+	djnz	1b
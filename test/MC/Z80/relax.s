@@ -0,0 +1,48 @@
+; RUN: llvm-mc -triple=z80 -filetype=obj %s -o - | llvm-objdump -s - \
+; RUN:   | FileCheck %s
+
+; A jq is encoded as a jr while its target is within -128 to +127 bytes of the
+; end of the branch, and relaxed to a jp otherwise.
+
+; CHECK-LABEL: Contents of section .text.fwd127:
+; CHECK-NEXT: 0000 187f0000
+	.section	.text.fwd127,"ax",@progbits
+	jq	1f
+	.space	127
+1:
+
+; CHECK-LABEL: Contents of section .text.fwd128:
+; CHECK-NEXT: 0000 c3
+	.section	.text.fwd128,"ax",@progbits
+	jq	1f
+	.space	128
+1:
+
+; CHECK-LABEL: Contents of section .text.back128:
+; CHECK: 0070 00000000 00000000 00000000 00001880
+	.section	.text.back128,"ax",@progbits
+1:
+	.space	126
+	jq	1b
+
+; CHECK-LABEL: Contents of section .text.back129:
+; CHECK: 0070 00000000 00000000 00000000 000000c3
+	.section	.text.back129,"ax",@progbits
+1:
+	.space	127
+	jq	1b
+
+; A conditional jq relaxes the same way, to a jp with the same condition.
+; CHECK-LABEL: Contents of section .text.cond127:
+; CHECK-NEXT: 0000 207f0000
+	.section	.text.cond127,"ax",@progbits
+	jq	nz, 1f
+	.space	127
+1:
+
+; CHECK-LABEL: Contents of section .text.cond128:
+; CHECK-NEXT: 0000 da
+	.section	.text.cond128,"ax",@progbits
+	jq	c, 1f
+	.space	128
+1:
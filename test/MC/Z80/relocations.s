@@ -0,0 +1,40 @@
+; RUN: llvm-mc -triple=z80 -filetype=obj %s -o - | llvm-readobj -r - \
+; RUN:   | FileCheck %s
+; RUN: llvm-mc -triple=ez80 -filetype=obj %s -o - | llvm-readobj -r - \
+; RUN:   | FileCheck --check-prefix=EZ80 %s
+
+; CHECK:      Relocations [
+; CHECK-NEXT:   Section {{.*}} .rel.text {
+; CHECK-NEXT:     0x1 R_Z80_8 foo
+; CHECK-NEXT:     0x3 R_Z80_16 foo
+; CHECK-NEXT:     0x6 R_Z80_16 foo
+; CHECK-NEXT:     0x9 R_Z80_8_PCREL foo
+; CHECK-NEXT:     0xA R_Z80_8 foo
+; CHECK-NEXT:     0xB R_Z80_16 foo
+; CHECK-NEXT:     0xF R_Z80_8_DIS foo
+; CHECK-NEXT:     0x11 R_Z80_16 foo
+; CHECK-NEXT:   }
+; CHECK-NEXT: ]
+
+; EZ80:      Relocations [
+; EZ80-NEXT:   Section {{.*}} .rel.text {
+; EZ80-NEXT:     0x1 R_Z80_8 foo
+; EZ80-NEXT:     0x3 R_Z80_24 foo
+; EZ80-NEXT:     0x7 R_Z80_24 foo
+; EZ80-NEXT:     0xB R_Z80_8_PCREL foo
+; EZ80-NEXT:     0xC R_Z80_8 foo
+; EZ80-NEXT:     0xD R_Z80_16 foo
+; EZ80-NEXT:     0x11 R_Z80_8_DIS foo
+; EZ80-NEXT:     0x13 R_Z80_24 foo
+; EZ80-NEXT:   }
+; EZ80-NEXT: ]
+
+	ld	a, foo
+	ld	hl, foo
+	call	foo
+	jr	foo
+	.byte	foo
+	.short	foo
+	ld	a, (ix + foo)
+; A jq to an unknown target is relaxed to a jp.
+	jq	foo
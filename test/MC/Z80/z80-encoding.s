@@ -0,0 +1,168 @@
+; RUN: llvm-mc -triple=z80 -show-encoding %s | FileCheck %s
+
+; CHECK: nop                           ; encoding: [0x00]
+	nop
+
+; 8-bit loads
+; CHECK: ld	a, b                        ; encoding: [0x78]
+	ld	a, b
+; CHECK: ld	ixh, ixl                    ; encoding: [0xdd,0x65]
+	ld	ixh, ixl
+; CHECK: ld	c, 42                       ; encoding: [0x0e,0x2a]
+	ld	c, 42
+; CHECK: ld	e, (hl)                     ; encoding: [0x5e]
+	ld	e, (hl)
+; CHECK: ld	d, (ix + 5)                 ; encoding: [0xdd,0x56,0x05]
+	ld	d, (ix + 5)
+; CHECK: ld	(iy - 2), c                 ; encoding: [0xfd,0x71,0xfe]
+	ld	(iy - 2), c
+; CHECK: ld	(hl), 7                     ; encoding: [0x36,0x07]
+	ld	(hl), 7
+; CHECK: ld	(ix + 1), 255               ; encoding: [0xdd,0x36,0x01,0xff]
+	ld	(ix + 1), 255
+; CHECK: ld	a, (4660)                   ; encoding: [0x3a,0x34,0x12]
+	ld	a, (4660)
+; CHECK: ld	(4660), a                   ; encoding: [0x32,0x34,0x12]
+	ld	(4660), a
+
+; 16-bit loads
+; CHECK: ld	hl, 4660                    ; encoding: [0x21,0x34,0x12]
+	ld	hl, 4660
+; CHECK: ld	ix, 4660                    ; encoding: [0xdd,0x21,0x34,0x12]
+	ld	ix, 4660
+; CHECK: ld	hl, (4660)                  ; encoding: [0x2a,0x34,0x12]
+	ld	hl, (4660)
+; CHECK: ld	de, (4660)                  ; encoding: [0xed,0x5b,0x34,0x12]
+	ld	de, (4660)
+; CHECK: ld	(4660), bc                  ; encoding: [0xed,0x43,0x34,0x12]
+	ld	(4660), bc
+; CHECK: ld	sp, hl                      ; encoding: [0xf9]
+	ld	sp, hl
+; CHECK: ld	sp, ix                      ; encoding: [0xdd,0xf9]
+	ld	sp, ix
+; CHECK: push	af                        ; encoding: [0xf5]
+	push	af
+; CHECK: push	bc                        ; encoding: [0xc5]
+	push	bc
+; CHECK: pop	ix                         ; encoding: [0xdd,0xe1]
+	pop	ix
+; CHECK: ex	de, hl                      ; encoding: [0xeb]
+	ex	de, hl
+; CHECK: ex	(sp), hl                    ; encoding: [0xe3]
+	ex	(sp), hl
+; CHECK: ex	af, af'                     ; encoding: [0x08]
+	ex	af, af'
+; CHECK: exx                           ; encoding: [0xd9]
+	exx
+
+; 8-bit arithmetic
+; CHECK: add	a, c                       ; encoding: [0x81]
+	add	a, c
+; CHECK: adc	a, 1                       ; encoding: [0xce,0x01]
+	adc	a, 1
+; CHECK: sub	a, (hl)                    ; encoding: [0x96]
+	sub	a, (hl)
+; CHECK: sbc	a, (ix + 3)                ; encoding: [0xdd,0x9e,0x03]
+	sbc	a, (ix + 3)
+; CHECK: and	a, e                       ; encoding: [0xa3]
+	and	a, e
+; CHECK: xor	a, a                       ; encoding: [0xaf]
+	xor	a, a
+; CHECK: or	a, 128                      ; encoding: [0xf6,0x80]
+	or	a, 128
+; CHECK: cp	a, l                        ; encoding: [0xbd]
+	cp	a, l
+; CHECK: inc	b                          ; encoding: [0x04]
+	inc	b
+; CHECK: dec	(hl)                       ; encoding: [0x35]
+	dec	(hl)
+; CHECK: inc	(ix + 2)                   ; encoding: [0xdd,0x34,0x02]
+	inc	(ix + 2)
+; CHECK: rlc	b                          ; encoding: [0xcb,0x00]
+	rlc	b
+; CHECK: rr	(hl)                        ; encoding: [0xcb,0x1e]
+	rr	(hl)
+; CHECK: sla	a                          ; encoding: [0xcb,0x27]
+	sla	a
+; CHECK: sra	c                          ; encoding: [0xcb,0x29]
+	sra	c
+; CHECK: srl	(iy + 4)                   ; encoding: [0xfd,0xcb,0x04,0x3e]
+	srl	(iy + 4)
+; CHECK: scf                           ; encoding: [0x37]
+	scf
+; CHECK: ccf                           ; encoding: [0x3f]
+	ccf
+
+; 16-bit arithmetic
+; CHECK: inc	hl                         ; encoding: [0x23]
+	inc	hl
+; CHECK: dec	de                         ; encoding: [0x1b]
+	dec	de
+; CHECK: inc	ix                         ; encoding: [0xdd,0x23]
+	inc	ix
+; CHECK: add	hl, hl                     ; encoding: [0x29]
+	add	hl, hl
+; CHECK: add	hl, bc                     ; encoding: [0x09]
+	add	hl, bc
+; CHECK: add	ix, de                     ; encoding: [0xdd,0x19]
+	add	ix, de
+; CHECK: add	hl, sp                     ; encoding: [0x39]
+	add	hl, sp
+; CHECK: sbc	hl, de                     ; encoding: [0xed,0x52]
+	sbc	hl, de
+; CHECK: adc	hl, bc                     ; encoding: [0xed,0x4a]
+	adc	hl, bc
+; CHECK: sbc	hl, sp                     ; encoding: [0xed,0x72]
+	sbc	hl, sp
+
+; Block transfers
+; CHECK: ldi                           ; encoding: [0xed,0xa0]
+	ldi
+; CHECK: ldir                          ; encoding: [0xed,0xb0]
+	ldir
+; CHECK: lddr                          ; encoding: [0xed,0xb8]
+	lddr
+
+; Control flow
+; CHECK: di                            ; encoding: [0xf3]
+	di
+; CHECK: ei                            ; encoding: [0xfb]
+	ei
+; CHECK: ret                           ; encoding: [0xc9]
+	ret
+; CHECK: ret	nz                         ; encoding: [0xc0]
+	ret	nz
+; CHECK: ret	m                          ; encoding: [0xf8]
+	ret	m
+; CHECK: reti                          ; encoding: [0xed,0x4d]
+	reti
+; CHECK: retn                          ; encoding: [0xed,0x45]
+	retn
+; CHECK: rst	56                         ; encoding: [0xff]
+	rst	56
+; CHECK: jp	(hl)                        ; encoding: [0xe9]
+	jp	(hl)
+; CHECK: jp	(ix)                        ; encoding: [0xdd,0xe9]
+	jp	(ix)
+; CHECK: jp	4660                        ; encoding: [0xc3,0x34,0x12]
+	jp	4660
+; CHECK: jp	pe, 4660                    ; encoding: [0xea,0x34,0x12]
+	jp	pe, 4660
+; CHECK: call	4660                      ; encoding: [0xcd,0x34,0x12]
+	call	4660
+; CHECK: call	z, 4660                   ; encoding: [0xcc,0x34,0x12]
+	call	z, 4660
+
+; Relative branches leave the displacement to a fixup.
+; CHECK: jr	foo                         ; encoding: [0x18,A]
+; CHECK-NEXT: fixup A - offset: 1, value: foo-1, kind: fixup_8_pcrel
+	jr	foo
+; CHECK: jr	nz, foo                     ; encoding: [0x20,A]
+; CHECK-NEXT: fixup A - offset: 1, value: foo-1, kind: fixup_8_pcrel
+	jr	nz, foo
+; CHECK: jr	c, foo                      ; encoding: [0x38,A]
+; CHECK-NEXT: fixup A - offset: 1, value: foo-1, kind: fixup_8_pcrel
+	jr	c, foo
+; CHECK: djnz	foo                       ; encoding: [0x10,A]
+; CHECK-NEXT: fixup A - offset: 1, value: foo-1, kind: fixup_8_pcrel
+	djnz	foo
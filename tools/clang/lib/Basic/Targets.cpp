@@ -8323,12 +8323,23 @@ public:
     PtrDiffType = IntPtrType = SignedInt;
     Char32Type = UnsignedLong;
     UseBitFieldTypeAlignment = false;
+    // regparm arguments go in hl, de, and bc, with bytes in a, l, e, and c.
+    RegParmMax = 3;
   }
   bool hasInt48Type() const override { return true; }
   ArrayRef<Builtin::Info> getTargetBuiltins() const final { return None; }
   BuiltinVaListKind getBuiltinVaListKind() const override {
     return TargetInfo::VoidPtrBuiltinVaList;
   }
+  CallingConvCheckResult checkCallingConvention(CallingConv CC) const override {
+    switch (CC) {
+    default:
+      return CCCR_Warning;
+    case CC_C:
+    case CC_X86StdCall: // The callee pops its arguments.
+      return CCCR_OK;
+    }
+  }
   bool validateAsmConstraint(const char *&Name,
                              TargetInfo::ConstraintInfo &Info) const override {
     return false;
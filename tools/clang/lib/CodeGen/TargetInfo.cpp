@@ -6342,6 +6342,88 @@ void MSP430TargetCodeGenInfo::setTargetAttributes(const Decl *D,
   }
 }
 
+//===----------------------------------------------------------------------===//
+// Z80 ABI Implementation
+//===----------------------------------------------------------------------===//
+
+namespace {
+
+class Z80ABIInfo : public DefaultABIInfo {
+  // The number of arguments passed in registers without a regparm attribute.
+  unsigned DefaultNumRegisterParameters;
+
+public:
+  Z80ABIInfo(CodeGen::CodeGenTypes &CGT, unsigned NumRegisterParameters)
+      : DefaultABIInfo(CGT),
+        DefaultNumRegisterParameters(NumRegisterParameters) {}
+
+  bool shouldUseInReg(QualType Ty, CCState &State) const;
+
+  void computeInfo(CGFunctionInfo &FI) const override {
+    CCState State(FI.getCallingConvention());
+    // Variadic functions take all of their arguments on the stack.
+    if (!FI.isVariadic())
+      State.FreeRegs = FI.getHasRegParm() ? FI.getRegParm()
+                                          : DefaultNumRegisterParameters;
+
+    if (!getCXXABI().classifyReturnType(FI))
+      FI.getReturnInfo() = classifyReturnType(FI.getReturnType());
+    for (auto &I : FI.arguments())
+      I.info = classifyArgumentType(I.type, State);
+  }
+
+  ABIArgInfo classifyArgumentType(QualType Ty, CCState &State) const;
+};
+
+class Z80TargetCodeGenInfo : public TargetCodeGenInfo {
+public:
+  Z80TargetCodeGenInfo(CodeGen::CodeGenTypes &CGT,
+                       unsigned NumRegisterParameters)
+      : TargetCodeGenInfo(new Z80ABIInfo(CGT, NumRegisterParameters)) {}
+};
+
+} // end anonymous namespace
+
+/// shouldUseInReg - Each register holds a byte or a pointer sized word, and an
+/// argument only goes in registers if all of it fits in the ones that are left.
+bool Z80ABIInfo::shouldUseInReg(QualType Ty, CCState &State) const {
+  unsigned Size = getContext().getTypeSize(Ty);
+  unsigned PtrWidth = getTarget().getPointerWidth(0);
+  unsigned SizeInRegs = llvm::alignTo(Size, PtrWidth) / PtrWidth;
+
+  if (SizeInRegs == 0)
+    return false;
+
+  if (SizeInRegs > State.FreeRegs) {
+    State.FreeRegs = 0;
+    return false;
+  }
+
+  State.FreeRegs -= SizeInRegs;
+  return true;
+}
+
+ABIArgInfo Z80ABIInfo::classifyArgumentType(QualType Ty,
+                                            CCState &State) const {
+  // Aggregates are always passed in memory.
+  if (isAggregateTypeForABI(Ty))
+    return DefaultABIInfo::classifyArgumentType(Ty);
+
+  // Treat an enum type as its underlying type.
+  if (const EnumType *EnumTy = Ty->getAs<EnumType>())
+    Ty = EnumTy->getDecl()->getIntegerType();
+
+  bool InReg = shouldUseInReg(Ty, State);
+  if (Ty->isPromotableIntegerType()) {
+    if (InReg)
+      return ABIArgInfo::getExtendInReg();
+    return ABIArgInfo::getExtend();
+  }
+  if (InReg)
+    return ABIArgInfo::getDirectInReg();
+  return ABIArgInfo::getDirect();
+}
+
 //===----------------------------------------------------------------------===//
 // MIPS ABI Implementation.  This works for both little-endian and
 // big-endian variants.
@@ -8305,6 +8387,11 @@ const TargetCodeGenInfo &CodeGenModule::getTargetCodeGenInfo() {
   case llvm::Triple::msp430:
     return SetCGInfo(new MSP430TargetCodeGenInfo(Types));
 
+  case llvm::Triple::z80:
+  case llvm::Triple::ez80:
+    return SetCGInfo(
+        new Z80TargetCodeGenInfo(Types, CodeGenOpts.NumRegisterParameters));
+
   case llvm::Triple::systemz: {
     bool HasVector = getTarget().getABI() == "vector";
     return SetCGInfo(new SystemZTargetCodeGenInfo(Types, HasVector));